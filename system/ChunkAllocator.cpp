@@ -36,6 +36,7 @@
 #include "LocaleSharedMemory.hpp"
 #include "TaskingScheduler.hpp"
 #include "Communicator.hpp"
+#include "Topology.hpp"
 
 #include "Metrics.hpp"
 
@@ -102,6 +103,8 @@ static void _aligned_allocator_append_chunk(struct aligned_allocator *aa,
     new_chunk->chunk_size = std::max(min_size, aa->chunk_size) + aa->align_on;
     new_chunk->chunk = Grappa::locale_alloc_aligned<char>(CACHE_LINE_SIZE, new_chunk->chunk_size);
     CHECK_NOTNULL(new_chunk->chunk);
+    // message pools are per-core, so keep them near the core that fills them
+    Grappa::impl::topology.bind_local(new_chunk->chunk, new_chunk->chunk_size);
 
     auto chunk_size = sizeof(new_chunk->chunk_size);
     shared_pool_total_allocated += std::max( new_chunk->chunk_size, (decltype(chunk_size)) CACHE_LINE_SIZE );
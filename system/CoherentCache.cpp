@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#include "CoherentCache.hpp"
+#include "Delegate.hpp"
+#include "GlobalCompletionEvent.hpp"
+#include "Message.hpp"
+#include "LocaleSharedMemory.hpp"
+#include <algorithm>
+
+DEFINE_int64( coherent_cache_lines, 4096, "Number of blocks each core's coherent cache can hold" );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_hits, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_misses, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_evictions, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_invalidations_sent, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_invalidations_received, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, coherent_cache_stale_replies, 0 );
+
+namespace Grappa {
+namespace impl {
+
+/// global CoherentCache instance
+CoherentCache global_coherent_cache;
+
+/// contents of one block, as sent from home
+struct CoherentBlock {
+  char data[ BLOCK_SIZE ];
+  uint64_t version;
+};
+
+static const char * block_of( const char * p ) {
+  return reinterpret_cast< const char * >( reinterpret_cast< uintptr_t >( p ) & ~static_cast< uintptr_t >( block_size - 1 ) );
+}
+
+void CoherentCache::init() {
+  CHECK_GT( FLAGS_coherent_cache_lines, 0 );
+  lines.resize( FLAGS_coherent_cache_lines );
+  char * storage = static_cast< char * >( locale_shared_memory.allocate_aligned( FLAGS_coherent_cache_lines * block_size, block_size ) );
+  CHECK_NOTNULL( storage );
+  for( int64_t i = FLAGS_coherent_cache_lines - 1; i >= 0; --i ) {
+    lines[i].data = storage + i * block_size;
+    free_lines.push_back( &lines[i] );
+  }
+}
+
+void CoherentCache::unlink( Line * l ) {
+  if( l->prev ) l->prev->next = l->next; else lru_head = l->next;
+  if( l->next ) l->next->prev = l->prev; else lru_tail = l->prev;
+  l->prev = l->next = NULL;
+}
+
+void CoherentCache::push_front( Line * l ) {
+  l->prev = NULL;
+  l->next = lru_head;
+  if( lru_head ) lru_head->prev = l; else lru_tail = l;
+  lru_head = l;
+}
+
+void CoherentCache::install( Key key, uint64_t version, const char * data ) {
+  auto it = index.find( key );
+  Line * l = NULL;
+  if( it != index.end() ) {
+    // another miss on the same block got here first
+    l = it->second;
+    if( l->version > version ) return;
+    unlink( l );
+  } else {
+    if( free_lines.empty() ) {
+      // evict the least recently used line; its home keeps us as a
+      // sharer until the next write, which just costs a spare invalidation
+      Line * victim = lru_tail;
+      unlink( victim );
+      index.erase( victim->key );
+      free_lines.push_back( victim );
+      coherent_cache_evictions++;
+    }
+    l = free_lines.back();
+    free_lines.pop_back();
+    l->key = key;
+    index[ key ] = l;
+  }
+  l->version = version;
+  memcpy( l->data, data, block_size );
+  push_front( l );
+}
+
+void CoherentCache::read( Core home, const char * p, void * result, size_t size ) {
+  const char * block = block_of( p );
+  size_t offset = p - block;
+  CHECK_LE( offset + size, block_size ) << "coherent reads must lie within one block";
+
+  if( lines.empty() ) init();
+
+  Key key = key_of( home, block );
+  auto it = index.find( key );
+  if( it != index.end() ) {
+    coherent_cache_hits++;
+    Line * l = it->second;
+    unlink( l );
+    push_front( l );
+    memcpy( result, l->data + offset, size );
+    return;
+  }
+
+  coherent_cache_misses++;
+  Pending& before = pending[ key ];
+  if( before.count++ == 0 ) before.invalidated = 0;
+
+  Core me = mycore();
+  CoherentBlock reply = delegate::call( home, [block, me]() -> CoherentBlock {
+      CoherentBlock b;
+      b.version = global_coherent_cache.add_sharer( block, me );
+      memcpy( b.data, block, block_size );
+      return b;
+    });
+
+  memcpy( result, reply.data + offset, size );
+
+  // an invalidation for a newer write may have overtaken the reply;
+  // the value is still fine to return but must not be cached
+  auto pit = pending.find( key );
+  if( pit->second.invalidated > reply.version ) {
+    coherent_cache_stale_replies++;
+  } else {
+    install( key, reply.version, reply.data );
+  }
+  if( --pit->second.count == 0 ) pending.erase( pit );
+}
+
+void PendingCompletion::acknowledge() {
+  if( --remaining == 0 ) {
+    if( gce ) gce->send_completion( origin );
+    delete this;
+  }
+}
+
+static void acknowledge( InvalidationAck ack ) {
+  if( ack.waiter ) ack.waiter->acknowledge();
+  if( ack.completion ) ack.completion->acknowledge();
+}
+
+void CoherentCache::invalidate( Core home, const char * block, uint64_t version, InvalidationAck ack ) {
+  coherent_cache_invalidations_received++;
+  Key key = key_of( home, block );
+  auto it = index.find( key );
+  if( it != index.end() && it->second->version < version ) {
+    Line * l = it->second;
+    unlink( l );
+    index.erase( it );
+    free_lines.push_back( l );
+  }
+  auto pit = pending.find( key );
+  if( pit != pending.end() && pit->second.invalidated < version ) {
+    pit->second.invalidated = version;
+  }
+
+  if( ack.core == mycore() ) {
+    acknowledge( ack );
+  } else {
+    send_heap_message( ack.core, [ack] { acknowledge( ack ); } );
+  }
+}
+
+uint64_t CoherentCache::add_sharer( const char * block, Core sharer ) {
+  DirectoryEntry& entry = directory[ reinterpret_cast< uintptr_t >( block ) ];
+  if( std::find( entry.sharers.begin(), entry.sharers.end(), sharer ) == entry.sharers.end() ) {
+    entry.sharers.push_back( sharer );
+  }
+  return entry.version;
+}
+
+uint64_t CoherentCache::written_slow( const void * p, size_t size, Core origin,
+                                      InvalidationWait * waiter, GlobalCompletionEvent * gce, bool async ) {
+  const char * first = block_of( static_cast< const char * >( p ) );
+  const char * last = static_cast< const char * >( p ) + size;
+
+  uint64_t sent = 0;
+  for( const char * block = first; block < last; block += block_size ) {
+    auto it = directory.find( reinterpret_cast< uintptr_t >( block ) );
+    if( it != directory.end() ) sent += it->second.sharers.size();
+  }
+  if( sent == 0 ) return 0;
+
+  InvalidationAck ack;
+  if( async ) {
+    // acknowledgements come back here, and the last one completes
+    ack = InvalidationAck{ mycore(), nullptr, new PendingCompletion{ sent, origin, gce } };
+  } else {
+    ack = InvalidationAck{ origin, waiter, nullptr };
+  }
+
+  Core home = mycore();
+  for( const char * block = first; block < last; block += block_size ) {
+    auto it = directory.find( reinterpret_cast< uintptr_t >( block ) );
+    if( it == directory.end() ) continue;
+
+    // keep the version so a later reader's copy is newer than any
+    // invalidation still in flight; only the sharer list is reset
+    uint64_t version = ++it->second.version;
+    for( auto sharer : it->second.sharers ) {
+      coherent_cache_invalidations_sent++;
+      send_heap_message( sharer, [home, block, version, ack] {
+          global_coherent_cache.invalidate( home, block, version, ack );
+        });
+    }
+    it->second.sharers.clear();
+  }
+  return sent;
+}
+
+} // namespace impl
+} // namespace Grappa
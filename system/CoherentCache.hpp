@@ -0,0 +1,248 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "Addressing.hpp"
+#include "Communicator.hpp"
+#include "Metrics.hpp"
+#include "ConditionVariableLocal.hpp"
+
+DECLARE_int64( coherent_cache_lines );
+
+namespace Grappa {
+
+class GlobalCompletionEvent;
+
+namespace impl {
+
+/// On the core that issued a blocking write: counts acknowledgements
+/// of the invalidations the write caused, so the write can return
+/// only once no sharer can still see the old value.
+class InvalidationWait {
+  uint64_t acked;
+  ConditionVariable cv;
+public:
+  InvalidationWait(): acked(0), cv() {}
+
+  void acknowledge() {
+    acked++;
+    broadcast( &cv );
+  }
+
+  /// Block until `sent` invalidations have been acknowledged.
+  void wait( uint64_t sent ) {
+    while( acked < sent ) Grappa::wait( &cv );
+  }
+};
+
+/// On the home core of an async write: holds back the write's
+/// completion until its invalidations have all been acknowledged.
+struct PendingCompletion {
+  uint64_t remaining;
+  Core origin;
+  GlobalCompletionEvent * gce;
+  void acknowledge();
+};
+
+/// Where a sharer sends the acknowledgement of an invalidation: a
+/// waiter or a pending completion, on `core`.
+struct InvalidationAck {
+  Core core;
+  InvalidationWait * waiter;
+  PendingCompletion * completion;
+};
+
+/// Result of a blocking delegate operation that wrote memory: the
+/// operation's own result, plus how many invalidations to wait for.
+template< typename T >
+struct WithInvalidations {
+  T value;
+  uint64_t invalidations;
+};
+
+/// Coherent cache of remote global memory, one block (BLOCK_SIZE
+/// bytes) at a time. Each core caches blocks it has read in an LRU
+/// set of lines stored in locale shared memory. The home core of a
+/// block keeps a directory of the cores that may have it cached, and
+/// when a delegate operation writes the block it sends each of them
+/// an invalidation.
+///
+/// Sharers acknowledge invalidations. A blocking write returns only
+/// once every sharer has dropped the old value, and an async write's
+/// GlobalCompletionEvent completion is held back the same way. Each
+/// write bumps the block's version so a reply overtaken by an
+/// invalidation is never cached. Only writes made through delegate
+/// operations are tracked.
+class CoherentCache {
+private:
+  /// a block is named by its home core and its address there, packed
+  /// like a 2D GlobalAddress
+  typedef uint64_t Key;
+  static Key key_of( Core home, const char * block ) {
+    return ( static_cast< uint64_t >( home ) << 48 ) | ( reinterpret_cast< uintptr_t >( block ) & ( (1UL << 48) - 1 ) );
+  }
+
+  struct Line {
+    Key key;
+    uint64_t version;
+    char * data;
+    Line * prev;
+    Line * next;
+  };
+
+  /// lines in use, most recently used at the head
+  Line * lru_head;
+  Line * lru_tail;
+  std::vector< Line > lines;
+  std::vector< Line * > free_lines;
+  std::unordered_map< Key, Line * > index;
+
+  /// misses in flight, with the newest invalidation seen while waiting
+  struct Pending {
+    int count;
+    uint64_t invalidated;
+  };
+  std::unordered_map< Key, Pending > pending;
+
+  /// for blocks homed here: who may be caching them
+  struct DirectoryEntry {
+    uint64_t version;
+    std::vector< Core > sharers;
+  };
+  std::unordered_map< uintptr_t, DirectoryEntry > directory;
+
+  void init();
+  void unlink( Line * l );
+  void push_front( Line * l );
+  void install( Key key, uint64_t version, const char * data );
+  uint64_t written_slow( const void * p, size_t size, Core origin,
+                         InvalidationWait * waiter, GlobalCompletionEvent * gce, bool async );
+
+public:
+  CoherentCache()
+    : lru_head( NULL )
+    , lru_tail( NULL )
+    , lines()
+    , free_lines()
+    , index()
+    , pending()
+    , directory()
+  { }
+
+  /// Copy size bytes at p, on core home, into result, from the cache
+  /// if possible. The bytes must lie within one block.
+  void read( Core home, const char * p, void * result, size_t size );
+
+  /// On a sharer: the block at home was written, making versions
+  /// before this one stale. Acknowledges to `ack` once dropped.
+  void invalidate( Core home, const char * block, uint64_t version, InvalidationAck ack );
+
+  /// On home: remember that a core is caching a block, and return the
+  /// block's version.
+  uint64_t add_sharer( const char * block, Core sharer );
+
+  /// On home: called after a blocking delegate operation from
+  /// `origin` writes memory here. Sharers acknowledge to `waiter` on
+  /// origin; returns how many invalidations it should wait for.
+  inline uint64_t written( const void * p, size_t size, Core origin, InvalidationWait * waiter ) {
+    if( directory.empty() ) return 0;
+    return written_slow( p, size, origin, waiter, nullptr, false );
+  }
+
+  /// On home: called after an async delegate operation from `origin`
+  /// writes memory here. If this returns nonzero, the cache has taken
+  /// over sending the operation's completion to `gce` on origin, once
+  /// every invalidation is acknowledged; otherwise the caller sends it.
+  inline uint64_t written_async( const void * p, size_t size, Core origin, GlobalCompletionEvent * gce ) {
+    if( directory.empty() ) return 0;
+    return written_slow( p, size, origin, nullptr, gce, true );
+  }
+};
+
+/// global CoherentCache instance
+extern CoherentCache global_coherent_cache;
+
+/// On home: adds up the invalidations sent by the writes of one
+/// blocking operation from `origin`, for operations that write more
+/// than one location.
+struct WriteAcks {
+  Core origin;
+  InvalidationWait * waiter;
+  uint64_t sent;
+
+  void written( const void * p, size_t size ) {
+    sent += global_coherent_cache.written( p, size, origin, waiter );
+  }
+};
+
+} // namespace impl
+
+namespace coherent {
+
+  /// Read the value at a global address through this core's coherent
+  /// cache. The first read of a remote block fetches it from its home
+  /// core; later reads are local until a delegate write to the block
+  /// invalidates it.
+  /// @warning Target object must lie within one block.
+  ///
+  /// Example:
+  /// @code
+  ///   GlobalAddress<int64_t> table;
+  ///   int64_t x = Grappa::coherent::read( table + i );
+  /// @endcode
+  template< typename T >
+  T read( GlobalAddress<T> target ) {
+    if( target.core() == mycore() ) {
+      return *target.pointer();
+    }
+    T result;
+    impl::global_coherent_cache.read( target.core(), reinterpret_cast< const char * >( target.pointer() ),
+                                      &result, sizeof(T) );
+    return result;
+  }
+
+  template< typename T >
+  T read( GlobalAddress<const T> target ) {
+    return read( static_cast< GlobalAddress<T> >( target ) );
+  }
+
+} // namespace coherent
+} // namespace Grappa
@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+/// Tests for the coherent cache
+
+#include <boost/test/unit_test.hpp>
+
+#include "Grappa.hpp"
+#include "CoherentCache.hpp"
+
+using namespace Grappa;
+
+BOOST_AUTO_TEST_SUITE( CoherentCache_tests );
+
+int64_t shared_data[8] __attribute__ ((aligned (BLOCK_SIZE))) = { 0 };
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  Grappa::init( GRAPPA_TEST_ARGS );
+  Grappa::run([]{
+    BOOST_CHECK_EQUAL( 2, Grappa::cores() );
+
+    call_on_all_cores([]{
+      for( int i = 0; i < 8; ++i ) shared_data[i] = mycore() * 100 + i;
+    });
+
+    auto a = make_global( &shared_data[3], 1 );
+
+    // first read misses, second hits
+    BOOST_CHECK_EQUAL( coherent::read( a ), 103 );
+    BOOST_CHECK_EQUAL( coherent::read( a ), 103 );
+    // a neighbor in the same block comes along for free
+    BOOST_CHECK_EQUAL( coherent::read( make_global( &shared_data[4], 1 ) ), 104 );
+
+    // local reads don't go through the cache
+    BOOST_CHECK_EQUAL( coherent::read( make_global( &shared_data[3] ) ), 3 );
+
+    // a delegate write doesn't return until our copy is invalidated
+    delegate::write( a, 2345 );
+    BOOST_CHECK_EQUAL( coherent::read( a ), 2345 );
+    BOOST_CHECK_EQUAL( coherent::read( make_global( &shared_data[4], 1 ) ), 104 );
+
+    // atomics invalidate too, including ones issued on the home core
+    on_all_cores([a]{ if( mycore() == 1 ) delegate::fetch_and_add( a, 1 ); });
+    BOOST_CHECK_EQUAL( coherent::read( a ), 2346 );
+
+    BOOST_CHECK( delegate::compare_and_swap( a, 2346, 3456 ) );
+    BOOST_CHECK_EQUAL( coherent::read( a ), 3456 );
+
+    delegate::atomic_max( a, 4567 );
+    BOOST_CHECK_EQUAL( coherent::read( a ), 4567 );
+
+    // async writes complete only once the invalidations are acknowledged
+    finish([a]{ delegate::write<async>( a, 5678 ); });
+    BOOST_CHECK_EQUAL( coherent::read( a ), 5678 );
+
+    finish([a]{ delegate::increment<async>( a, 1 ); });
+    BOOST_CHECK_EQUAL( coherent::read( a ), 5679 );
+
+    GlobalAddress<int64_t> as[] = { a };
+    int64_t vs[] = { 6789 };
+    delegate::write_batch( as, vs, 1 );
+    BOOST_CHECK_EQUAL( coherent::read( a ), 6789 );
+
+    Grappa::Metrics::merge_and_print();
+  });
+  Grappa::finalize();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -45,6 +45,7 @@
 
 #include <functional>
 #include <algorithm>
+#include <vector>
 
 // TODO/FIXME: use actual max message size (have Communicator be able to tell us)
 const size_t MAX_MESSAGE_SIZE = 3192;
@@ -203,115 +204,283 @@ namespace Grappa {
   
   namespace impl {
     
-    template<typename T>
-    struct Reduction {
-      static FullEmpty<T> result;
-    };
-    template<typename T> FullEmpty<T> Reduction<T>::result;
+    /// Binomial tree over all cores, rooted at @a root.
+    inline Core tree_rank(Core root) { return (mycore() - root + cores()) % cores(); }
+    
+    inline Core tree_parent(Core root) {
+      Core r = tree_rank(root);
+      if (r == 0) return -1;
+      return (r - (r & -r) + root) % cores();
+    }
     
-    template< typename T, T (*ReduceOp)(const T&, const T&) >
-    void collect_reduction(const T& val) {
-      static T total;
-      static Core cores_in = 0;
+    template<typename F>
+    void for_each_tree_child(Core root, F f) {
+      Core r = tree_rank(root);
+      for (Core mask = 1; mask < cores() && !(r & mask); mask <<= 1) {
+        if (r + mask < cores()) f((r + mask + root) % cores());
+      }
+    }
+    
+    /// Per-core state for collectives built on Grappa messages. Data
+    /// moves in chunks of up to MAX_MESSAGE_SIZE bytes that are either
+    /// combined into or copied over the current call's array. Only the
+    /// calling task blocks, so other tasks on the core keep running.
+    ///
+    /// Other cores may finish a call and start the next one before we
+    /// have entered it, so each call gets a sequence number and chunks
+    /// for later calls are stashed until we get there. This requires
+    /// all cores to make the same sequence of calls for a given type.
+    template< typename T >
+    class MessageCollective {
+    public:
+      enum class Kind : int8_t { Reduce, Write };
+      
+      /// chunks in flight per call before the caller waits for them to be sent
+      static const size_t window = 64;
+      
+      static size_t elems_per_chunk() { return std::max<size_t>(1, MAX_MESSAGE_SIZE / sizeof(T)); }
+      static size_t chunks(size_t nelem) { return (nelem + elems_per_chunk() - 1) / elems_per_chunk(); }
+      
+    protected:
+      struct Chunk {
+        MessageCollective * self;
+        int64_t round;
+        size_t offset;
+        Kind kind;
+        void operator()(void * payload, size_t payload_size) {
+          self->receive(round, kind, offset, static_cast<T*>(payload), payload_size / sizeof(T));
+        }
+      };
+      
+      struct Stashed {
+        int64_t round;
+        Kind kind;
+        size_t offset;
+        std::vector<T> data;
+      };
+      
+      T * array;
+      T (*op)(const T&, const T&);
+      int64_t round;
+      bool active;
+      size_t reduced;
+      size_t written;
+      ConditionVariable cv;
+      std::vector<Stashed> stash;
       
-      DCHECK(mycore() == HOME_CORE);
+      MessagePool * pool;
+      size_t pool_count;
       
-      if (cores_in == 0) {
-        total = val;
-      } else {
-        total = ReduceOp(total, val);
+      void apply(Kind kind, size_t offset, const T * data, size_t n) {
+        T * dst = array + offset;
+        if (kind == Kind::Reduce) {
+          for (size_t i = 0; i < n; i++) dst[i] = op(dst[i], data[i]);
+          reduced++;
+        } else {
+          std::copy(data, data + n, dst);
+          written++;
+        }
+        Grappa::broadcast(&cv);
       }
       
-      cores_in++;
-      DVLOG(4) << "cores_in: " << cores_in;
+      void receive(int64_t r, Kind kind, size_t offset, const T * data, size_t n) {
+        if (active && r == round) {
+          apply(kind, offset, data, n);
+        } else {
+          DCHECK_GT(r, round) << "chunk for a collective we already finished";
+          stash.push_back(Stashed{ r, kind, offset, std::vector<T>(data, data + n) });
+        }
+      }
       
-      if (cores_in == cores()) {
-        cores_in = 0;
-        T tmp_total = total;
-        for (Core c = 0; c < cores(); c++) {
-          send_heap_message(c, [tmp_total] {
-            Reduction<T>::result.writeXF(tmp_total);
-          });
+    public:
+      MessageCollective(): array(nullptr), op(nullptr), round(0), active(false)
+                         , reduced(0), written(0), pool(nullptr), pool_count(0) {}
+      
+      /// Start a call on this core, applying anything that arrived early.
+      void enter(T * a, T (*o)(const T&, const T&) = nullptr) {
+        array = a;
+        op = o;
+        round++;
+        reduced = 0;
+        written = 0;
+        active = true;
+        for (size_t i = 0; i < stash.size(); ) {
+          if (stash[i].round == round) {
+            apply(stash[i].kind, stash[i].offset, &stash[i].data[0], stash[i].data.size());
+            stash[i] = std::move(stash.back());
+            stash.pop_back();
+          } else {
+            i++;
+          }
+        }
+      }
+      
+      /// Wait for our sends to leave @a array, then finish the call.
+      void exit() {
+        if (pool) {
+          delete pool;
+          pool = nullptr;
+          pool_count = 0;
         }
+        active = false;
       }
+      
+      /// Send array[offset,offset+n) to the same range of @a dest's array.
+      void send(Core dest, Kind kind, size_t offset, size_t n) {
+        if (!pool) pool = new MessagePool(window * sizeof(PayloadMessage<Chunk>));
+        for (size_t k = 0; k < n; k += elems_per_chunk()) {
+          if (pool_count == window) {
+            pool->block_until_all_sent();
+            pool_count = 0;
+          }
+          size_t this_nelem = std::min(elems_per_chunk(), n - k);
+          pool->send_message(dest, Chunk{ this, round, offset + k, kind },
+                             (void*)(array + offset + k), sizeof(T) * this_nelem);
+          pool_count++;
+        }
+      }
+      
+      void wait_reduced(size_t nchunks) { while (reduced < nchunks) Grappa::wait(&cv); }
+      void wait_written(size_t nchunks) { while (written < nchunks) Grappa::wait(&cv); }
+      
+      /// Binomial-tree reduce of array[0,nelem) onto @a root; if
+      /// @a bcast, the result is sent back down the tree to everyone.
+      void tree_allreduce(size_t nelem, Core root, bool bcast) {
+        size_t nchildren = 0;
+        for_each_tree_child(root, [&nchildren](Core c){ nchildren++; });
+        wait_reduced(nchildren * chunks(nelem));
+        
+        Core parent = tree_parent(root);
+        if (parent >= 0) {
+          send(parent, Kind::Reduce, 0, nelem);
+          if (bcast) wait_written(chunks(nelem));
+        }
+        if (bcast) {
+          for_each_tree_child(root, [this,nelem](Core c){ send(c, Kind::Write, 0, nelem); });
+        }
+      }
+      
+      /// Binomial-tree broadcast of array[0,nelem) from @a root.
+      void tree_broadcast(size_t nelem, Core root) {
+        if (mycore() != root) wait_written(chunks(nelem));
+        for_each_tree_child(root, [this,nelem](Core c){ send(c, Kind::Write, 0, nelem); });
+      }
+      
+      /// Reduce-scatter then allgather: each core reduces one segment
+      /// of the array, then sends it to everyone. Cores start with
+      /// their ring neighbor and work around, so every core sends and
+      /// receives about 2*nelem elements no matter how many cores there are.
+      void ring_allreduce(size_t nelem) {
+        auto seg_begin = [nelem](Core c) { return nelem * c / cores(); };
+        auto seg_size = [seg_begin](Core c) { return seg_begin(c+1) - seg_begin(c); };
+        
+        size_t expect_written = 0;
+        for (Core i = 1; i < cores(); i++) {
+          Core c = (mycore() + i) % cores();
+          send(c, Kind::Reduce, seg_begin(c), seg_size(c));
+          expect_written += chunks(seg_size(c));
+        }
+        wait_reduced((cores()-1) * chunks(seg_size(mycore())));
+        
+        for (Core i = 1; i < cores(); i++) {
+          Core c = (mycore() + i) % cores();
+          send(c, Kind::Write, seg_begin(mycore()), seg_size(mycore()));
+        }
+        wait_written(expect_written);
+      }
+      
+      /// Each core's nelem elements go to its slot in everyone's array.
+      void ring_allgather(size_t nelem) {
+        for (Core i = 1; i < cores(); i++) {
+          Core c = (mycore() + i) % cores();
+          send(c, Kind::Write, mycore() * nelem, nelem);
+        }
+        wait_written((cores()-1) * chunks(nelem));
+      }
+    };
+    
+    /// The collective state for a type on this core.
+    template< typename T >
+    MessageCollective<T>& message_collective() {
+      static MessageCollective<T> collective;
+      return collective;
     }
     
-    template<typename T, T (*ReduceOp)(const T&, const T&) >
-    class InplaceReduction {
+    template< typename T >
+    class AllToAllExchange {
     protected:
+      T * recv;
+      std::vector<size_t> recv_offset; ///< where each source core's elements start
       CompletionEvent * ce;
-      T * array;
-      Core elems_in = 0;
-      size_t nelem;
-    public:      
+    public:
       /// SPMD, must be called on static/file-global object on all cores
-      /// blocks until reduction is complete
-      void call_allreduce(T * in_array, size_t nelem) {
-        // setup everything (block to make sure HOME_CORE is done)
-        this->array = in_array;
-        this->nelem = nelem;
-        
-        size_t n_per_msg = MAX_MESSAGE_SIZE / sizeof(T);
-        size_t nmsg = nelem / n_per_msg + (nelem % n_per_msg ? 1 : 0);
-        auto nmsg_total = nmsg*(cores()-1);
+      /// blocks until this core has received everything sent to it
+      void call_alltoallv(const T * send, const size_t * send_counts,
+                          T * recv, const size_t * recv_counts, int64_t window) {
+        CHECK_GT(window, 0);
+        CHECK_LE(window, CountingSemaphore::max_value);
+        size_t n_per_msg = std::max<size_t>(1, MAX_MESSAGE_SIZE / sizeof(T));
+
+        // setup receive side, and count the chunks we expect
+        this->recv = recv;
+        recv_offset.resize(cores());
+        size_t offset = 0, nmsg = 0;
+        for (Core c = 0; c < cores(); c++) {
+          recv_offset[c] = offset;
+          offset += recv_counts[c];
+          if (c != mycore()) nmsg += recv_counts[c] / n_per_msg + (recv_counts[c] % n_per_msg ? 1 : 0);
+        }
 
         CompletionEvent local_ce;
         this->ce = &local_ce;
-        this->ce->enroll( (mycore() == HOME_CORE) ? nmsg_total : nmsg );
+        this->ce->enroll(nmsg);
+
+        // make sure everyone is ready to receive
         barrier();
-        
-        if (mycore() != HOME_CORE) {
-          for (size_t k=0; k<nelem; k+=n_per_msg) {
-            size_t this_nelem = std::min(n_per_msg, nelem-k);
-            
-            // everyone sends their contribution to HOME_CORE, last one wakes HOME_CORE
-            send_heap_message(HOME_CORE, [this,k](void * payload, size_t payload_size) {
-              DCHECK(mycore() == HOME_CORE);
-      
+
+        // each chunk takes a credit, returned once the receiver has
+        // copied it out; this bounds how much we have in flight
+        CountingSemaphore credits(window);
+        auto credits_addr = make_global(&credits);
+        Core origin = mycore();
+
+        size_t send_offset = 0;
+        std::vector<size_t> send_displ(cores());
+        for (Core c = 0; c < cores(); c++) {
+          send_displ[c] = send_offset;
+          send_offset += send_counts[c];
+        }
+
+        // start with the next core over so we don't all send to core 0 first
+        for (Core i = 0; i < cores(); i++) {
+          Core c = (origin + i) % cores();
+          const T * src = send + send_displ[c];
+
+          if (c == origin) {
+            CHECK_EQ(send_counts[c], recv_counts[c]) << "self exchange size mismatch";
+            std::copy(src, src + send_counts[c], recv + recv_offset[c]);
+            continue;
+          }
+
+          for (size_t k=0; k<send_counts[c]; k+=n_per_msg) {
+            size_t this_nelem = std::min(n_per_msg, send_counts[c]-k);
+            credits.decrement();
+            send_heap_message(c, [this,origin,k,credits_addr](void * payload, size_t payload_size) {
               auto in_array = static_cast<T*>(payload);
-              auto in_n = payload_size/sizeof(T);
-              auto total = this->array+k;
-      
-              for (size_t i=0; i<in_n; i++) {
-                total[i] = ReduceOp(total[i], in_array[i]);
-              }
-              DVLOG(3) << "incrementing HOME sem, now at " << ce->get_count();      
+              std::copy(in_array, in_array + payload_size/sizeof(T),
+                        this->recv + this->recv_offset[origin] + k);
               this->ce->complete();
-            }, (void*)(in_array+k), sizeof(T)*this_nelem);
-          }
-          
-          DVLOG(3) << "about to block for " << nelem << " with sem == " << ce->get_count();           this->ce->wait();
-          
-        } else {
-          auto nmsg_total = nmsg*(cores()-1);
-          
-          // home core waits until woken by last received message from other cores
-          this->ce->wait();
-          DVLOG(3) << "woke with sem == " << ce->get_count();
-          
-          // send total to everyone else and wake them
-          char msg_buf[(cores()-1)*sizeof(PayloadMessage<std::function<void(decltype(this),size_t)>>)];
-          MessagePool pool(msg_buf, sizeof(msg_buf));
-          for (Core c = 0; c < cores(); c++) {
-            if (c != HOME_CORE) {
-              // send totals back to all the other cores
-              size_t n_per_msg = MAX_MESSAGE_SIZE / sizeof(T);
-              for (size_t k=0; k<nelem; k+=n_per_msg) {
-                size_t this_nelem = std::min(n_per_msg, nelem-k);
-                pool.send_message(c, [this,k](void * payload, size_t psz){
-                  auto total_k = static_cast<T*>(payload);
-                  auto in_n = psz / sizeof(T);
-                  for (size_t i=0; i<in_n; i++) {
-                    this->array[k+i] = total_k[i];
-                  }
-                  this->ce->complete();
-                  DVLOG(3) << "incrementing sem, now at " << ce->get_count();
-                }, this->array+k, sizeof(T)*this_nelem);              
-              }
-            }
+              send_heap_message(credits_addr.core(), [credits_addr]{
+                credits_addr.pointer()->increment();
+              });
+            }, (void*)(src+k), sizeof(T)*this_nelem);
           }
-          // once all messages are sent, HOME_CORE's task continues
         }
+
+        // wait for our data, then for our credits so acks don't outlive them
+        DVLOG(3) << "waiting for " << nmsg << " alltoallv chunks";
+        this->ce->wait();
+        credits.decrement(window);
       }
     };
     
@@ -319,9 +488,11 @@ namespace Grappa {
   
   /// Called from SPMD context, reduces values from all cores calling `allreduce` and returns reduced
   /// values to everyone. Blocks until reduction is complete, so suffices as a global barrier.
+  /// Values are combined up a binomial tree and the result is sent back down it; only the calling
+  /// task blocks.
   ///
-  /// @warning May only one with a given type/op combination may be used at a time,
-  ///          uses a function-private static variable.
+  /// @warning Collectives on a given type must be called in the same order on all cores,
+  ///          and only one at a time per core.
   ///
   /// @b Example:
   /// @code
@@ -332,25 +503,124 @@ namespace Grappa {
   /// @endcode
   template< typename T, T (*ReduceOp)(const T&, const T&) >
   T allreduce(T myval) {
-    impl::Reduction<T>::result.reset();
-    
-    send_message(impl::HOME_CORE, [myval]{
-      impl::collect_reduction<T,ReduceOp>(myval);
-    });
-    
-    return impl::Reduction<T>::result.readFF();
+    auto& c = impl::message_collective<T>();
+    c.enter(&myval, ReduceOp);
+    c.tree_allreduce(1, impl::HOME_CORE, true);
+    c.exit();
+    return myval;
   }
   
   /// Called from SPMD context.
   /// Do an in-place allreduce (works on arrays). All elements of the array will be 
   /// overwritten by the operation with the total from all cores.
   ///
-  /// @warning May only one with a given type/op combination may be used at a time,
-  ///          uses a function-private static variable.
+  /// Small arrays go up and down a binomial tree. Arrays with at least one chunk per
+  /// core are reduce-scattered and then allgathered around the ring, so each core sends
+  /// and receives about twice the array regardless of core count.
+  ///
+  /// @warning Collectives on a given type must be called in the same order on all cores,
+  ///          and only one at a time per core. @a array must be in locale shared memory
+  ///          (a task stack or the locale heap).
   template< typename T, T (*ReduceOp)(const T&, const T&) >
   void allreduce_inplace(T * array, size_t nelem = 1) {
-    static impl::InplaceReduction<T,ReduceOp> reducer;
-    reducer.call_allreduce(array, nelem);
+    auto& c = impl::message_collective<T>();
+    c.enter(array, ReduceOp);
+    if (nelem >= cores() * impl::MessageCollective<T>::elems_per_chunk()) {
+      c.ring_allreduce(nelem);
+    } else {
+      c.tree_allreduce(nelem, impl::HOME_CORE, true);
+    }
+    c.exit();
+  }
+  
+  /// Called from SPMD context. Reduce arrays from all cores into @a root's array along a
+  /// binomial tree. Other cores' arrays are left unchanged.
+  ///
+  /// @warning Collectives on a given type must be called in the same order on all cores,
+  ///          and only one at a time per core. @a array must be in locale shared memory.
+  template< typename T, T (*ReduceOp)(const T&, const T&) >
+  void reduce_inplace(T * array, size_t nelem = 1, Core root = impl::HOME_CORE) {
+    T * buf = array;
+    if (mycore() != root) {
+      buf = locale_alloc<T>(nelem);
+      std::copy(array, array + nelem, buf);
+    }
+    auto& c = impl::message_collective<T>();
+    c.enter(buf, ReduceOp);
+    c.tree_allreduce(nelem, root, false);
+    c.exit();
+    if (buf != array) locale_free(buf);
+  }
+  
+  /// Called from SPMD context. Copy @a root's array to all other cores along a binomial tree.
+  ///
+  /// @warning Collectives on a given type must be called in the same order on all cores,
+  ///          and only one at a time per core. @a array must be in locale shared memory.
+  template< typename T >
+  void broadcast_inplace(T * array, size_t nelem = 1, Core root = impl::HOME_CORE) {
+    auto& c = impl::message_collective<T>();
+    c.enter(array);
+    c.tree_broadcast(nelem, root);
+    c.exit();
+  }
+  
+  /// Called from SPMD context. Gather @a nelem elements from every core into @a all, which
+  /// holds `nelem * cores()` elements in core order, on every core.
+  ///
+  /// @warning Collectives on a given type must be called in the same order on all cores,
+  ///          and only one at a time per core. @a all must be in locale shared memory.
+  template< typename T >
+  void allgather(const T * mine, size_t nelem, T * all) {
+    auto& c = impl::message_collective<T>();
+    std::copy(mine, mine + nelem, all + mycore() * nelem);
+    c.enter(all);
+    c.ring_allgather(nelem);
+    c.exit();
+  }
+  
+  /// Called from SPMD context. Exchange variable-sized blocks between all
+  /// pairs of cores, like MPI_Alltoallv. Blocks are sent in chunks of up
+  /// to MAX_MESSAGE_SIZE bytes, so the aggregator can batch them; at most
+  /// @a window chunks per core are in flight at once. Returns once this
+  /// core has received all its data.
+  ///
+  /// @param send elements for each core, packed in core order. Must be
+  ///             in locale shared memory (task stack or locale heap)
+  ///             since chunks are sent from it directly.
+  /// @param send_counts number of elements for each core
+  /// @param recv receive region, sized for the sum of @a recv_counts;
+  ///             elements from each core are packed in core order
+  /// @param recv_counts number of elements to receive from each core;
+  ///                    use alltoall() on the send counts to find these
+  ///
+  /// @warning May only one with a given type may be used at a time,
+  ///          uses a function-private static variable.
+  ///
+  /// @b Example:
+  /// @code
+  ///   Grappa::on_all_cores([]{
+  ///     size_t recv_counts[Grappa::cores()];
+  ///     Grappa::alltoall(send_counts, 1, recv_counts);
+  ///     Grappa::alltoallv(keys, send_counts, sorted_keys, recv_counts);
+  ///   });
+  /// @endcode
+  template< typename T >
+  void alltoallv(const T * send, const size_t * send_counts,
+                 T * recv, const size_t * recv_counts, int64_t window = 64) {
+    static impl::AllToAllExchange<T> exchange;
+    exchange.call_alltoallv(send, send_counts, recv, recv_counts, window);
+  }
+  
+  /// Called from SPMD context. Send @a count elements to every core,
+  /// like MPI_Alltoall. @a send and @a recv each hold
+  /// `count * cores()` elements, packed in core order.
+  ///
+  /// @warning May only one with a given type may be used at a time,
+  ///          uses a function-private static variable.
+  template< typename T >
+  void alltoall(const T * send, size_t count, T * recv) {
+    std::vector<size_t> counts(cores(), count);
+    alltoallv(send, &counts[0], recv, &counts[0]);
   }
   
   /// Called from a single task (usually user_main), reduces values from all cores onto the calling node.
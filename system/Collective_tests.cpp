@@ -112,11 +112,85 @@ BOOST_AUTO_TEST_CASE( test1 ) {
       for (int i=0; i<N; i++) BOOST_CHECK_EQUAL(xs[i], Grappa::cores() * i);
     });
     
+    BOOST_MESSAGE("testing large allreduce_inplace");
+    Grappa::on_all_cores([]{
+      // big enough to reduce-scatter/allgather, with uneven segments
+      const size_t N = 100003;
+      auto xs = Grappa::locale_alloc<int64_t>(N);
+      for (size_t i=0; i<N; i++) xs[i] = i + Grappa::mycore();
+      
+      Grappa::allreduce_inplace<int64_t,collective_add>(xs, N);
+      
+      Core n = Grappa::cores();
+      for (size_t i=0; i<N; i++) BOOST_CHECK_EQUAL(xs[i], n * i + n*(n-1)/2);
+      Grappa::locale_free(xs);
+    });
+    
+    BOOST_MESSAGE("testing reduce_inplace, broadcast_inplace and allgather");
+    Grappa::on_all_cores([]{
+      Core n = Grappa::cores();
+      const int N = 1000;
+      int64_t xs[N];
+      for (int i=0; i<N; i++) xs[i] = Grappa::mycore();
+      
+      Grappa::reduce_inplace<int64_t,collective_max>(xs, N, n-1);
+      for (int i=0; i<N; i++) {
+        BOOST_CHECK_EQUAL(xs[i], Grappa::mycore() == n-1 ? n-1 : Grappa::mycore());
+      }
+      
+      Grappa::broadcast_inplace(xs, N, 0);
+      for (int i=0; i<N; i++) BOOST_CHECK_EQUAL(xs[i], 0);
+      
+      int64_t mine[3] = { Grappa::mycore(), 2*Grappa::mycore(), 3*Grappa::mycore() };
+      int64_t all[3*n];
+      Grappa::allgather(mine, 3, all);
+      for (Core c = 0; c < n; c++) {
+        for (int j=0; j<3; j++) BOOST_CHECK_EQUAL(all[3*c+j], (j+1)*c);
+      }
+    });
+    
     Grappa::call_on_all_cores([]{ global_x = 1; });
     
     auto total = Grappa::sum_all_cores([]{ return global_x; });
     CHECK_EQ(total, cores());
     
+    BOOST_MESSAGE("testing alltoallv");
+    Grappa::on_all_cores([]{
+      // uneven block sizes, several chunks per block
+      Core n = Grappa::cores();
+      size_t send_counts[n], recv_counts[n];
+      size_t total_send = 0;
+      for (Core c = 0; c < n; c++) {
+        send_counts[c] = 1000 * ((Grappa::mycore() + c) % 3) + c;
+        total_send += send_counts[c];
+      }
+      
+      Grappa::alltoall(send_counts, 1, recv_counts);
+      size_t total_recv = 0;
+      for (Core c = 0; c < n; c++) {
+        BOOST_CHECK_EQUAL(recv_counts[c], 1000 * ((Grappa::mycore() + c) % 3) + Grappa::mycore());
+        total_recv += recv_counts[c];
+      }
+      
+      auto send = Grappa::locale_alloc<int64_t>(total_send);
+      auto recv = Grappa::locale_alloc<int64_t>(total_recv);
+      int64_t * p = send;
+      for (Core c = 0; c < n; c++) {
+        for (size_t i = 0; i < send_counts[c]; i++) *p++ = Grappa::mycore() * 1000000 + c * 10000 + i;
+      }
+      
+      Grappa::alltoallv(send, send_counts, recv, recv_counts, 4);
+      
+      p = recv;
+      for (Core c = 0; c < n; c++) {
+        for (size_t i = 0; i < recv_counts[c]; i++) {
+          BOOST_CHECK_EQUAL(*p++, c * 1000000 + Grappa::mycore() * 10000 + i);
+        }
+      }
+      Grappa::locale_free(send);
+      Grappa::locale_free(recv);
+    });
+    
   });
   Grappa::finalize();
 }
@@ -46,6 +46,8 @@ extern HeapLeakChecker * Grappa_heapchecker;
 
 #include "Communicator.hpp"
 #include "LocaleSharedMemory.hpp"
+#include "MPITransport.hpp"
+#include "SocketTransport.hpp"
 
 #ifndef COMMUNICATOR_TEST
 #include "Metrics.hpp"
@@ -61,6 +63,8 @@ DEFINE_int64( log2_buffer_size, 19, "Size of Communicator buffers" );
 
 static const int MIN_LOG2_BUFFER_SIZE = 15;
 
+DEFINE_string( transport, "mpi", "Point-to-point transport used by Communicator (mpi or sockets)" );
+
 #ifndef COMMUNICATOR_TEST
 // // other metrics
 // GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, communicator_messages, 0);
@@ -80,6 +84,23 @@ GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, communicator_message_bytes, 0
 
 /// Global communicator instance
 Communicator global_communicator;
+
+namespace Grappa {
+namespace impl {
+
+Transport * make_transport() {
+  if( FLAGS_transport == "mpi" ) {
+    return new MPITransport();
+  } else if( FLAGS_transport == "sockets" ) {
+    return new SocketTransport();
+  } else {
+    LOG(FATAL) << "Unknown transport " << FLAGS_transport << "; choose mpi or sockets";
+    return NULL;
+  }
+}
+
+}
+}
   
 
 /// Construct communicator
@@ -103,7 +124,7 @@ Communicator::Communicator( )
   , send_tail(0)
   , send_mask(0)
 
-  , barrier_request( MPI_REQUEST_NULL )
+  , transport_( NULL )
   , external_sends()
   , collective_context(NULL)
 
@@ -225,6 +246,11 @@ void Communicator::init( int * argc_p, char ** argv_p[] ) {
 
   sends = new CommunicatorContext[ 1 << FLAGS_log2_concurrent_sends ];
   
+  // set up transport for point-to-point communication
+  transport_ = Grappa::impl::make_transport();
+  transport_->init( this );
+  if( 0 == mycore_ ) VLOG(2) << "Using " << transport_->name() << " transport";
+
   MPI_CHECK( MPI_Barrier( grappa_comm ) );
 }
 
@@ -322,7 +348,7 @@ void Communicator::post_send( CommunicatorContext * c,
   DVLOG(6) << "Posting send " << c << " to " << dest
            << " with buf " << c->buf
            << " callback " << (void*)c->callback;
-  MPI_CHECK( MPI_Isend( c->buf, size, MPI_BYTE, dest, tag, grappa_comm, &c->request ) );
+  transport_->post_send( c, dest, size, tag );
 #ifndef COMMUNICATOR_TEST
   communicator_message_bytes += size;
 #endif
@@ -341,7 +367,7 @@ void Communicator::post_external_send( CommunicatorContext * c,
 }
 
 void Communicator::post_receive( CommunicatorContext * c ) {
-  MPI_CHECK( MPI_Irecv( c->buf, c->size, MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, grappa_comm, &c->request ) );
+  transport_->post_receive( c );
   DVLOG(6) << "Posted receive " << c << " with buf " << c->buf << " callback " << (void*) c->callback;
 }
 
@@ -349,17 +375,17 @@ void Communicator::post_receive( CommunicatorContext * c ) {
 
 
 void Communicator::garbage_collect() {
-  int flag;
-  MPI_Status status;
+  Grappa::impl::TransportStatus status;
+
+  transport_->progress();
 
   // check for completed sends and re-enable
   while( send_tail != send_head ) {
     auto c = &sends[send_tail];
     if( c->reference_count > 0 ) {
-      MPI_CHECK( MPI_Test( &c->request, &flag, &status ) );
-      if( flag ) {
+      if( transport_->test_send( c, &status ) ) {
         if( c->callback ) {
-          (c->callback)( c, status.MPI_SOURCE, status.MPI_TAG, c->size );
+          (c->callback)( c, status.source, status.tag, c->size );
         }
         c->reference_count = 0;
         send_tail = (send_tail + 1) & send_mask;
@@ -375,11 +401,10 @@ void Communicator::garbage_collect() {
   while( !external_sends.empty() ) {
     auto c = external_sends.front();
     if( c->reference_count > 0 ) {
-      MPI_CHECK( MPI_Test( &c->request, &flag, &status ) );
-      if( flag ) {
+      if( transport_->test_send( c, &status ) ) {
         c->reference_count = 0;
         if( c->callback ) {
-          (c->callback)( c, status.MPI_SOURCE, status.MPI_TAG, c->size );
+          (c->callback)( c, status.source, status.tag, c->size );
         }
         external_sends.pop_front();
       } else { // not sent yet
@@ -425,23 +450,21 @@ static void receive( CommunicatorContext * c, int size ) {
 }
 
 void Communicator::process_received_buffers() {
-  MPI_Status status;
+  Grappa::impl::TransportStatus status;
+
+  transport_->progress();
 
   while( receive_dispatch != receive_head ) {
-    int flag;
     auto c = &receives[receive_dispatch];
     
-    MPI_CHECK( MPI_Test( &c->request, &flag, &status ) );
-    
     // if message has been received
-    if( flag ) {
-      int size = 0;
-      MPI_CHECK( MPI_Get_count( &status, MPI_BYTE, &size ) );
+    if( transport_->test_receive( c, &status ) ) {
+      int size = status.size;
       c->reference_count = 1;
       // start delivering received buffer
       receive( c, size );
       if( c->callback ) {
-        (c->callback)( c, status.MPI_SOURCE, status.MPI_TAG, size );
+        (c->callback)( c, status.source, status.tag, size );
       }
       receive_dispatch = (receive_dispatch + 1) & receive_mask;
       // update if anything has finished delivery
@@ -500,7 +523,7 @@ void Communicator::finish(int retval) {
   for( int i = 0; i < (1 << FLAGS_log2_concurrent_sends); ++i ) {
     if( NULL != sends[i].callback ) {
       sends[i].callback = NULL;
-      MPI_CHECK( MPI_Cancel( &sends[i].request ) );
+      transport_->cancel( &sends[i] );
     }
   }
   
@@ -510,12 +533,16 @@ void Communicator::finish(int retval) {
   for( int i = 0; i < (1 << FLAGS_log2_concurrent_receives); ++i ) {
     if( NULL != receives[i].callback ) {
       receives[i].callback = NULL;
-      MPI_CHECK( MPI_Cancel( &receives[i].request ) );
+      transport_->cancel( &receives[i] );
     }
   }
   
   MPI_CHECK( MPI_Barrier( grappa_comm ) );
 
+  transport_->finish();
+  delete transport_;
+  transport_ = NULL;
+
   MPI_Comm_free( &locale_comm );
   MPI_Comm_free( &grappa_comm );
 
@@ -59,6 +59,7 @@
 #include <glog/logging.h>
 
 #include "common.hpp"
+#include "Transport.hpp"
 //#include "Metrics.hpp"
 
 //#include "PerformanceTools.hpp"
@@ -86,7 +87,11 @@ struct CommunicatorContext {
   int size;
   int reference_count;
   void (*callback)( CommunicatorContext * c, int source, int tag, int received_size );
-  CommunicatorContext(): request(MPI_REQUEST_NULL), buf(NULL), size(0), reference_count(0), callback(NULL) {}
+  /// completion state for transports that don't use `request`
+  bool transport_done;
+  Grappa::impl::TransportStatus transport_status;
+  CommunicatorContext(): request(MPI_REQUEST_NULL), buf(NULL), size(0), reference_count(0), callback(NULL)
+                       , transport_done(false), transport_status() {}
 };
 
 namespace Grappa {
@@ -145,8 +150,9 @@ private:
   int send_tail;
   int send_mask;
 
-  MPI_Request barrier_request;
-  
+  /// point-to-point transport that actually moves buffers
+  Grappa::impl::Transport * transport_;
+
   void process_received_buffers();
   void process_collectives();
 
@@ -199,6 +205,9 @@ public:
 
   const char * hostname();
 
+  /// Name of transport in use
+  const char * transport_name() const { return transport_->name(); }
+
   inline bool send_context_available() const { return ((send_head + 1) & send_mask) != send_tail; }
   CommunicatorContext * try_get_send_context();
 
@@ -280,7 +289,7 @@ public:
   
   /// Global (anonymous) barrier (ALLNODES)
   inline void barrier() {
-    MPI_CHECK( MPI_Barrier( grappa_comm ) );
+    transport_->barrier();
   }
 
   template< typename T >
@@ -290,14 +299,12 @@ public:
 
   /// Global (anonymous) two-phase barrier notify (ALLNODES)
   inline void barrier_notify() {
-    MPI_CHECK( MPI_Ibarrier( grappa_comm, &barrier_request ) );
+    transport_->barrier_notify();
   }
   
   /// Global (anonymous) two-phase barrier try (ALLNODES)
   inline bool barrier_try() {
-    int flag;
-    MPI_CHECK( MPI_Test( &barrier_request, &flag, MPI_STATUS_IGNORE ) );
-    return flag;
+    return transport_->barrier_try();
   }
 
 };
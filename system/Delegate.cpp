@@ -33,6 +33,8 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include "Delegate.hpp"
+#include "DelegateBatch.hpp"
+#include "RemoteAtomic.hpp"
 #include "Timestamp.hpp"
 #include "common.hpp"
 
@@ -43,6 +45,9 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+DEFINE_int64( delegate_batch_max_bytes, 2048, "Largest payload of a single batched delegate message" );
+DEFINE_bool( delegate_atomic_combining, true, "Combine remote atomics to the same address from tasks on one core" );
+
 GRAPPA_DEFINE_METRIC(HistogramMetric, delegate_op_latency_histogram, 0);
 
 GRAPPA_DEFINE_METRIC(SummarizingMetric<uint64_t>, flat_combiner_fetch_and_add_amount, 0);
@@ -53,6 +58,12 @@ GRAPPA_DEFINE_METRIC(SummarizingMetric<double>, delegate_network_latency, 0.0);
 GRAPPA_DEFINE_METRIC(SummarizingMetric<double>, delegate_wakeup_latency, 0.0);
 
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_ops, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_batches, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_batch_ops, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_batch_messages, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_atomics, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_atomic_targets, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_atomics_combined, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_targets, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_reads, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, delegate_read_targets, 0);
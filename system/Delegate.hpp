@@ -41,6 +41,7 @@
 #include "DelegateBase.hpp"
 #include "GlobalCompletionEvent.hpp"
 #include "AsyncDelegate.hpp"
+#include "CoherentCache.hpp"
 #include <type_traits>
 
 GRAPPA_DECLARE_METRIC(SummarizingMetric<uint64_t>, flat_combiner_fetch_and_add_amount);
@@ -105,6 +106,30 @@ namespace Grappa {
       }
     };    
     
+    /// Async call of a function that writes memory. `func(origin)` returns
+    /// the number of coherent cache invalidations its writes sent (see
+    /// CoherentCache::written_async()); if that's nonzero, the cache sends
+    /// the completion to `C` once they have all been acknowledged.
+    template< GlobalCompletionEvent * C, typename F >
+    void call_async_writing(Core dest, F func) {
+      delegate_ops++;
+      delegate_async_ops++;
+      Core origin = Grappa::mycore();
+      
+      if (dest == origin) {
+        // short-circuit if local; acks can't arrive until we yield
+        delegate_targets++;
+        delegate_short_circuits++;
+        if (func(origin) > 0 && C) C->enroll();
+      } else {
+        if (C) C->enroll();
+        send_heap_message(dest, [origin, func] {
+          delegate_targets++;
+          if (func(origin) == 0 && C) C->send_completion(origin);
+        });
+      }
+    }
+    
   } // namespace impl
   
   namespace delegate {
@@ -270,11 +295,24 @@ namespace Grappa {
     void write(GlobalAddress<T> target, U value) {
       static_assert(std::is_convertible<T,U>(), "type of value must match GlobalAddress type");
       delegate_writes++;
-      // TODO: don't return any val, requires changes to `delegate::call()`.
-      return call<S,C>(target.core(), [target, value] {
-        delegate_write_targets++;
-        *target.pointer() = value;
-      });
+      if (S == SyncMode::Blocking) {
+        // don't return until every cached copy of the old value is gone
+        impl::InvalidationWait w;
+        auto wp = &w;
+        Core origin = mycore();
+        auto sent = call<SyncMode::Blocking,C>(target.core(), [target, value, origin, wp]() -> uint64_t {
+          delegate_write_targets++;
+          *target.pointer() = value;
+          return impl::global_coherent_cache.written(target.pointer(), sizeof(T), origin, wp);
+        });
+        w.wait(sent);
+      } else {
+        impl::call_async_writing<C>(target.core(), [target, value](Core origin) -> uint64_t {
+          delegate_write_targets++;
+          *target.pointer() = value;
+          return impl::global_coherent_cache.written_async(target.pointer(), sizeof(T), origin, C);
+        });
+      }
     }
     
     /// Fetch the value at `target`, increment the value stored there with `inc` and return the
@@ -286,13 +324,18 @@ namespace Grappa {
               typename U = decltype(nullptr) >
     T fetch_and_add(GlobalAddress<T> target, U inc) {
       delegate_fetchadds++;
-      return call(target.core(), [target, inc]() -> T {
+      impl::InvalidationWait w;
+      auto wp = &w;
+      Core origin = mycore();
+      auto r = call(target.core(), [target, inc, origin, wp]() -> impl::WithInvalidations<T> {
         delegate_fetchadd_targets++;
         T* p = target.pointer();
         T r = *p;
         *p += inc;
-        return r;
+        return { r, impl::global_coherent_cache.written(p, sizeof(T), origin, wp) };
       });
+      w.wait(r.invalidations);
+      return r.value;
     }
 
     /// Flat combines fetch_and_add to a single global address
@@ -383,12 +426,17 @@ namespace Grappa {
             uint64_t increment_total = increment;
             flat_combiner_fetch_and_add_amount += increment_total;
             auto t = target;
-            result = call(target.core(), [t, increment_total]() -> U {
+            impl::InvalidationWait w;
+            auto wp = &w;
+            Core origin = mycore();
+            auto r = call(target.core(), [t, increment_total, origin, wp]() -> impl::WithInvalidations<U> {
               T * p = t.pointer();
               uint64_t r = *p;
               *p += increment_total;
-              return r;
+              return { r, impl::global_coherent_cache.written(p, sizeof(T), origin, wp) };
             });
+            w.wait(r.invalidations);
+            result = r.value;
             // tell the others that the result has arrived
             Grappa::broadcast(&untilReceived);
           } else {
@@ -423,16 +471,21 @@ namespace Grappa {
       static_assert(std::is_convertible<T,V>(), "type of new_val must match GlobalAddress type");
       
       delegate_cmpswaps++;
-      return call(target.core(), [target, cmp_val, new_val]() -> bool {
+      impl::InvalidationWait w;
+      auto wp = &w;
+      Core origin = mycore();
+      auto r = call(target.core(), [target, cmp_val, new_val, origin, wp]() -> impl::WithInvalidations<bool> {
         T * p = target.pointer();
         delegate_cmpswap_targets++;
         if (cmp_val == *p) {
           *p = new_val;
-          return true;
+          return { true, impl::global_coherent_cache.written(p, sizeof(T), origin, wp) };
         } else {
-          return false;
+          return { false, 0 };
         }
       });
+      w.wait(r.invalidations);
+      return r.value;
     }
     
     template< SyncMode S = SyncMode::Blocking, 
@@ -442,8 +495,9 @@ namespace Grappa {
     void increment(GlobalAddress<T> target, U inc) {
       static_assert(std::is_convertible<T,U>(), "type of inc must match GlobalAddress type");
       delegate_async_increments++;
-      delegate::call<SyncMode::Async,C>(target.core(), [target,inc]{
+      impl::call_async_writing<C>(target.core(), [target,inc](Core origin) -> uint64_t {
         (*target.pointer()) += inc;
+        return impl::global_coherent_cache.written_async(target.pointer(), sizeof(T), origin, C);
       });
     }
     
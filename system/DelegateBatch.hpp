@@ -0,0 +1,224 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Delegate.hpp"
+#include "CompletionEvent.hpp"
+#include "LocaleSharedMemory.hpp"
+#include <vector>
+
+DECLARE_int64( delegate_batch_max_bytes );
+
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_batches);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_batch_ops);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_batch_messages);
+
+namespace Grappa {
+  namespace delegate {
+    /// @addtogroup Delegates
+    /// @{
+
+    namespace impl {
+
+      /// one operation in a batch, as sent to the target's home
+      template< typename T, typename A >
+      struct BatchRequest {
+        T * target;
+        A arg;
+      };
+
+      struct NoArg {};
+
+      /// Apply `apply(T*, A, WriteAcks&) -> R` to every target, grouped into one
+      /// message per destination core (split only if it won't fit in
+      /// delegate_batch_max_bytes). Results, if wanted, come back in one
+      /// reply per message and are scattered into `results` in the
+      /// original order. Blocks until every operation is done, and
+      /// every coherent cache invalidation the writes caused has been
+      /// acknowledged.
+      template< typename R, typename T, typename A, typename F >
+      void batch( const GlobalAddress<T> * targets, const A * args, size_t n, R * results, F apply ) {
+        if( n == 0 ) return;
+        delegate_batches++;
+        delegate_batch_ops += n;
+
+        // counting sort of operation indices by destination core
+        std::vector< size_t > start( cores() + 1, 0 );
+        for( size_t i = 0; i < n; ++i ) start[ targets[i].core() + 1 ]++;
+        for( Core c = 0; c < cores(); ++c ) start[c+1] += start[c];
+        std::vector< size_t > order( n );
+        {
+          std::vector< size_t > next( start.begin(), start.end() - 1 );
+          for( size_t i = 0; i < n; ++i ) order[ next[ targets[i].core() ]++ ] = i;
+        }
+
+        typedef BatchRequest<T,A> Request;
+        // payload sizes travel in an int16_t
+        size_t max_bytes = std::min< int64_t >( FLAGS_delegate_batch_max_bytes, INT16_MAX );
+        size_t per_message = std::max< size_t >( 1, max_bytes / std::max( sizeof(Request), sizeof(R) ) );
+
+        size_t nmessages = 0;
+        for( Core c = 0; c < cores(); ++c ) {
+          if( c == mycore() ) continue;
+          size_t count = start[c+1] - start[c];
+          nmessages += ( count + per_message - 1 ) / per_message;
+        }
+
+        CompletionEvent ce( nmessages );
+        auto cep = &ce;
+        Grappa::impl::InvalidationWait w;
+        auto wp = &w;
+        uint64_t invalidations = 0;
+        auto ip = &invalidations;
+        Request * requests = nullptr;
+        if( nmessages > 0 ) {
+          requests = locale_alloc< Request >( n - ( start[mycore()+1] - start[mycore()] ) );
+        }
+        Request * r = requests;
+        Core origin = mycore();
+
+        for( Core c = 0; c < cores(); ++c ) {
+          if( c == mycore() ) continue;
+          for( size_t m = start[c]; m < start[c+1]; m += per_message ) {
+            size_t count = std::min( per_message, start[c+1] - m );
+            for( size_t k = 0; k < count; ++k ) {
+              size_t i = order[ m + k ];
+              r[k].target = targets[i].pointer();
+              if( args ) r[k].arg = args[i];
+            }
+            const size_t * idx = &order[m];
+            delegate_batch_messages++;
+
+            send_heap_message( c, [origin, results, idx, cep, wp, ip, apply]( void * payload, size_t payload_size ) {
+              /* ON TARGET */
+              auto reqs = static_cast< Request * >( payload );
+              size_t count = payload_size / sizeof(Request);
+              Grappa::impl::WriteAcks acks{ origin, wp, 0 };
+              if( results ) {
+                R * out = locale_alloc< R >( count );
+                for( size_t k = 0; k < count; ++k ) out[k] = apply( reqs[k].target, reqs[k].arg, acks );
+                uint64_t sent = acks.sent;
+                // the reply buffer is freed here once it has been sent
+                auto reply = heap_message( origin, [results, idx, cep, ip, sent]( void * payload, size_t payload_size ) {
+                  /* ON ORIGIN */
+                  auto rs = static_cast< R * >( payload );
+                  size_t count = payload_size / sizeof(R);
+                  for( size_t k = 0; k < count; ++k ) results[ idx[k] ] = rs[k];
+                  *ip += sent;
+                  cep->complete();
+                }, out, count * sizeof(R) );
+                reply->delete_payload_after_send();
+                reply->enqueue();
+              } else {
+                for( size_t k = 0; k < count; ++k ) apply( reqs[k].target, reqs[k].arg, acks );
+                uint64_t sent = acks.sent;
+                send_heap_message( origin, [cep, ip, sent]{
+                  *ip += sent;
+                  cep->complete();
+                });
+              }
+            }, r, count * sizeof(Request) );
+
+            r += count;
+          }
+        }
+
+        // local operations run in place while the messages are out
+        Grappa::impl::WriteAcks local_acks{ origin, wp, 0 };
+        for( size_t m = start[mycore()]; m < start[mycore()+1]; ++m ) {
+          size_t i = order[m];
+          A arg = args ? args[i] : A();
+          if( results ) {
+            results[i] = apply( targets[i].pointer(), arg, local_acks );
+          } else {
+            apply( targets[i].pointer(), arg, local_acks );
+          }
+        }
+        invalidations += local_acks.sent;
+
+        ce.wait();
+        w.wait( invalidations );
+        // every request has been delivered, so its payload was sent
+        if( requests ) locale_free( requests );
+      }
+
+    } // namespace impl
+
+    /// Read the values at each of `n` global addresses into `results`,
+    /// sending one message per destination core rather than one per
+    /// address. Blocks until all have been read.
+    /// @warning Each target object must lie on a single node (not span blocks in global address space).
+    template< typename T >
+    void read_batch( const GlobalAddress<T> * targets, size_t n, T * results ) {
+      delegate_reads += n;
+      impl::batch< T, T, impl::NoArg >( targets, nullptr, n, results, []( T * p, impl::NoArg, Grappa::impl::WriteAcks& ) -> T {
+        delegate_read_targets++;
+        return *p;
+      });
+    }
+
+    /// Write `values[i]` to `targets[i]` for each of `n` addresses, sending
+    /// one message per destination core. Blocks until all writes are done.
+    /// @warning Each target object must lie on a single node (not span blocks in global address space).
+    template< typename T, typename U >
+    void write_batch( const GlobalAddress<T> * targets, const U * values, size_t n ) {
+      static_assert(std::is_convertible<T,U>(), "type of value must match GlobalAddress type");
+      delegate_writes += n;
+      impl::batch< char, T, U >( targets, values, n, static_cast< char * >( nullptr ), []( T * p, U value, Grappa::impl::WriteAcks& acks ) -> char {
+        delegate_write_targets++;
+        *p = value;
+        acks.written(p, sizeof(T));
+        return 0;
+      });
+    }
+
+    /// Add `incs[i]` to the value at `targets[i]` for each of `n`
+    /// addresses, sending one message per destination core, and return
+    /// the previous values in `results`. Blocks until all are done.
+    /// @warning Each target object must lie on a single node (not span blocks in global address space).
+    template< typename T, typename U >
+    void fetch_and_add_batch( const GlobalAddress<T> * targets, const U * incs, size_t n, T * results ) {
+      delegate_fetchadds += n;
+      impl::batch< T, T, U >( targets, incs, n, results, []( T * p, U inc, Grappa::impl::WriteAcks& acks ) -> T {
+        delegate_fetchadd_targets++;
+        T r = *p;
+        *p += inc;
+        acks.written(p, sizeof(T));
+        return r;
+      });
+    }
+
+    /// @}
+  } // namespace delegate
+} // namespace Grappa
@@ -0,0 +1,330 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Delegate.hpp"
+#include "ConditionVariableLocal.hpp"
+#include "Tasking.hpp"
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Grappa {
+
+  template< typename T > class Future;
+
+  namespace impl {
+
+    /// A continuation waiting on a FutureState, kept on an intrusive list.
+    template< typename T >
+    struct FutureContinuation {
+      FutureContinuation * next;
+      FutureContinuation(): next(nullptr) {}
+      virtual ~FutureContinuation() {}
+      virtual void run( const T& value ) = 0;
+    };
+
+    template< typename T, typename F >
+    struct FutureContinuationImpl : public FutureContinuation<T> {
+      F f;
+      FutureContinuationImpl( F f ): FutureContinuation<T>(), f(f) {}
+      virtual void run( const T& value ) { f( value ); }
+    };
+
+    /// Storage for a Future's value, shared by every Future handle that
+    /// refers to it and by any message in flight to fill it. States live
+    /// on the core that created them and are reference counted by hand,
+    /// since messages carry only a raw pointer.
+    template< typename T >
+    class FutureState {
+      T value_;
+      bool ready_;
+      int64_t refs_;
+      ConditionVariable cv_;
+      FutureContinuation<T> * continuations_;
+
+      void launch( FutureContinuation<T> * c ) {
+        acquire();
+        spawn_continuation( [this, c] {
+          c->run( this->value_ );
+          delete c;
+          this->release();
+        });
+      }
+
+    public:
+      FutureState(): value_(), ready_(false), refs_(1), cv_(), continuations_(nullptr) {}
+
+      void acquire() { refs_++; }
+      void release() { if( --refs_ == 0 ) delete this; }
+
+      bool ready() const { return ready_; }
+
+      /// Set the value, wake anyone blocked in get(), and spawn the
+      /// continuations. Safe to call from a message handler.
+      void fill( const T& value ) {
+        CHECK( !ready_ ) << "Future filled twice";
+        value_ = value;
+        ready_ = true;
+        broadcast( &cv_ );
+        while( continuations_ ) {
+          auto c = continuations_;
+          continuations_ = c->next;
+          launch( c );
+        }
+      }
+
+      const T& get() {
+        while( !ready_ ) Grappa::wait( &cv_ );
+        return value_;
+      }
+
+      /// Run `f(value)` as a continuation on this core once the value is
+      /// ready (right away if it already is).
+      template< typename F >
+      void add_continuation( F f ) {
+        auto c = new FutureContinuationImpl<T,F>( f );
+        if( ready_ ) {
+          launch( c );
+        } else {
+          c->next = continuations_;
+          continuations_ = c;
+        }
+      }
+    };
+
+    /// How the result of a then() continuation reaches the next Future:
+    /// plain values fill it directly, and Futures are flattened so that
+    /// chained asynchronous calls produce a Future<U>, not a
+    /// Future<Future<U>>.
+    template< typename R >
+    struct FutureChain {
+      typedef R value_type;
+      static void forward( FutureState<R> * next, const R& r ) {
+        next->fill( r );
+        next->release();
+      }
+    };
+
+    template< typename U >
+    struct FutureChain< Future<U> > {
+      typedef U value_type;
+      static void forward( FutureState<U> * next, const Future<U>& inner ) {
+        inner.shared_state()->add_continuation( [next]( const U& u ) {
+          next->fill( u );
+          next->release();
+        });
+      }
+    };
+
+  } // namespace impl
+
+  /// @addtogroup Delegates
+  /// @{
+
+  /// Handle on a value that will be available later on this core, usually
+  /// the result of an asynchronous delegate (see delegate::call_future()).
+  /// Unlike delegate::Promise, nothing has to block to use the result:
+  /// then() attaches a continuation that runs as a lightweight task on
+  /// this core when the value arrives, and returns a Future for its
+  /// result, so multi-hop lookups can be pipelined without parking a
+  /// Worker per request. Copies of a Future share the same value. A
+  /// Future must only be used on the core that created it, and T must be
+  /// default-constructible and copyable.
+  ///
+  /// @b Example:
+  /// @code
+  ///   auto f = delegate::call_future(1, []{ return index[key]; })
+  ///     .then([](int64_t slot){ return delegate::call_future(slot % cores(), [slot]{ return data[slot]; }); })
+  ///     .then([](double d){ return d * 2; });
+  ///   // other work
+  ///   double result = f.get();
+  /// @endcode
+  template< typename T >
+  class Future {
+    impl::FutureState<T> * state;
+
+  public:
+    /// A Future with no value yet; fill() provides one.
+    Future(): state( new impl::FutureState<T>() ) {}
+    Future( const Future& f ): state( f.state ) { state->acquire(); }
+    Future& operator=( const Future& f ) {
+      f.state->acquire();
+      state->release();
+      state = f.state;
+      return *this;
+    }
+    ~Future() { state->release(); }
+
+    /// Has the value arrived?
+    bool ready() const { return state->ready(); }
+
+    /// Block until the value arrives, and return it.
+    const T& get() const { return state->get(); }
+
+    /// Provide the value, waking blocked getters and spawning continuations.
+    void fill( const T& value ) const { state->fill( value ); }
+
+    /// Call `f(value)` as a continuation on this core once the value is
+    /// ready, returning a Future for its result. If `f` itself returns a
+    /// Future<U>, the result is a Future<U> that is ready when that one is.
+    /// `f` may block, but must return a value.
+    template< typename F >
+    auto then( F f ) -> Future< typename impl::FutureChain< decltype( f( std::declval<const T&>() ) ) >::value_type > {
+      typedef decltype( f( std::declval<const T&>() ) ) R;
+      static_assert( !std::is_void<R>::value, "continuations passed to then() must return a value" );
+      typedef impl::FutureChain<R> Chain;
+      Future< typename Chain::value_type > next;
+      auto n = next.shared_state();
+      n->acquire();
+      state->add_continuation( [f, n]( const T& value ) {
+        Chain::forward( n, f( value ) );
+      });
+      return next;
+    }
+
+    /// @b internal
+    impl::FutureState<T> * shared_state() const { return state; }
+  };
+
+  /// A Future whose value is already known.
+  template< typename T >
+  Future<T> make_ready_future( const T& value ) {
+    Future<T> f;
+    f.fill( value );
+    return f;
+  }
+
+  /// A Future that is ready when all of `futures` are, holding their
+  /// values in the same order.
+  template< typename T >
+  Future< std::vector<T> > when_all( const std::vector< Future<T> >& futures ) {
+    struct Gather {
+      std::vector<T> values;
+      size_t remaining;
+      impl::FutureState< std::vector<T> > * result;
+    };
+    Future< std::vector<T> > all;
+    if( futures.empty() ) {
+      all.fill( std::vector<T>() );
+      return all;
+    }
+    auto g = new Gather{ std::vector<T>( futures.size() ), futures.size(), all.shared_state() };
+    g->result->acquire();
+    for( size_t i = 0; i < futures.size(); ++i ) {
+      futures[i].shared_state()->add_continuation( [g, i]( const T& value ) {
+        g->values[i] = value;
+        if( --g->remaining == 0 ) {
+          g->result->fill( g->values );
+          g->result->release();
+          delete g;
+        }
+      });
+    }
+    return all;
+  }
+
+  /// A Future that is ready as soon as any of `futures` is, holding its
+  /// index and value. The others still complete, but are ignored.
+  template< typename T >
+  Future< std::pair<size_t,T> > when_any( const std::vector< Future<T> >& futures ) {
+    CHECK( !futures.empty() ) << "when_any of no futures would never be ready";
+    struct First {
+      size_t remaining;
+      impl::FutureState< std::pair<size_t,T> > * result;
+    };
+    Future< std::pair<size_t,T> > any;
+    auto first = new First{ futures.size(), any.shared_state() };
+    first->result->acquire();
+    for( size_t i = 0; i < futures.size(); ++i ) {
+      futures[i].shared_state()->add_continuation( [first, i]( const T& value ) {
+        if( !first->result->ready() ) {
+          first->result->fill( std::make_pair( i, value ) );
+        }
+        if( --first->remaining == 0 ) {
+          first->result->release();
+          delete first;
+        }
+      });
+    }
+    return any;
+  }
+
+  namespace delegate {
+
+    /// Call `func` on core `dest` and return a Future for its result
+    /// without blocking. The reply fills the Future on this core.
+    template< typename F >
+    auto call_future( Core dest, F func ) -> Future< decltype( func() ) > {
+      typedef decltype( func() ) R;
+      Future<R> result;
+      delegate_ops++;
+      delegate_async_ops++;
+      Core origin = Grappa::mycore();
+
+      if( dest == origin ) {
+        // short-circuit if local
+        delegate_targets++;
+        delegate_short_circuits++;
+        result.fill( func() );
+      } else {
+        auto s = result.shared_state();
+        s->acquire(); // held by the reply
+        send_heap_message( dest, [origin, func, s] {
+          delegate_targets++;
+          R val = func();
+          send_heap_message( origin, [val, s] {
+            s->fill( val );
+            s->release();
+          });
+        });
+      }
+      return result;
+    }
+
+    /// Read the value at a global address, returning a Future for it.
+    template< typename T >
+    Future<T> read_future( GlobalAddress<T> target ) {
+      delegate_reads++;
+      return call_future( target.core(), [target]() -> T {
+        delegate_read_targets++;
+        return *target.pointer();
+      });
+    }
+
+  } // namespace delegate
+
+  /// @}
+
+} // namespace Grappa
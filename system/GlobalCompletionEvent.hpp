@@ -39,6 +39,7 @@
 #include "Tasking.hpp"
 #include "Message.hpp"
 #include "DelegateBase.hpp"
+#include "FullEmptyLocal.hpp"
 #include "Collective.hpp"
 #include "Timestamp.hpp"
 #include <type_traits>
@@ -241,11 +242,22 @@ public:
     // first one to have work here
     if (count == inc) { // count[0 -> inc]
       event_in_progress = true; // optimization to save checking in wait()
-      // cancel barrier
-      Core co = impl::call(master_core, [this] {
-        cores_out++;
-        return cores_out;
-      });
+      // cancel barrier; urgent, like entering it in complete(), so this
+      // core's next entry can't overtake the cancel
+      Core co;
+      if (mycore() == master_core) {
+        co = ++cores_out;
+      } else {
+        FullEmpty<Core> result;
+        auto ra = make_global(&result);
+        send_urgent_heap_message(master_core, [this,ra] {
+          Core co = ++cores_out;
+          send_urgent_heap_message(ra.core(), [ra,co] {
+            ra->writeXF(co);
+          });
+        });
+        co = result.readFF();
+      }
       // first one to cancel barrier should make sure other cores are ready to wait
       if (co == 1) { // cores_out[0 -> 1]
         event_in_progress = true;
@@ -281,7 +293,7 @@ public:
     // out of work here
     if (count == 0) { // count[dec -> 0]
       // enter cancellable barrier
-      send_heap_message(master_core, [this] {
+      send_urgent_heap_message(master_core, [this] {
         cores_out--;
         DVLOG(4) << "core entered barrier (cores_out:"<< cores_out <<")";
         
@@ -293,7 +305,7 @@ public:
           temporary_waking_cores_out = cores();
           auto re = this->reenroll_count; // remember if we requested reenroll
           for (Core c = 0; c < cores(); c++) {
-            send_heap_message(c, [this,re] {
+            send_urgent_heap_message(c, [this,re] {
               CHECK_EQ(count, 0);
               temporary_waking_cv = cv; // capture current list of waiters
               reset(); // reset, now anyone else calling `wait` should fall through
@@ -306,7 +318,7 @@ public:
               }
 
               // then, once everyone is reset,
-              send_heap_message(master_core, [this,re] {
+              send_urgent_heap_message(master_core, [this,re] {
                 temporary_waking_cores_out--;
                 if (temporary_waking_cores_out == 0) {
                   
@@ -320,7 +332,7 @@ public:
 
                   // notify everyone to wake
                   for (Core c = 0; c < cores(); c++) {
-                    send_heap_message(c, [this] {
+                    send_urgent_heap_message(c, [this] {
                       DVLOG(3) << "broadcast";
                       broadcast(&temporary_waking_cv); // wake anyone who was waiting here
                       temporary_waking_cv.waiters_ = 0; 
@@ -55,6 +55,7 @@ extern "C" {
 
 #include "GlobalMemoryChunk.hpp"
 #include "LocaleSharedMemory.hpp"
+#include "Topology.hpp"
 
 DEFINE_bool( global_memory_use_hugepages, false, "UNUSED: use 1GB huge pages for global heap" );
 DEFINE_int64( global_memory_per_node_base_address, 0x0000123400000000L, "UNUSED: global memory base address");
@@ -79,6 +80,8 @@ GlobalMemoryChunk::GlobalMemoryChunk( size_t size )
   DVLOG(2) << "Core " << Grappa::mycore() << " allocating " << size_ << " bytes ";
   memory_ = Grappa::impl::locale_shared_memory.allocate_aligned( size_, 64 );
   CHECK_NOTNULL( memory_ );
+  // keep this core's slice of the heap on its own NUMA node
+  Grappa::impl::topology.bind_local( memory_, size_ );
   Grappa::impl::global_memory_chunk_base = memory_;
   DVLOG(2) << "Core " << Grappa::mycore() << " allocated " << size_ << " bytes ";
 }
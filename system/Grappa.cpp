@@ -52,8 +52,11 @@
 #include "FileIO.hpp"
 
 #include "RDMAAggregator.hpp"
+#include "Rendezvous.hpp"
 #include "LocaleSharedMemory.hpp"
 #include "SharedMessagePool.hpp"
+#include "StackPool.hpp"
+#include "Topology.hpp"
 #include "Metrics.hpp"
 
 #include <fstream>
@@ -68,7 +71,6 @@
 
 // command line arguments
 DEFINE_uint64( num_starting_workers, 512, "Number of starting workers in task-executer pool" );
-DEFINE_bool( set_affinity, false, "Set processor affinity based on local rank" );
 
 DEFINE_int64( node_memsize, -1, "User-specified node memory size; overrides autodetection" );
 
@@ -518,18 +520,10 @@ void Grappa_init( int * argc_p, char ** argv_p[], int64_t global_memory_size_byt
   VLOG(2) << "Aggregator initialized.";
   
   // set CPU affinity if requested
-#ifdef CPU_SET
   if( FLAGS_set_affinity ) {
-    char * localid_str = getenv("SLURM_LOCALID");
-    if( NULL != localid_str ) {
-      int localid = atoi( localid_str );
-      cpu_set_t mask;
-      CPU_ZERO( &mask );
-      CPU_SET( localid, &mask );
-      sched_setaffinity( 0, sizeof(mask), &mask );
-    }
+    topology.discover();
+    topology.pin( global_communicator.locale_mycore );
   }
-#endif
 
   // initialize node shared memory
   if( FLAGS_node_memsize == -1 ) { 
@@ -607,6 +601,7 @@ void Grappa_activate()
   auto base_locale_shared_memory_allocated = locale_shared_memory.get_allocated();
 
   global_communicator.activate();
+  global_rendezvous.activate();
   auto communicator_locale_shared_memory_allocated = locale_shared_memory.get_allocated();
 
   global_task_manager.activate();
@@ -619,6 +614,11 @@ void Grappa_activate()
   global_memory = new GlobalMemory( Grappa::impl::global_memory_size_bytes );
   auto heap_locale_shared_memory_allocated = locale_shared_memory.get_allocated();
 
+  // reserve stacks for the polling thread, user_main and the starting workers together
+  if( FLAGS_stack_pool ) {
+    stack_pool.init( FLAGS_stack_size, FLAGS_num_starting_workers + 2 );
+  }
+
   // fire up polling thread
   global_scheduler.periodic( impl::worker_spawn( master_thread, &global_scheduler, &poller, NULL ) );
   auto polling_locale_shared_memory_allocated = locale_shared_memory.get_allocated();
@@ -738,6 +738,7 @@ int Grappa_finish( int retval )
   assert( Grappa_heapchecker->NoLeaks() );
 #endif
 
+  global_rendezvous.finish();
   global_communicator.finish( retval );
 
   locale_shared_memory.finish();
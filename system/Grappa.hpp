@@ -54,9 +54,13 @@
 #include "Message.hpp"
 
 #include "Delegate.hpp"
+#include "DelegateBatch.hpp"
+#include "RemoteAtomic.hpp"
 #include "AsyncDelegate.hpp"
+#include "Future.hpp"
 #include "Collective.hpp"
 #include "ParallelLoop.hpp"
+#include "TaskAffinity.hpp"
 #include "GlobalAllocator.hpp"
 // #include "Cache.hpp"
 #include "Array.hpp"
@@ -102,6 +106,16 @@ namespace Grappa {
   const auto async = Grappa::SyncMode::Async;
 #endif
   
+#ifndef GRAPPA_NO_ABBREV
+  /// Specify lazy splitting of loop iterations into tasks
+  ///
+  /// @code
+  ///   forall<lazy>(...)
+  ///   forall_here<lazy,unbound>(...)
+  /// @endcode
+  const auto lazy = Grappa::SplitMode::Lazy;
+#endif
+  
 }
 
 #endif
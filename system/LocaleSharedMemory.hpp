@@ -79,12 +79,17 @@ public:
   // clean up before shutting down
   void finish();
 
+  // is an address in the locale shared memory?
+  inline bool contains( const void * addr ) const {
+    const char * char_base = reinterpret_cast< const char* >( base_address );
+    const char * char_addr = reinterpret_cast< const char* >( addr );
+    return (char_base <= char_addr) && (char_addr < (char_base + region_size) );
+  }
+
   // make sure an address is in the locale shared memory
   inline void validate_address( void * addr ) {
     //#ifndef NDEBUG
-    char * char_base = reinterpret_cast< char* >( base_address );
-    char * char_addr = reinterpret_cast< char* >( addr );
-    CHECK( (char_base <= addr) && (addr < (char_base + region_size) ) )
+    CHECK( contains( addr ) )
       << "Address " << addr << "  out of locale shared range!";
   }
     //#endif
@@ -96,6 +101,7 @@ public:
   const size_t get_free_memory() const { return segment.get_free_memory(); }
   const size_t get_size() const { return segment.get_size(); }
   const size_t get_allocated() const { return allocated; }
+  void * get_base_address() const { return base_address; }
 };
 
 
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include "MPITransport.hpp"
+#include "Communicator.hpp"
+
+namespace Grappa {
+namespace impl {
+
+void MPITransport::init( Communicator * communicator ) {
+  comm_ = communicator->grappa_comm;
+}
+
+void MPITransport::post_send( CommunicatorContext * c, int dest, size_t size, int tag ) {
+  MPI_CHECK( MPI_Isend( c->buf, size, MPI_BYTE, dest, tag, comm_, &c->request ) );
+}
+
+void MPITransport::post_receive( CommunicatorContext * c ) {
+  MPI_CHECK( MPI_Irecv( c->buf, c->size, MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, comm_, &c->request ) );
+}
+
+bool MPITransport::test_send( CommunicatorContext * c, TransportStatus * status ) {
+  int flag;
+  MPI_Status mpi_status;
+  MPI_CHECK( MPI_Test( &c->request, &flag, &mpi_status ) );
+  if( flag ) {
+    status->source = mpi_status.MPI_SOURCE;
+    status->tag = mpi_status.MPI_TAG;
+    status->size = c->size;
+  }
+  return flag;
+}
+
+bool MPITransport::test_receive( CommunicatorContext * c, TransportStatus * status ) {
+  int flag;
+  MPI_Status mpi_status;
+  MPI_CHECK( MPI_Test( &c->request, &flag, &mpi_status ) );
+  if( flag ) {
+    status->source = mpi_status.MPI_SOURCE;
+    status->tag = mpi_status.MPI_TAG;
+    MPI_CHECK( MPI_Get_count( &mpi_status, MPI_BYTE, &status->size ) );
+  }
+  return flag;
+}
+
+void MPITransport::cancel( CommunicatorContext * c ) {
+  MPI_CHECK( MPI_Cancel( &c->request ) );
+}
+
+void MPITransport::barrier() {
+  MPI_CHECK( MPI_Barrier( comm_ ) );
+}
+
+void MPITransport::barrier_notify() {
+  MPI_CHECK( MPI_Ibarrier( comm_, &barrier_request_ ) );
+}
+
+bool MPITransport::barrier_try() {
+  int flag;
+  MPI_CHECK( MPI_Test( &barrier_request_, &flag, MPI_STATUS_IGNORE ) );
+  return flag;
+}
+
+} // namespace impl
+} // namespace Grappa
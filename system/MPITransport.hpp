@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <mpi.h>
+
+#include "Transport.hpp"
+
+namespace Grappa {
+namespace impl {
+
+/// Transport built on nonblocking MPI point-to-point calls. This is
+/// the default.
+class MPITransport : public Transport {
+  MPI_Comm comm_;
+  MPI_Request barrier_request_;
+
+public:
+  MPITransport()
+    : comm_( MPI_COMM_NULL )
+    , barrier_request_( MPI_REQUEST_NULL )
+  { }
+
+  virtual const char * name() const { return "mpi"; }
+
+  virtual void init( Communicator * communicator );
+  virtual void finish() { }
+
+  virtual void post_send( CommunicatorContext * c, int dest, size_t size, int tag );
+  virtual void post_receive( CommunicatorContext * c );
+  virtual bool test_send( CommunicatorContext * c, TransportStatus * status );
+  virtual bool test_receive( CommunicatorContext * c, TransportStatus * status );
+  virtual void cancel( CommunicatorContext * c );
+
+  virtual void barrier();
+  virtual void barrier_notify();
+  virtual bool barrier_try();
+};
+
+} // namespace impl
+} // namespace Grappa
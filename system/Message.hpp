@@ -37,6 +37,7 @@
 
 #include "MessageBase.hpp"
 #include "MessageBaseImpl.hpp"
+#include "Rendezvous.hpp"
 
 #include <glog/logging.h>
 
@@ -211,7 +212,6 @@ namespace Grappa {
     
     virtual ~PayloadMessage() {
       block_until_sent();
-      //if( delete_payload_after_send_ ) delete payload_;
     }
 
     inline void set_payload( void * payload, size_t size ) {
@@ -220,6 +220,8 @@ namespace Grappa {
       Grappa::impl::locale_shared_memory.validate_address( payload );
     }
 
+    /// Free the payload with locale_free() once the message has been
+    /// sent, so the sender doesn't have to wait around to do it.
     inline void delete_payload_after_send() { delete_payload_after_send_ = true; }
 
     virtual void reset() {
@@ -233,6 +235,24 @@ namespace Grappa {
       return "Message"; //typename_of(*this);
     }
 
+  protected:
+    virtual void mark_sent() {
+      // this is the last mark_sent unless we're waiting on a
+      // rendezvous pull or must go home first (see MessageBase)
+      bool final = !this->is_rendezvous_ && ( !this->is_delivered_ || Grappa::mycore() == this->source_ );
+      void * payload_copy = payload_;
+      bool delete_payload = delete_payload_after_send_;
+
+      Grappa::impl::MessageBase::mark_sent();
+
+      /* `this` may have been deleted */
+
+      if( final && delete_payload ) {
+        Grappa::locale_free( payload_copy );
+      }
+    }
+
+  public:
     ///
     /// for Messages with modifiable contents. Don't use with lambdas.
     ///
@@ -249,8 +269,17 @@ namespace Grappa {
 
 
 
+    /// Should the receiver pull the payload instead of having it
+    /// copied into the aggregation buffer?
+    inline bool use_rendezvous() const {
+      return Grappa::impl::global_rendezvous.use_for( destination_, payload_, payload_size_ );
+    }
+
     /// How much storage do we need to send this message?
     virtual const size_t serialized_size( ) const {
+      if( use_rendezvous() ) {
+        return sizeof( &deserialize_and_call ) + sizeof( T ) + sizeof( Grappa::impl::RendezvousDescriptor );
+      }
       return sizeof( &deserialize_and_call ) + sizeof( T ) + sizeof( int16_t ) + payload_size_;
     }
 
@@ -278,6 +307,22 @@ namespace Grappa {
       return t + payload_size;
     }
 
+    /// Deserialize a rendezvous descriptor and start pulling its
+    /// payload. The message is called once the payload has arrived.
+    ///
+    /// @param t address of message functor/descriptor in buffer
+    /// @return address of byte following message functor/descriptor in buffer
+    static char * deserialize_rendezvous_and_call( char * t ) {
+      DVLOG(5) << "In " << __PRETTY_FUNCTION__;
+      T * obj = reinterpret_cast< T * >( t );
+      t += sizeof( T );
+
+      Grappa::impl::RendezvousDescriptor * d = reinterpret_cast< Grappa::impl::RendezvousDescriptor * >( t );
+      Grappa::impl::global_rendezvous.receive( *obj, *d );
+
+      return t + sizeof( Grappa::impl::RendezvousDescriptor );
+    }
+
     virtual void deliver_locally() {
       if( !is_delivered_ ) {
         storage_( payload_, payload_size_ );
@@ -293,6 +338,23 @@ namespace Grappa {
       auto fp = &deserialize_and_call;
       if( serialized_size() > max_size ) {
         return p;
+      } else if( use_rendezvous() ) {
+        auto rfp = &deserialize_rendezvous_and_call;
+        MessageFPAddr gfp = { destination_, reinterpret_cast< intptr_t >( rfp ) };
+        *(reinterpret_cast< MessageFPAddr* >(p)) = gfp;
+        p += sizeof( gfp );
+
+        std::memcpy( p, &storage_, sizeof(storage_) );
+        p += sizeof( storage_ );
+
+        // payload stays where it is until the receiver has pulled it
+        Grappa::impl::RendezvousDescriptor d = { static_cast< char * >( payload_ ), this, payload_size_, source_ };
+        *(reinterpret_cast< Grappa::impl::RendezvousDescriptor* >(p)) = d;
+        is_rendezvous_ = true;
+
+        DVLOG(5) << __PRETTY_FUNCTION__ << " serialized rendezvous descriptor for " << payload_size_ << " bytes to " << gfp.dest << " with deserializer " << rfp;
+
+        return p + sizeof( d );
       } else {
         // // turn into 2D pointer
         // auto gfp = make_global( fp, destination_ );
@@ -86,6 +86,8 @@ namespace Grappa {
           bool is_sent_ : 1;           ///< Is our payload no longer needed?
           bool is_delivered_ : 1;      ///< Are we waiting to mark the message sent?
           bool is_moved_ : 1;          ///< HACK: make sure we don't try to send ourselves if we're just a temporary
+          bool is_rendezvous_ : 1;     ///< Is a receiver still pulling our payload?
+          bool is_urgent_ : 1;         ///< Should we go ahead of bulk traffic to our destination?
           Core source_ : 16;           ///< What core is this message coming from? (TODO: probably unneccesary)
           Core destination_ : 16;      ///< What core is this message aimed at?
         };
@@ -105,6 +107,13 @@ namespace Grappa {
         next_ = NULL;
         prefetch_ = NULL;
 
+        if( is_rendezvous_ ) {
+          // only a descriptor went out; the receiver will call
+          // rendezvous_complete() once it has pulled the payload
+          DVLOG(5) << __func__ << ": " << this << " Waiting for rendezvous completion";
+          return;
+        }
+
         //if( Grappa::mycore() != source_ ) {
         if( (is_delivered_ == true) && (Grappa::mycore() != source_) ) {
           DVLOG(5) << __func__ << ": " << this << " Re-enqueuing to " << source_;
@@ -129,6 +138,14 @@ namespace Grappa {
         }
       }
 
+      /// Called on the source core when the receiver has pulled a
+      /// rendezvous payload.
+      void rendezvous_complete() {
+        DCHECK_EQ( Grappa::mycore(), this->source_ );
+        is_rendezvous_ = false;
+        mark_sent();
+      }
+
       virtual const char * typestr() = 0;
 
       /// Active message handler to support sending messages through old aggregator
@@ -190,6 +207,8 @@ namespace Grappa {
         , is_sent_( false )
         , is_delivered_( false )
         , is_moved_( false )
+        , is_rendezvous_( false )
+        , is_urgent_( false )
         // , reset_count_(0)
         , delete_after_send_( false ) 
       { 
@@ -204,6 +223,8 @@ namespace Grappa {
         , is_sent_( false )
         , is_delivered_( false )
         , is_moved_( false )
+        , is_rendezvous_( false )
+        , is_urgent_( false )
         , source_( -1 )
         , destination_( dest )
         // , reset_count_(0)
@@ -232,6 +253,8 @@ namespace Grappa {
         , is_sent_( m.is_sent_ )
         , is_delivered_( m.is_delivered_ )
         , is_moved_( false ) // this only tells us if the current message has been moved
+        , is_rendezvous_( m.is_rendezvous_ )
+        , is_urgent_( m.is_urgent_ )
         , source_( m.source_ )
         , destination_( m.destination_ )
         // , reset_count_(0)
@@ -269,6 +292,12 @@ namespace Grappa {
         delete_after_send_ = true;
       }
 
+      /// Latency-critical message: send it immediately if possible,
+      /// otherwise ahead of bulk messages to the same locale.
+      inline void mark_urgent() {
+        is_urgent_ = true;
+      }
+
 
       virtual void reset() {
         // if( reset_count_ > 0 ) {
@@ -291,6 +320,8 @@ namespace Grappa {
         is_enqueued_ = false;
         is_sent_ = false;
         is_delivered_ = false;
+        is_rendezvous_ = false;
+        is_urgent_ = false;
       }
       
       /// Block until message can be deallocated.
@@ -0,0 +1,254 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glog/logging.h>
+
+#include <cstdint>
+#include <cstring>
+
+namespace Grappa {
+namespace impl {
+
+/// Lossless encoding for a run of serialized messages bound for one
+/// core, used to shrink aggregated buffers before they go on the wire.
+///
+/// Every serialized message starts with an 8-byte deserializer word,
+/// and consecutive messages of the same type tend to carry nearby
+/// addresses. Each message is encoded as:
+///   - a tag byte naming a dictionary entry for its deserializer word
+///     (0x80: entry is new and the raw word follows; 0x40: body length
+///     changed and a varint length follows)
+///   - the first few 8-byte words of the body as zigzag varint deltas
+///     from the previous message with the same deserializer
+///   - the rest of the body verbatim
+///
+/// The decoder only follows the tags, so the encoder alone decides
+/// which dictionary entry to replace when it is full. Dictionaries are
+/// reset for each run, so runs can be decoded independently.
+class MessageCodec {
+public:
+  static const int max_entries = 64;
+  static const int max_words = 8;
+
+private:
+  static const uint8_t new_entry_bit = 0x80;
+  static const uint8_t new_length_bit = 0x40;
+  static const uint8_t index_mask = 0x3f;
+
+  struct Entry {
+    int64_t key;
+    uint32_t length;
+    int64_t words[ max_words ];
+  };
+
+  Entry entries_[ max_entries ];
+  int count_;
+  int victim_;
+  int last_;
+
+  static inline char * put_varint( char * p, uint64_t v ) {
+    while( v >= 0x80 ) {
+      *p++ = static_cast< char >( v | 0x80 );
+      v >>= 7;
+    }
+    *p++ = static_cast< char >( v );
+    return p;
+  }
+
+  static inline const char * get_varint( const char * p, uint64_t * v ) {
+    uint64_t result = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      byte = static_cast< uint8_t >( *p++ );
+      result |= static_cast< uint64_t >( byte & 0x7f ) << shift;
+      shift += 7;
+    } while( byte & 0x80 );
+    *v = result;
+    return p;
+  }
+
+  static inline uint64_t zigzag( int64_t v ) {
+    return ( static_cast< uint64_t >( v ) << 1 ) ^ static_cast< uint64_t >( v >> 63 );
+  }
+
+  static inline int64_t unzigzag( uint64_t v ) {
+    return static_cast< int64_t >( v >> 1 ) ^ -static_cast< int64_t >( v & 1 );
+  }
+
+  inline void reset() {
+    count_ = 0;
+    victim_ = 0;
+    last_ = 0;
+  }
+
+  /// find the entry for a deserializer word, or -1
+  inline int find( int64_t key ) {
+    if( last_ < count_ && entries_[ last_ ].key == key ) return last_;
+    for( int i = 0; i < count_; ++i ) {
+      if( entries_[i].key == key ) return last_ = i;
+    }
+    return -1;
+  }
+
+  inline void install( int index, int64_t key ) {
+    entries_[ index ].key = key;
+    entries_[ index ].length = UINT32_MAX; // force explicit length on first use
+    memset( entries_[ index ].words, 0, sizeof( entries_[ index ].words ) );
+  }
+
+public:
+  MessageCodec() { reset(); }
+
+  /// Largest encoding of a message with a body of this many bytes.
+  static inline size_t max_encoded_size( size_t body ) {
+    size_t words = body / 8 < max_words ? body / 8 : max_words;
+    return 1 + 8 + 5 + 10 * words + ( body - 8 * words );
+  }
+
+  /// Encode the messages in [begin, ends[n-1]), where ends[i] points
+  /// just past message i. Returns the encoded size, or 0 if the
+  /// encoding would not fit in out_max bytes.
+  size_t encode( const char * begin, char * const * ends, size_t n, char * out, size_t out_max ) {
+    reset();
+    char * p = out;
+    char * out_end = out + out_max;
+    const char * m = begin;
+
+    for( size_t i = 0; i < n; ++i ) {
+      const char * m_end = ends[i];
+      DCHECK_GE( m_end - m, 8 ) << "Serialized message shorter than its deserializer";
+      uint32_t length = ( m_end - m ) - 8;
+      if( max_encoded_size( length ) > static_cast< size_t >( out_end - p ) ) return 0;
+
+      int64_t key;
+      memcpy( &key, m, sizeof(key) );
+      m += sizeof(key);
+
+      char * tag = p++;
+      int index = find( key );
+      if( index < 0 ) {
+        if( count_ < max_entries ) {
+          index = count_++;
+        } else {
+          index = victim_;
+          victim_ = ( victim_ + 1 ) % max_entries;
+        }
+        last_ = index;
+        install( index, key );
+        *tag = static_cast< char >( new_entry_bit | index );
+        memcpy( p, &key, sizeof(key) );
+        p += sizeof(key);
+      } else {
+        *tag = static_cast< char >( index );
+      }
+
+      Entry& e = entries_[ index ];
+      if( e.length != length ) {
+        *tag |= new_length_bit;
+        p = put_varint( p, length );
+        e.length = length;
+      }
+
+      int words = length / 8 < max_words ? length / 8 : max_words;
+      for( int w = 0; w < words; ++w ) {
+        int64_t v;
+        memcpy( &v, m, sizeof(v) );
+        m += sizeof(v);
+        p = put_varint( p, zigzag( static_cast< int64_t >( static_cast< uint64_t >( v ) - static_cast< uint64_t >( e.words[w] ) ) ) );
+        e.words[w] = v;
+      }
+
+      size_t rest = length - 8 * words;
+      memcpy( p, m, rest );
+      p += rest;
+      m += rest;
+    }
+
+    return p - out;
+  }
+
+  /// Decode a run produced by encode(). Returns the decoded size.
+  size_t decode( const char * in, size_t size, char * out, size_t out_max ) {
+    reset();
+    const char * p = in;
+    const char * in_end = in + size;
+    char * q = out;
+
+    while( p < in_end ) {
+      uint8_t tag = static_cast< uint8_t >( *p++ );
+      int index = tag & index_mask;
+      if( tag & new_entry_bit ) {
+        int64_t key;
+        memcpy( &key, p, sizeof(key) );
+        p += sizeof(key);
+        install( index, key );
+      }
+
+      Entry& e = entries_[ index ];
+      if( tag & new_length_bit ) {
+        uint64_t length;
+        p = get_varint( p, &length );
+        e.length = length;
+      }
+
+      CHECK_LE( 8 + e.length, out_max - ( q - out ) ) << "Decoded messages overflow buffer";
+      memcpy( q, &e.key, sizeof(e.key) );
+      q += sizeof(e.key);
+
+      int words = e.length / 8 < max_words ? e.length / 8 : max_words;
+      for( int w = 0; w < words; ++w ) {
+        uint64_t d;
+        p = get_varint( p, &d );
+        int64_t v = static_cast< int64_t >( static_cast< uint64_t >( e.words[w] ) + static_cast< uint64_t >( unzigzag( d ) ) );
+        memcpy( q, &v, sizeof(v) );
+        q += sizeof(v);
+        e.words[w] = v;
+      }
+
+      size_t rest = e.length - 8 * words;
+      memcpy( q, p, rest );
+      q += rest;
+      p += rest;
+    }
+
+    DCHECK_EQ( p, in_end ) << "Encoded run ended mid-message";
+    return q - out;
+  }
+};
+
+} // namespace impl
+} // namespace Grappa
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "MessageCodec.hpp"
+
+BOOST_AUTO_TEST_SUITE( MessageCodec_tests );
+
+static const int buffer_size = 1 << 16;
+
+/// append a message with a deserializer word, some address-like words, and a tail
+static char * append( char * p, int64_t fp, int64_t base, int i, int tail ) {
+  memcpy( p, &fp, sizeof(fp) ); p += sizeof(fp);
+  int64_t address = base + 8 * i;
+  memcpy( p, &address, sizeof(address) ); p += sizeof(address);
+  int64_t value = i % 3;
+  memcpy( p, &value, sizeof(value) ); p += sizeof(value);
+  memset( p, i & 0x7f, tail ); p += tail;
+  return p;
+}
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  static char raw[ buffer_size ];
+  static char encoded[ buffer_size ];
+  static char decoded[ buffer_size ];
+  Grappa::impl::MessageCodec encoder, decoder;
+
+  // a few message types interleaved, with more types than fit in the dictionary
+  std::vector< char * > ends;
+  char * p = raw;
+  for( int i = 0; i < 1000; ++i ) {
+    int64_t fp = 0x400000 + 0x40 * ( i % 5 == 0 ? 100 + i % 97 : i % 3 );
+    p = append( p, fp, 0x10000000 * ( i % 3 ), i, i % 3 == 2 ? 3 : 0 );
+    ends.push_back( p );
+  }
+  size_t raw_size = p - raw;
+
+  size_t encoded_size = encoder.encode( raw, &ends[0], ends.size(), encoded, raw_size );
+  BOOST_CHECK_GT( encoded_size, 0 );
+  BOOST_CHECK_LT( encoded_size, raw_size / 2 );
+  BOOST_MESSAGE( "encoded " << raw_size << " bytes to " << encoded_size );
+
+  size_t decoded_size = decoder.decode( encoded, encoded_size, decoded, buffer_size );
+  BOOST_CHECK_EQUAL( decoded_size, raw_size );
+  BOOST_CHECK( 0 == memcmp( raw, decoded, raw_size ) );
+
+  // incompressible data is refused rather than expanded
+  std::vector< char * > random_ends;
+  p = raw;
+  uint64_t x = 88172645463325252ULL;
+  for( int i = 0; i < 100; ++i ) {
+    for( int w = 0; w < 4; ++w ) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      memcpy( p, &x, sizeof(x) ); p += sizeof(x);
+    }
+    random_ends.push_back( p );
+  }
+  raw_size = p - raw;
+  BOOST_CHECK_EQUAL( encoder.encode( raw, &random_ends[0], random_ends.size(), encoded, raw_size ), 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,175 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <cstdint>
+
+namespace Grappa {
+namespace impl {
+
+/// Single-producer/single-consumer ring of serialized messages, used
+/// to hand messages between a pair of cores in the same locale.
+///
+/// Rings live in locale shared memory, which is mapped at the same
+/// address in every process, so the data pointer is valid on both
+/// sides. Each record is an 8-byte header holding the record length
+/// followed by the serialized message, padded to a multiple of 8
+/// bytes. A zero header marks the point where the producer wrapped
+/// around to the start of the buffer.
+class MessageRing {
+  ///
+  /// producer cache line
+  ///
+
+  /// total bytes published by producer
+  uint64_t tail_;
+  /// producer's most recent view of head_
+  uint64_t cached_head_;
+  /// bytes skipped by current reservation to avoid wrapping a record
+  uint64_t reserved_skip_;
+  char * data_;
+  uint64_t size_;
+  int64_t pad1_[3];
+
+  ///
+  /// consumer cache line
+  ///
+
+  /// total bytes consumed by consumer
+  uint64_t head_;
+  /// consumer's most recent view of tail_
+  uint64_t cached_tail_;
+  int64_t pad2_[6];
+
+  static inline uint64_t round_up( uint64_t n ) { return (n + 7) & ~7ULL; }
+
+  inline uint64_t load_acquire( const uint64_t * p ) const { return __atomic_load_n( p, __ATOMIC_ACQUIRE ); }
+  inline void store_release( uint64_t * p, uint64_t v ) { __atomic_store_n( p, v, __ATOMIC_RELEASE ); }
+
+public:
+  MessageRing()
+    : tail_( 0 )
+    , cached_head_( 0 )
+    , reserved_skip_( 0 )
+    , data_( nullptr )
+    , size_( 0 )
+    , head_( 0 )
+    , cached_tail_( 0 )
+  { }
+
+  /// Attach storage; size must be a power of two.
+  void init( char * data, uint64_t size ) {
+    CHECK_EQ( size & (size - 1), 0 ) << "Ring size must be a power of two";
+    CHECK_EQ( reinterpret_cast< intptr_t >( data ) % 8, 0 ) << "Ring storage must be 8-byte aligned";
+    data_ = data;
+    size_ = size;
+    tail_ = cached_head_ = reserved_skip_ = 0;
+    head_ = cached_tail_ = 0;
+  }
+
+  inline char * data() const { return data_; }
+  inline bool empty() const { return head_ == load_acquire( &tail_ ); }
+
+  ///
+  /// producer side
+  ///
+
+  /// Reserve space for a record of up to `size` bytes. Returns
+  /// pointer to write record into, or nullptr if the ring is full.
+  inline char * reserve( size_t size ) {
+    uint64_t record = sizeof(uint64_t) + round_up( size );
+    uint64_t pos = tail_ & (size_ - 1);
+    uint64_t skip = ( pos + record > size_ ) ? size_ - pos : 0;
+    uint64_t needed = skip + record;
+
+    if( needed > size_ - (tail_ - cached_head_) ) {
+      cached_head_ = load_acquire( &head_ );
+      if( needed > size_ - (tail_ - cached_head_) ) {
+        return nullptr;
+      }
+    }
+
+    if( skip ) {
+      // mark wrap point and start again at the beginning
+      *reinterpret_cast< uint64_t* >( data_ + pos ) = 0;
+      pos = 0;
+    }
+    reserved_skip_ = skip;
+    return data_ + pos + sizeof(uint64_t);
+  }
+
+  /// Publish a record of `size` bytes written to space returned by
+  /// the most recent call to reserve().
+  inline void commit( size_t size ) {
+    uint64_t record = sizeof(uint64_t) + round_up( size );
+    uint64_t pos = (tail_ + reserved_skip_) & (size_ - 1);
+    *reinterpret_cast< uint64_t* >( data_ + pos ) = record;
+    store_release( &tail_, tail_ + reserved_skip_ + record );
+    reserved_skip_ = 0;
+  }
+
+  ///
+  /// consumer side
+  ///
+
+  /// Return pointer to oldest record, or nullptr if ring is empty.
+  inline char * front() {
+    if( head_ == cached_tail_ ) {
+      cached_tail_ = load_acquire( &tail_ );
+      if( head_ == cached_tail_ ) return nullptr;
+    }
+    uint64_t pos = head_ & (size_ - 1);
+    if( *reinterpret_cast< uint64_t* >( data_ + pos ) == 0 ) {
+      // producer wrapped here; skip to start of buffer
+      head_ += size_ - pos;
+      pos = 0;
+    }
+    return data_ + pos + sizeof(uint64_t);
+  }
+
+  /// Release oldest record so producer can reuse its space.
+  inline void pop() {
+    uint64_t pos = head_ & (size_ - 1);
+    uint64_t record = *reinterpret_cast< uint64_t* >( data_ + pos );
+    DCHECK_GT( record, 0 );
+    store_release( &head_, head_ + record );
+  }
+
+} __attribute__((aligned(64)));
+
+} // namespace impl
+} // namespace Grappa
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+
+#include "MessageRing.hpp"
+
+BOOST_AUTO_TEST_SUITE( MessageRing_tests );
+
+static const int ring_size = 1 << 10;
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  static char storage[ ring_size ] __attribute__((aligned(64)));
+  Grappa::impl::MessageRing r;
+  r.init( &storage[0], ring_size );
+
+  BOOST_CHECK( r.empty() );
+  BOOST_CHECK( r.front() == nullptr );
+
+  // push variable-size records through many times so we exercise wraparound
+  int produced = 0;
+  int consumed = 0;
+  for( int round = 0; round < 100; ++round ) {
+    // fill until full
+    while( true ) {
+      int size = 8 + (produced % 13) * 4;
+      char * p = r.reserve( size );
+      if( !p ) break;
+      memset( p, produced & 0x7f, size );
+      *reinterpret_cast<int*>( p ) = produced;
+      r.commit( size );
+      produced++;
+    }
+    BOOST_CHECK( !r.empty() );
+
+    // drain about half, checking order and contents
+    int to_drain = (produced - consumed + 1) / 2;
+    for( int i = 0; i < to_drain; ++i ) {
+      char * p = r.front();
+      BOOST_REQUIRE( p != nullptr );
+      BOOST_CHECK_EQUAL( *reinterpret_cast<int*>( p ), consumed );
+      int size = 8 + (consumed % 13) * 4;
+      BOOST_CHECK_EQUAL( p[size-1], consumed & 0x7f );
+      r.pop();
+      consumed++;
+    }
+  }
+
+  // drain the rest
+  while( char * p = r.front() ) {
+    BOOST_CHECK_EQUAL( *reinterpret_cast<int*>( p ), consumed );
+    r.pop();
+    consumed++;
+  }
+  BOOST_CHECK_EQUAL( produced, consumed );
+  BOOST_CHECK( r.empty() );
+
+  // records larger than the ring never fit
+  BOOST_CHECK( r.reserve( ring_size ) == nullptr );
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -241,6 +241,124 @@ void check_call_suspending() {
   BOOST_CHECK_EQUAL(x, y);
 }
 
+void check_futures() {
+  BOOST_MESSAGE("check_futures");
+  const int N = 1 << 6;
+  call_on_all_cores([]{ global_x = mycore() * 100; });
+
+  // chain a remote call into another remote call and a local step
+  auto xa = make_global(&global_x, 1);
+  auto f = delegate::read_future(xa)
+    .then([](int x){
+      return delegate::call_future(0, [x]{ return x + global_x; });
+    })
+    .then([](int y){ return y + 1; });
+  BOOST_CHECK_EQUAL(f.get(), 101);
+
+  // a continuation added after the value arrived still runs
+  auto g = make_ready_future(7);
+  BOOST_CHECK_EQUAL(g.then([](int v){ return v * 2; }).get(), 14);
+
+  std::vector< Future<int> > fs;
+  for (int i=0; i<N; i++) {
+    fs.push_back(delegate::call_future(i % cores(), [i]{ return global_x + i; }));
+  }
+  auto all = when_all(fs).get();
+  BOOST_CHECK_EQUAL(all.size(), N);
+  for (int i=0; i<N; i++) BOOST_CHECK_EQUAL(all[i], (i % cores()) * 100 + i);
+
+  auto any = when_any(fs).get();
+  BOOST_CHECK_LT(any.first, N);
+  BOOST_CHECK_EQUAL(any.second, all[any.first]);
+}
+
+int64_t atomic_targ = 0;
+void check_remote_atomics() {
+  BOOST_MESSAGE("check_remote_atomics");
+  auto ta = make_global(&atomic_targ, 1);
+  const int N = 64;
+
+  delegate::write(ta, 100);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_min(ta, 50), 100);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_min(ta, 70), 50);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_max(ta, 80), 50);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_or(ta, 0x100), 80);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_and(ta, 0x1ff), 0x150);
+  BOOST_CHECK_EQUAL(delegate::fetch_and_xor(ta, 0x1), 0x150);
+  BOOST_CHECK_EQUAL(delegate::swap(ta, -1), 0x151);
+  BOOST_CHECK_EQUAL((delegate::fetch_and_apply<delegate::op::WriteIfUnset<>>(ta, 7)), -1);
+  BOOST_CHECK_EQUAL((delegate::fetch_and_apply<delegate::op::WriteIfUnset<>>(ta, 8)), 7);
+  BOOST_CHECK_EQUAL(delegate::read(ta), 7);
+
+  // concurrent blocking mins get combined, but each sees a consistent
+  // previous value
+  delegate::write(ta, N);
+  CompletionEvent done(N);
+  int64_t seen_max = 0;
+  for (int i=0; i<N; i++) {
+    spawn([ta,i,&done,&seen_max]{
+      auto prev = delegate::fetch_and_min(ta, i);
+      BOOST_CHECK(prev >= 0 && prev <= N);
+      if (prev > seen_max) seen_max = prev;
+      done.complete();
+    });
+  }
+  done.wait();
+  BOOST_CHECK_EQUAL(seen_max, N);
+  BOOST_CHECK_EQUAL(delegate::read(ta), 0);
+
+  // fire-and-forget
+  finish([ta]{
+    for (int i=0; i<N; i++) {
+      delegate::atomic_max<async>(ta, i);
+    }
+  });
+  BOOST_CHECK_EQUAL(delegate::read(ta), N-1);
+
+  FLAGS_delegate_atomic_combining = false;
+  finish([ta]{
+    for (int i=0; i<N; i++) {
+      delegate::apply<delegate::op::Add,async>(ta, 1);
+    }
+  });
+  FLAGS_delegate_atomic_combining = true;
+  BOOST_CHECK_EQUAL(delegate::read(ta), 2*N-1);
+}
+
+void check_batches() {
+  BOOST_MESSAGE("check_batches");
+  const size_t N = 1000;
+  auto xs = global_alloc<int64_t>(N);
+
+  // shuffled targets, including some on this core
+  std::vector< GlobalAddress<int64_t> > targets(N);
+  std::vector< int64_t > values(N), results(N);
+  for (size_t i=0; i<N; i++) {
+    size_t j = (i * 389) % N;
+    targets[i] = xs + j;
+    values[i] = j;
+  }
+
+  delegate::write_batch(targets.data(), values.data(), N);
+  for (size_t j=0; j<N; j++) BOOST_CHECK_EQUAL(delegate::read(xs+j), j);
+
+  delegate::read_batch(targets.data(), N, results.data());
+  for (size_t i=0; i<N; i++) BOOST_CHECK_EQUAL(results[i], values[i]);
+
+  // force several messages per destination
+  auto max_bytes = FLAGS_delegate_batch_max_bytes;
+  FLAGS_delegate_batch_max_bytes = 64;
+  std::vector< int64_t > incs(N, 5);
+  delegate::fetch_and_add_batch(targets.data(), incs.data(), N, results.data());
+  FLAGS_delegate_batch_max_bytes = max_bytes;
+  for (size_t i=0; i<N; i++) BOOST_CHECK_EQUAL(results[i], values[i]);
+
+  delegate::read_batch(targets.data(), N, results.data());
+  for (size_t i=0; i<N; i++) BOOST_CHECK_EQUAL(results[i], values[i] + 5);
+
+  global_free(xs);
+}
+
 BOOST_AUTO_TEST_CASE( test1 ) {
   Grappa::init( GRAPPA_TEST_ARGS );
   Grappa::run([]{
@@ -257,6 +375,12 @@ BOOST_AUTO_TEST_CASE( test1 ) {
     check_fetch_add_combining();
  
     check_call_suspending();
+
+    check_futures();
+
+    check_batches();
+
+    check_remote_atomics();
  
     int64_t seed = 111;
     GlobalAddress<int64_t> seed_addr = make_global(&seed);
@@ -308,6 +308,52 @@ void test_forall_here_async() {
   }
 }
 
+void test_forall_lazy() {
+  BOOST_MESSAGE("Testing lazy splitting..."); VLOG(1) << "testing lazy splitting";
+  const int64_t N = 1 << 16;
+  
+  {
+    int64_t x = 0;
+    forall_here<lazy>(0, N, [&x](int64_t start, int64_t iters) {
+      CHECK(mycore() == 0);
+      x += iters;
+    });
+    BOOST_CHECK_EQUAL(x, N);
+  }
+  
+  auto xs = global_alloc<int64_t>(N);
+  forall<lazy,unbound>(0, N, [xs](int64_t i) {
+    delegate::write<async>(xs+i, i);
+  });
+  forall<lazy>(xs, N, [](int64_t i, int64_t& v) {
+    BOOST_CHECK_EQUAL(v, i);
+  });
+  global_free(xs);
+}
+
+void test_forall_adaptive() {
+  BOOST_MESSAGE("Testing adaptive grain size..."); VLOG(1) << "testing adaptive grain size";
+  const int64_t N = 1 << 16;
+  
+  // run the same loop several times so later calls use the learned threshold
+  for (int r = 0; r < 3; r++) {
+    int64_t x = 0;
+    forall_here<ADAPTIVE_GRAIN>(0, N, [&x](int64_t start, int64_t iters) {
+      x += iters;
+    });
+    BOOST_CHECK_EQUAL(x, N);
+  }
+  
+  auto xs = global_alloc<int64_t>(N);
+  forall<ADAPTIVE_GRAIN>(0, N, [xs](int64_t i) {
+    delegate::write<async>(xs+i, 2*i);
+  });
+  forall<lazy,TaskMode::Bound,SyncMode::Blocking,&impl::local_gce,ADAPTIVE_GRAIN>(xs, N, [](int64_t i, int64_t& v) {
+    BOOST_CHECK_EQUAL(v, 2*i);
+  });
+  global_free(xs);
+}
+
 BOOST_AUTO_TEST_CASE( test1 ) {
   Grappa::init( GRAPPA_TEST_ARGS );
   Grappa::run([]{
@@ -327,6 +373,9 @@ BOOST_AUTO_TEST_CASE( test1 ) {
     test_forall_localized();
 
     test_forall_here_async();
+
+    test_forall_lazy();
+    test_forall_adaptive();
     
     Metrics::merge_and_dump_to_file();
   });
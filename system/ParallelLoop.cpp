@@ -35,12 +35,35 @@
 #include "ParallelLoop.hpp"
 #include "CompletionEvent.hpp"
 #include "GlobalCompletionEvent.hpp"
+#include "Metrics.hpp"
 
 DEFINE_int64(loop_threshold, 16, "threshold for how small a group of iterations should be to perform them serially");
+DEFINE_bool(loop_adaptive_grain, false, "learn the threshold of each loop that would use loop_threshold from the measured cost of its iterations");
+DEFINE_int64(loop_grain_samples, 8, "number of chunks to time before choosing an adaptive loop threshold");
+DEFINE_int64(loop_grain_target_ticks, 100000, "ticks an adaptively-sized chunk of loop iterations should take");
+DEFINE_int64(loop_grain_max, 1 << 20, "largest threshold an adaptive loop will choose");
+
+GRAPPA_DEFINE_METRIC(SummarizingMetric<int64_t>, loop_adaptive_grain, 0);
+GRAPPA_DEFINE_METRIC(SummarizingMetric<double>, loop_adaptive_iteration_ticks, 0.0);
 
 namespace Grappa {
   namespace impl {
     CompletionEvent local_ce;
     GlobalCompletionEvent local_gce;
+    
+    void AdaptiveGrain::record(int64_t iters, Grappa::Timestamp ticks) {
+      if (!learning()) return; // another task finished learning while we ran
+      samples++;
+      sampled_iters += iters;
+      sampled_ticks += ticks;
+      if (!learning()) {
+        double per_iter = std::max(1.0, static_cast<double>(sampled_ticks) / std::max<int64_t>(1, sampled_iters));
+        grain = std::min<int64_t>(FLAGS_loop_grain_max,
+                  std::max<int64_t>(1, FLAGS_loop_grain_target_ticks / per_iter));
+        loop_adaptive_grain += grain;
+        loop_adaptive_iteration_ticks += per_iter;
+        VLOG(2) << "Learned loop threshold " << grain << " at " << per_iter << " ticks/iteration";
+      }
+    }
   }
 }
@@ -57,6 +57,12 @@
 /// parallel loop functions.
 DECLARE_int64(loop_threshold);
 
+/// Flag: loop_adaptive_grain
+///
+/// Learn the threshold for each loop that would otherwise use `loop_threshold` (see `ADAPTIVE_GRAIN`).
+DECLARE_bool(loop_adaptive_grain);
+DECLARE_int64(loop_grain_samples);
+
 namespace Grappa {
   /// @addtogroup Loops
   /// @{
@@ -66,12 +72,108 @@ namespace Grappa {
     /// (default for loop decompositions)
     const int64_t USE_LOOP_THRESHOLD_FLAG = 0;
     
+    /// Declares that the loop threshold should be learned separately for each loop, from
+    /// the measured cost of its first few chunks of iterations.
+    const int64_t USE_ADAPTIVE_THRESHOLD = -1;
+    
+    /// Grain size learned for one parallel loop. Times the first `loop_grain_samples` chunks
+    /// (run at `loop_threshold` iterations each), then picks a threshold so a chunk takes about
+    /// `loop_grain_target_ticks`. Times are elapsed, so include any time a chunk spends blocked.
+    class AdaptiveGrain {
+      int64_t grain;
+      int64_t samples;
+      int64_t sampled_iters;
+      Grappa::Timestamp sampled_ticks;
+    public:
+      AdaptiveGrain(): grain(0), samples(0), sampled_iters(0), sampled_ticks(0) {}
+      
+      int64_t threshold() const { return grain > 0 ? grain : FLAGS_loop_threshold; }
+      bool learning() const { return samples < FLAGS_loop_grain_samples; }
+      
+      /// Account for a chunk of iterations that took `ticks`.
+      void record(int64_t iters, Grappa::Timestamp ticks);
+    };
+    
+    /// One AdaptiveGrain per loop body type, i.e. per call site.
+    template< typename F >
+    AdaptiveGrain& adaptive_grain() {
+      static AdaptiveGrain g;
+      return g;
+    }
+    
+    template< int64_t Threshold >
+    inline bool uses_adaptive_grain() {
+      return Threshold == USE_ADAPTIVE_THRESHOLD
+        || (Threshold == USE_LOOP_THRESHOLD_FLAG && FLAGS_loop_adaptive_grain);
+    }
+    
+    /// Number of iterations below which a loop should run serially.
+    template< int64_t Threshold, typename F >
+    inline int64_t loop_threshold() {
+      if (uses_adaptive_grain<Threshold>()) return adaptive_grain<F>().threshold();
+      return (Threshold == USE_LOOP_THRESHOLD_FLAG) ? FLAGS_loop_threshold : Threshold;
+    }
+    
+    /// Run one serial chunk of a loop, timing it if its grain size is still being learned.
+    template< int64_t Threshold, typename F >
+    inline void run_chunk(int64_t start, int64_t iterations, F& loop_body) {
+      if (uses_adaptive_grain<Threshold>() && adaptive_grain<F>().learning()) {
+        Grappa::Timestamp t = Grappa::force_tick();
+        loop_body(start, iterations);
+        adaptive_grain<F>().record(iterations, Grappa::force_tick() - t);
+      } else {
+        loop_body(start, iterations);
+      }
+    }
+    
   } // namespace impl
   
+  /// Use as the `Threshold` template argument of a parallel loop to have its
+  /// grain size learned at runtime, e.g. `forall<ADAPTIVE_GRAIN>(...)`.
+  const int64_t ADAPTIVE_GRAIN = impl::USE_ADAPTIVE_THRESHOLD;
+  
   inline GlobalCompletionEvent& default_gce() { return local_gce; }
     
   namespace impl {
     
+    /// Does lazy binary splitting: runs iterations serially, `Threshold` at a time, and only
+    /// splits off the back half of what's left as a new task when this core has no other
+    /// tasks waiting (because none were spawned yet, or a thief or idle worker took them).
+    /// Regular loops end up with a few big tasks instead of a tree of tiny ones, while
+    /// irregular loops still split as often as needed to keep workers busy.
+    ///
+    /// Enrolls/completes split-off tasks with the GlobalCompletionEvent like `loop_decomposition`.
+    template< TaskMode B,
+              GlobalCompletionEvent * C,
+              int64_t Threshold,
+              typename F >
+    void lazy_loop_decomposition(int64_t start, int64_t iterations, F loop_body) {
+      int64_t end = start + iterations;
+      
+      while (start < end) {
+        int64_t remaining = end - start;
+        const int64_t chunk = loop_threshold<Threshold,F>();
+        
+        if (remaining > chunk && !global_task_manager.local_available()) {
+          // nothing else to do here, so give away the back half
+          int64_t rstart = start + (remaining+1)/2, riters = remaining/2;
+          Core origin = mycore();
+          struct { long rstart:48, riters:48, origin:16; } packed = { rstart, riters, origin };
+          
+          if (C) C->enroll();
+          spawn<B>([packed, loop_body] {
+            lazy_loop_decomposition<B,C,Threshold>(packed.rstart, packed.riters, loop_body);
+            if (C) C->send_completion(packed.origin);
+          });
+          end = rstart;
+        } else {
+          int64_t n = std::min(chunk, remaining);
+          run_chunk<Threshold>(start, n, loop_body);
+          start += n;
+        }
+      }
+    }
+    
     /// Does recursive loop decomposition, subdividing iterations by 2 until reaching
     /// the threshold and serializing the remaining iterations at each leaf.
     /// Note: this is an internal primitive for spawning tasks and does not synchronize on spawned tasks.
@@ -85,18 +187,22 @@ namespace Grappa {
     /// user-defined storage.
     ///
     /// warning: truncates int64_t's to 48 bits--should be enough for most problem sizes.
+    ///
+    /// With `SplitMode::Lazy`, does lazy binary splitting instead (see `lazy_loop_decomposition`).
     template< TaskMode B,
               GlobalCompletionEvent * C = nullptr,
               int64_t Threshold = USE_LOOP_THRESHOLD_FLAG,
+              SplitMode P = SplitMode::Eager,
               typename F = decltype(nullptr) >
     void loop_decomposition(int64_t start, int64_t iterations, F loop_body) {
       DVLOG(4) << "< " << start << " : " << iterations << ">";
       
-      if (iterations == 0) {
+      if (P == SplitMode::Lazy) {
+        lazy_loop_decomposition<B,C,Threshold>(start, iterations, loop_body);
+      } else if (iterations == 0) {
         return;
-      } else if ((Threshold == USE_LOOP_THRESHOLD_FLAG && iterations <= FLAGS_loop_threshold)
-                 || iterations <= Threshold) {
-        loop_body(start, iterations);
+      } else if (iterations <= loop_threshold<Threshold,F>()) {
+        run_chunk<Threshold>(start, iterations, loop_body);
         return;
       } else {
         // spawn right half
@@ -129,7 +235,8 @@ namespace Grappa {
     
   namespace impl {
     
-    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold, typename F>
+    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold,
+             SplitMode P = SplitMode::Eager, typename F = decltype(nullptr)>
     void forall_here(int64_t start, int64_t iters, F loop_body,
                      void (F::*mf)(int64_t,int64_t) const)
     {
@@ -146,7 +253,7 @@ namespace Grappa {
       if (C == nullptr && S == SyncMode::Blocking) {
         if (B == TaskMode::Bound) {
           CompletionEvent ce(iters);
-          impl::loop_decomposition<B,C,Threshold>(start, iters,
+          impl::loop_decomposition<B,C,Threshold,P>(start, iters,
           [&loop_body,&ce](int64_t s, int64_t n){
             loop_body(s, n);
             ce.complete(n);
@@ -159,18 +266,19 @@ namespace Grappa {
           && sizeof(F) > 8
           && C->get_shared_ptr<F>() == nullptr) {
         auto hf = new HeapF(loop_body, iters);
-        impl::loop_decomposition<B,C,Threshold>(start, iters,
+        impl::loop_decomposition<B,C,Threshold,P>(start, iters,
             [hf](int64_t s, int64_t n){
           hf->loop_body(s, n);
           hf->ref(-n);
         });
       } else {
-        impl::loop_decomposition<B,C,Threshold>(start, iters, loop_body);
+        impl::loop_decomposition<B,C,Threshold,P>(start, iters, loop_body);
         if (S == SyncMode::Blocking && C) C->wait();
       }
     }
     
-    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold, typename F>
+    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold,
+             SplitMode P = SplitMode::Eager, typename F = decltype(nullptr)>
     void forall_here(int64_t start, int64_t iters, F loop_body,
                      void (F::*mf)(int64_t) const)
     {
@@ -179,12 +287,13 @@ namespace Grappa {
           loop_body(s+i);
         }
       };
-      impl::forall_here<B,S,C,Threshold>(start, iters, f, &decltype(f)::operator());
+      impl::forall_here<B,S,C,Threshold,P>(start, iters, f, &decltype(f)::operator());
     }
     
-    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold, typename F>
+    template<TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold,
+             SplitMode P = SplitMode::Eager, typename F = decltype(nullptr)>
     void forall_here(int64_t start, int64_t iters, F loop_body) {
-      forall_here<B,S,C,Threshold>(start, iters, loop_body, &F::operator());
+      forall_here<B,S,C,Threshold,P>(start, iters, loop_body, &F::operator());
     }
     
   }
@@ -232,9 +341,21 @@ namespace Grappa {
   
 #undef FORALL_HERE_OVERLOAD
   
+  /// Overload for lazy splitting (SplitMode first)
+  template< SplitMode P,
+            TaskMode B = TaskMode::Bound,
+            SyncMode S = SyncMode::Blocking,
+            GlobalCompletionEvent * GCE = nullptr,
+            int64_t Threshold = impl::USE_LOOP_THRESHOLD_FLAG,
+            typename F = decltype(nullptr) >
+  void forall_here(int64_t start, int64_t iters, F loop_body) {
+    impl::forall_here<B,S,GCE,Threshold,P>(start, iters, loop_body);
+  }
+  
   namespace impl {
   
-    template< TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold, typename F >
+    template< TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold,
+              SplitMode P = SplitMode::Eager, typename F = decltype(nullptr) >
     void forall(int64_t start, int64_t iters, F loop_body,
         void (F::*mf)(int64_t,int64_t) const) {
       static_assert( C != nullptr, "GCE template arg cannot be null; need the GCE to store shared args");
@@ -254,7 +375,7 @@ namespace Grappa {
           C->set_shared_ptr(&loop_body);
           barrier();
           
-          forall_here<B,SyncMode::Async,C,Threshold>(r.start, r.end-r.start, [](int64_t s, int64_t n){
+          forall_here<B,SyncMode::Async,C,Threshold,P>(r.start, r.end-r.start, [](int64_t s, int64_t n){
             auto& loop_body = *C->get_shared_ptr<F>();
             loop_body(s,n);
           });
@@ -265,7 +386,7 @@ namespace Grappa {
           
         } else {
           
-          forall_here<B,SyncMode::Async,C,Threshold>(r.start, r.end-r.start, loop_body);
+          forall_here<B,SyncMode::Async,C,Threshold,P>(r.start, r.end-r.start, loop_body);
           C->send_completion(origin);
           if (S == SyncMode::Blocking) C->wait();
           
@@ -274,14 +395,15 @@ namespace Grappa {
     }
     
     // Convert lambda to `void(i64,i64)`
-    template< TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold, typename F >
+    template< TaskMode B, SyncMode S, GlobalCompletionEvent * C, int64_t Threshold,
+              SplitMode P = SplitMode::Eager, typename F = decltype(nullptr) >
     void forall(int64_t start, int64_t iters, F loop_body, void (F::*mf)(int64_t) const) {
       auto f = [loop_body](int64_t s, int64_t n){
         for (int64_t i=0; i < n; i++) {
           loop_body(s+i);
         }
       };
-      impl::forall<B,S,C,Threshold>(start, iters, f, &decltype(f)::operator());
+      impl::forall<B,S,C,Threshold,P>(start, iters, f, &decltype(f)::operator());
     }
   }
   
@@ -317,6 +439,17 @@ namespace Grappa {
                   int64_t Threshold = impl::USE_LOOP_THRESHOLD_FLAG);
                   
   
+  /// Overload for lazy splitting (SplitMode first)
+  template< SplitMode P,
+            TaskMode B = TaskMode::Bound,
+            SyncMode S = SyncMode::Blocking,
+            GlobalCompletionEvent * C = &impl::local_gce,
+            int64_t Threshold = impl::USE_LOOP_THRESHOLD_FLAG,
+            typename F = decltype(nullptr) >
+  void forall(int64_t start, int64_t iters, F loop_body) {
+    impl::forall<B,S,C,Threshold,P>(start, iters, loop_body, &F::operator());
+  }
+  
 #undef FORALL_OVERLOAD
     
   namespace impl {
@@ -398,7 +531,7 @@ namespace Grappa {
   namespace impl {
     template< TaskMode B, SyncMode S,
               GlobalCompletionEvent * GCE, int64_t Threshold,
-              typename T, typename F >
+              SplitMode P, typename T, typename F >
     void forall(GlobalAddress<T> base, int64_t nelems, F loop_body,
                                 void (F::*mf)(int64_t,int64_t,T*) const)
     {
@@ -407,7 +540,7 @@ namespace Grappa {
       
       on_cores_localized_async<GCE,Threshold>(base, nelems,
       [loop_body,base](T* local_base, size_t nlocal){
-        Grappa::forall_here<B,SyncMode::Async,GCE,Threshold>(0, nlocal, 
+        impl::forall_here<B,SyncMode::Async,GCE,Threshold,P>(0, nlocal, 
             [loop_body,local_base,base](int64_t s, int64_t n){
           loop_body( make_linear(local_base+s)-base, n, local_base+s );
         });
@@ -418,7 +551,7 @@ namespace Grappa {
   
     template< TaskMode B, SyncMode S,
               GlobalCompletionEvent * GCE, int64_t Threshold,
-              typename T, typename F >
+              SplitMode P, typename T, typename F >
     void forall(GlobalAddress<T> base, int64_t nelems, F loop_body,
                 void (F::*mf)(int64_t,T&) const)
     {
@@ -436,12 +569,12 @@ namespace Grappa {
           loop_body(index, first[i]);
         }
       };
-      impl::forall<B,S,GCE,Threshold>(base, nelems, f, &decltype(f)::operator());
+      impl::forall<B,S,GCE,Threshold,P>(base, nelems, f, &decltype(f)::operator());
     }
   
     template< TaskMode B, SyncMode S,
               GlobalCompletionEvent * GCE, int64_t Threshold,
-              typename T, typename F >
+              SplitMode P, typename T, typename F >
     void forall(GlobalAddress<T> base, int64_t nelems, F loop_body,
                 void (F::*mf)(T&) const)
     {
@@ -450,7 +583,7 @@ namespace Grappa {
           loop_body(first[i]);
         }
       };
-      impl::forall<B,S,GCE,Threshold>(base, nelems, f, &decltype(f)::operator());
+      impl::forall<B,S,GCE,Threshold,P>(base, nelems, f, &decltype(f)::operator());
     }
     
   
@@ -507,7 +640,7 @@ namespace Grappa {
             typename T = decltype(nullptr),
             typename F = decltype(nullptr) >
   void forall(GlobalAddress<T> base, int64_t nelems, F loop_body) {
-    impl::forall<B,S,GCE,Threshold>(base, nelems, loop_body, &F::operator());
+    impl::forall<B,S,GCE,Threshold,SplitMode::Eager>(base, nelems, loop_body, &F::operator());
   }
 
   /// Overload for specifying just SyncMode (or SyncMode first)
@@ -518,7 +651,7 @@ namespace Grappa {
             typename T = decltype(nullptr),
             typename F = decltype(nullptr) >
   void forall(GlobalAddress<T> base, int64_t nelems, F loop_body) {
-    impl::forall<B,S,GCE,Threshold>(base, nelems, loop_body, &F::operator());
+    impl::forall<B,S,GCE,Threshold,SplitMode::Eager>(base, nelems, loop_body, &F::operator());
   }
   
   /// Overload to allow using default GCE but specifying threshold
@@ -529,7 +662,7 @@ namespace Grappa {
             typename T = decltype(nullptr),
             typename F = decltype(nullptr) >
   void forall(GlobalAddress<T> base, int64_t nelems, F loop_body) {
-    impl::forall<B,S,GCE,Threshold>(base, nelems, loop_body, &F::operator());
+    impl::forall<B,S,GCE,Threshold,SplitMode::Eager>(base, nelems, loop_body, &F::operator());
   }
   
   /// Overload for specifying GCE only
@@ -540,7 +673,19 @@ namespace Grappa {
             typename T = decltype(nullptr),
             typename F = decltype(nullptr) >
   void forall(GlobalAddress<T> base, int64_t nelems, F loop_body) {
-    impl::forall<B,S,GCE,Threshold>(base, nelems, loop_body, &F::operator());
+    impl::forall<B,S,GCE,Threshold,SplitMode::Eager>(base, nelems, loop_body, &F::operator());
+  }
+  
+  /// Overload for lazy splitting (SplitMode first)
+  template< SplitMode P,
+            TaskMode B = TaskMode::Bound,
+            SyncMode S = SyncMode::Blocking,
+            GlobalCompletionEvent * GCE = &impl::local_gce,
+            int64_t Threshold = impl::USE_LOOP_THRESHOLD_FLAG,
+            typename T = decltype(nullptr),
+            typename F = decltype(nullptr) >
+  void forall(GlobalAddress<T> base, int64_t nelems, F loop_body) {
+    impl::forall<B,S,GCE,Threshold,P>(base, nelems, loop_body, &F::operator());
   }
   
   /// @}
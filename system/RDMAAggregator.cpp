@@ -36,10 +36,13 @@
 #include <sstream>
 #include <algorithm>
 #include <tuple>
+#include <memory>
 
 #include "RDMAAggregator.hpp"
 #include "Message.hpp"
 #include "Aggregator.hpp"
+#include "Topology.hpp"
+#include "DelegateBase.hpp"
 
 
 namespace Grappa {
@@ -70,6 +73,24 @@ DEFINE_string( route_graph_filename, "", "Name of file for routing graph output
 
 DEFINE_bool( rdma_flush_on_idle, true, "Flush RDMA buffers when idle" );
 
+DEFINE_bool( locale_message_rings, false, "Deliver messages within a locale through serialized per-core-pair rings instead of message lists" );
+DEFINE_int64( locale_message_ring_size, 1 << 16, "Size in bytes of each intra-locale message ring (must be a power of two)" );
+
+DEFINE_bool( aggregator_adaptive_flush, false, "Tune per-locale flush size and timeout from observed traffic" );
+DEFINE_int64( aggregator_adaptive_min_bytes, 1 << 8, "Smallest size threshold chosen by adaptive flushing" );
+DEFINE_int64( aggregator_adaptive_max_bytes, 1 << 16, "Largest size threshold chosen by adaptive flushing" );
+DEFINE_int64( aggregator_adaptive_min_ticks, 1000, "Shortest flush timeout chosen by adaptive flushing" );
+DEFINE_int64( aggregator_adaptive_max_ticks, 200000, "Longest flush timeout chosen by adaptive flushing" );
+
+DEFINE_string( aggregator_compression, "auto", "Encode aggregated buffers before sending: off, on, or auto (encode while sampled savings outweigh the CPU cost)" );
+DEFINE_int64( aggregator_compression_sample_interval, 64, "In auto mode, buffers to send between trial encodings while encoding is off" );
+DEFINE_double( aggregator_compression_link_bytes_per_tick, 0.5, "Estimated interconnect bytes per timestamp tick; auto mode encodes when each tick spent encoding and decoding saves more than this" );
+
+DEFINE_bool( aggregator_urgent_immediate, true, "Send urgent messages to other locales right away when a send context is free, instead of in the next buffer" );
+DEFINE_int64( aggregator_credit_bytes, 0, "Bytes of bulk messages each locale may have queued or in flight to another locale before senders block (0 disables flow control)" );
+
+DEFINE_int64( aggregator_route_dimensions, 1, "Route aggregated messages through a virtual 1D (direct), 2D, or 3D grid of locales; more dimensions mean fewer, fuller buffers but more forwarding hops" );
+
 /// stats for application messages
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_enqueue, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_enqueue_cas, 0 );
@@ -80,6 +101,10 @@ GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, app_bytes_serialized, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_deserialized, 0 );
 
 GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, app_nt_message_bytes, 0 );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_ring_enqueue, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_ring_full, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, app_messages_ring_delivered, 0 );
 GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, aggregated_nt_message_bytes, 0 );
 
 GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, app_messages_delivered_locally, 0 );
@@ -103,6 +128,32 @@ GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_capacity_flushes, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_idle_flushes, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_core_idle_flushes, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_requested_flushes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_adaptive_size_flushes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_adaptive_timeout_flushes, 0 );
+GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, rdma_adaptive_flush_threshold, 0 );
+GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, rdma_adaptive_flush_timeout, 0 );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_urgent_immediate, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_urgent_enqueued, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_urgent_buffers, 0 );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_credit_stalls, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_credit_stall_ticks, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_credit_overdrafts, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_credit_returned_bytes, 0 );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_buffers, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_bytes_in, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_bytes_out, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_bytes_saved, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_encode_ticks, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_decode_ticks, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_slices_decoded, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_compression_enabled, 0 );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_forward_bytes_sent, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_forward_bytes_relayed, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_forward_runs_relayed, 0 );
 
 GRAPPA_DEFINE_METRIC( SummarizingMetric<int64_t>, rdma_buffers_inuse, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rdma_buffers_blocked, 0 );
@@ -195,6 +246,137 @@ namespace Grappa {
       }
     }
   
+  /// Header for a run of messages that the receiving locale sends on
+  /// toward their destination core. It goes in the slice for the
+  /// receiving locale's last core, which runs deserialize_forward().
+  struct ForwardHeader {
+    Grappa::impl::MessageFPAddr gfp;
+    uint32_t size;  ///< bytes of serialized messages following the header
+    Core dest;      ///< core the messages are headed for
+    int16_t urgent; ///< forward ahead of bulk traffic?
+  };
+  static_assert( sizeof(ForwardHeader) == 16, "forward header should keep messages aligned" );
+
+  /// Already-serialized messages being forwarded through this locale.
+  /// They go out as one opaque run, so the next locale sees exactly
+  /// what the original sender wrote.
+  class ForwardMessage : public Grappa::impl::MessageBase {
+  private:
+    char * data_;
+    size_t size_;
+
+  public:
+    ForwardMessage( Core dest, char * data, size_t size )
+      : MessageBase( dest )
+      , data_( Grappa::locale_alloc<char>( size ) )
+      , size_( size )
+    {
+      memcpy( data_, data, size );
+    }
+
+    virtual ~ForwardMessage() {
+      Grappa::locale_free( data_ );
+    }
+
+    virtual const char * typestr() {
+      return "ForwardMessage";
+    }
+
+    virtual const size_t serialized_size() const { return size_; }
+
+    virtual const size_t size() const { return sizeof(*this); }
+
+    virtual void deliver_locally() {
+      if( !is_delivered_ ) {
+        global_rdma_aggregator.deaggregate_buffer( data_, size_ );
+        is_delivered_ = true;
+      }
+      this->mark_sent();
+    }
+
+    virtual char * serialize_to( char * p, size_t max_size ) {
+      Grappa::impl::MessageBase::serialize_to( p, max_size );
+      if( size_ > max_size ) {
+        return p;
+      } else {
+        memcpy( p, data_, size_ );
+        return p + size_;
+      }
+    }
+  } __attribute__((aligned(64)));
+
+  char * RDMAAggregator::deserialize_forward( char * t ) {
+    ForwardHeader * h = reinterpret_cast< ForwardHeader * >( t - sizeof( Grappa::impl::MessageFPAddr ) );
+    char * data = reinterpret_cast< char * >( h + 1 );
+    DVLOG(5) << __func__ << ": Forwarding " << h->size << " bytes to core " << h->dest;
+
+    auto m = new (Grappa::SharedMessagePool::alloc(sizeof(ForwardMessage))) ForwardMessage( h->dest, data, h->size );
+    m->delete_after_send();
+    if( h->urgent ) m->mark_urgent();
+    m->enqueue();
+
+    rdma_forward_bytes_relayed += h->size;
+    rdma_forward_runs_relayed++;
+    return data + h->size;
+  }
+
+  /// Dimension-ordered routing on a virtual grid of locales. Each
+  /// locale gets coordinates in a grid with side ceil(locales^(1/D));
+  /// a hop fixes the lowest coordinate that differs from the
+  /// destination's. Since the last row or plane of the grid may be
+  /// partial, a hop that lands off the end goes to the next
+  /// coordinate instead, and if none exists we go direct.
+  Locale RDMAAggregator::next_hop( Locale from, Locale to ) const {
+    const int dims = FLAGS_aggregator_route_dimensions;
+    const Locale locales = Grappa::locales();
+    if( dims <= 1 || from == to ) return to;
+
+    int side = 1;
+    for( int cells = 1; cells < locales; ) {
+      side++;
+      cells = 1;
+      for( int d = 0; d < dims; ++d ) cells *= side;
+    }
+
+    int stride = 1;
+    for( int d = 0; d < dims; ++d ) {
+      int from_coord = ( from / stride ) % side;
+      int to_coord = ( to / stride ) % side;
+      if( from_coord != to_coord ) {
+        int hop = from + ( to_coord - from_coord ) * stride;
+        if( hop < locales ) return hop;
+      }
+      stride *= side;
+    }
+    return to;
+  }
+
+  int RDMAAggregator::route_hops( Locale from, Locale to ) const {
+    int hops = 0;
+    while( from != to ) {
+      from = next_hop( from, to );
+      hops++;
+    }
+    return hops;
+  }
+
+  /// Each process computes the first hop from its own locale, since
+  /// forwarded messages are re-enqueued on intermediate locales.
+  void RDMAAggregator::compute_next_hops() {
+    CHECK( FLAGS_aggregator_route_dimensions >= 1 && FLAGS_aggregator_route_dimensions <= 3 )
+      << "--aggregator_route_dimensions must be 1, 2, or 3";
+
+    next_hop_for_locale_ = new Locale[ Grappa::locales() ];
+    routed_through_locale_.assign( Grappa::locales(), std::vector< Locale >() );
+    for( Locale i = 0; i < Grappa::locales(); ++i ) {
+      Locale hop = next_hop( Grappa::mylocale(), i );
+      next_hop_for_locale_[i] = hop;
+      if( hop != i ) routed_through_locale_[ hop ].push_back( i );
+      DVLOG(2) << "From locale " << Grappa::mylocale() << " to locale " << i
+               << " next hop " << hop << " in " << route_hops( Grappa::mylocale(), i ) << " hops";
+    }
+  }
+
   /// allocate and initialize locale-to-core translation
   void RDMAAggregator::compute_route_map() {
 
@@ -210,10 +392,17 @@ namespace Grappa {
 
     // initialize source cores
     //source_core_for_locale_ = new Core[ Grappa::locales() ];
+    Locale next_hop_count = 0;
     for( int i = 0; i < Grappa::locales(); ++i ) {
       if( i == Grappa::mylocale() ) {
         // locally, cores are responsible for their own messages
         source_core_for_locale_[i] = -1;
+      } else if( FLAGS_aggregator_route_dimensions > 1 ) {
+        // only next hops get a send stream of their own, so spread
+        // those across our cores; routed locales are filled in below
+        if( next_hop_for_locale_[i] == i ) {
+          source_core_for_locale_[i] = Grappa::mylocale() * Grappa::locale_cores() + ( next_hop_count++ % Grappa::locale_cores() );
+        }
       } else {
         // guess at correct source core on the node
         Core offset = i / locales_per_core;
@@ -231,6 +420,14 @@ namespace Grappa {
     for( int i = 0; i < Grappa::locales(); ++i ) {
       if( i == Grappa::mylocale() ) {
         dest_core_for_locale_[i] = -1;
+      } else if( FLAGS_aggregator_route_dimensions > 1 ) {
+        // count our place among locale i's next hops, the way it
+        // counted when assigning its source cores above
+        Locale count = 0;
+        for( Locale j = 0; j < Grappa::mylocale(); ++j ) {
+          if( j != i && next_hop( i, j ) == j ) count++;
+        }
+        dest_core_for_locale_[i] = i * Grappa::locale_cores() + ( count % Grappa::locale_cores() );
       } else {
         // guess at correct destination core on the node
         Core offset = Grappa::mylocale() / locales_per_core;
@@ -244,6 +441,15 @@ namespace Grappa {
       }
     }
 
+    // locales reached through another locale share its send stream
+    for( int i = 0; i < Grappa::locales(); ++i ) {
+      Locale hop = next_hop_for_locale_[i];
+      if( hop != i ) {
+        source_core_for_locale_[i] = source_core_for_locale_[hop];
+        dest_core_for_locale_[i] = dest_core_for_locale_[hop];
+      }
+    }
+
     for( int i = 0; i < Grappa::locales(); ++i ) {
       DVLOG(2) << "From locale " << Grappa::mylocale() << " to locale " << i 
                 << " source core " << source_core_for_locale_[i]
@@ -323,6 +529,8 @@ namespace Grappa {
     
     void RDMAAggregator::activate() {
 #ifdef ENABLE_RDMA_AGGREGATOR
+      compute_next_hops();
+
       // one core on each locale initializes shared data
       if( global_communicator.locale_mycore == 0 ) {
         try {
@@ -334,6 +542,16 @@ namespace Grappa {
           // allocate routing info
           source_core_for_locale_ = Grappa::impl::locale_shared_memory.segment.construct<Core>("SourceCores")[global_communicator.locales]();
           dest_core_for_locale_ = Grappa::impl::locale_shared_memory.segment.construct<Core>("DestCores")[global_communicator.locales]();
+
+          // allocate intra-locale message rings
+          if( FLAGS_locale_message_rings ) {
+            const int num_rings = global_communicator.locale_cores * global_communicator.locale_cores;
+            rings_ = Grappa::impl::locale_shared_memory.segment.construct<MessageRing>("MessageRings")[num_rings]();
+            for( int i = 0; i < num_rings; ++i ) {
+              char * data = static_cast< char * >( Grappa::impl::locale_shared_memory.allocate_aligned( FLAGS_locale_message_ring_size, 64 ) );
+              rings_[i].init( data, FLAGS_locale_message_ring_size );
+            }
+          }
         }
         catch(...){
           failure_function();
@@ -362,6 +580,14 @@ namespace Grappa {
           q = Grappa::impl::locale_shared_memory.segment.find<Core>("DestCores");
           CHECK_EQ( q.second, global_communicator.locales );
           dest_core_for_locale_ = q.first;
+
+          // attach to intra-locale message rings
+          if( FLAGS_locale_message_rings ) {
+            std::pair< MessageRing *, boost::interprocess::managed_shared_memory::size_type > r;
+            r = Grappa::impl::locale_shared_memory.segment.find<MessageRing>("MessageRings");
+            CHECK_EQ( r.second, global_communicator.locale_cores * global_communicator.locale_cores );
+            rings_ = r.first;
+          }
         }
         catch(...){
           failure_function();
@@ -384,7 +610,7 @@ namespace Grappa {
       // generate list of locales this core is responsible for
       core_partner_locales_ = new Locale[ locales_per_core ];
       for( int i = 0; i < Grappa::locales(); ++i ) {
-        if( source_core_for_locale_[i] == Grappa::mycore() ) {
+        if( source_core_for_locale_[i] == Grappa::mycore() && next_hop_for_locale_[i] == i ) {
           CHECK_LT( core_partner_locale_count_, locales_per_core ) << "this core is responsible for more locales than expected";
           core_partner_locales_[ core_partner_locale_count_++ ] = i;
           DVLOG(2) << "Core " << Grappa::mycore() << " responsible for locale " << i;
@@ -392,6 +618,21 @@ namespace Grappa {
       }
       DVLOG(2) << "Partner locale count is " << core_partner_locale_count_ << ", locales per core is " << locales_per_core;
 
+      // choose how aggregated buffers are encoded
+      if( FLAGS_aggregator_compression == "on" ) {
+        compression_mode_ = CompressionMode::On;
+      } else if( FLAGS_aggregator_compression == "auto" ) {
+        compression_mode_ = CompressionMode::Auto;
+      } else {
+        CHECK_EQ( FLAGS_aggregator_compression, "off" ) << "Unknown aggregator compression mode";
+        compression_mode_ = CompressionMode::Off;
+      }
+      compression_enabled_ = ( compression_mode_ == CompressionMode::On );
+      rdma_compression_enabled = compression_enabled_;
+      if( compression_mode_ != CompressionMode::Off ) {
+        encode_scratch_ = new char[ BUFFER_SIZE ];
+      }
+
       // fill pool of buffers
       if( core_partner_locale_count_ > 0 ) {
         const int num_buffers = core_partner_locale_count_ * FLAGS_rdma_buffers_per_core;
@@ -462,16 +703,33 @@ namespace Grappa {
     void RDMAAggregator::finish() {
 #ifdef ENABLE_RDMA_AGGREGATOR
       global_communicator.barrier();
+
+      // redraw route map with the traffic each route carried
+      draw_routing_graph();
+
       if( global_communicator.locale_mycore == 0 ) {
         Grappa::impl::locale_shared_memory.segment.destroy<CoreData>("Cores");
         Grappa::impl::locale_shared_memory.segment.destroy<Core>("SourceCores");
         Grappa::impl::locale_shared_memory.segment.destroy<Core>("DestCores");
+        if( rings_ ) {
+          for( int i = 0; i < global_communicator.locale_cores * global_communicator.locale_cores; ++i ) {
+            Grappa::impl::locale_shared_memory.deallocate( rings_[i].data() );
+          }
+          Grappa::impl::locale_shared_memory.segment.destroy<MessageRing>("MessageRings");
+        }
       }
       cores_ = NULL;
+      rings_ = NULL;
       source_core_for_locale_ = NULL;
       dest_core_for_locale_ = NULL;
 
       if( core_partner_locales_ ) delete [] core_partner_locales_;
+      if( next_hop_for_locale_ ) delete [] next_hop_for_locale_;
+      next_hop_for_locale_ = NULL;
+      if( encode_scratch_ ) delete [] encode_scratch_;
+      if( decode_scratch_ ) delete [] decode_scratch_;
+      encode_scratch_ = NULL;
+      decode_scratch_ = NULL;
       Grappa::impl::locale_shared_memory.deallocate( rdma_buffers_ );
 #endif
     }
@@ -544,10 +802,18 @@ void RDMAAggregator::draw_routing_graph() {
 
         //for( int c = n * Grappa::locale_cores(); c < (n+1) * Grappa::locale_cores(); ++c ) {
         for( int d = 0; d < Grappa::locales(); ++d ) {
-          if( d != Grappa::mylocale() ) {
+          if( d != Grappa::mylocale() && next_hop_for_locale_[d] == d ) {
+            CoreData * locale_core = localeCoreData( d * Grappa::locale_cores() );
             o << "    n" << n << ":c" << source_core_for_locale_[d] << ":e"
               << " -> n" << d << ":c" << dest_core_for_locale_[d] << ":w"
-              << " [headlabel=\"c" << source_core_for_locale_[d] << "\"]"
+              << " [headlabel=\"c" << source_core_for_locale_[d] << "\""
+              << " label=\"" << locale_core->route_bytes_ << "B/" << locale_core->route_forwarded_bytes_ << "B fwd\"]"
+              << ";\n";
+          } else if( d != Grappa::mylocale() ) {
+            // locales reached by forwarding: hop count and first hop
+            o << "    n" << n << " -> n" << d
+              << " [style=dashed constraint=false"
+              << " label=\"" << route_hops( n, d ) << " hops via n" << next_hop_for_locale_[d] << "\"]"
               << ";\n";
           }
         }
@@ -570,7 +836,8 @@ void RDMAAggregator::draw_routing_graph() {
 
 
 
-    char * RDMAAggregator::aggregate_to_buffer( char * buffer, Grappa::impl::MessageBase ** message_ptr, size_t max, uint64_t * count_p ) {
+    char * RDMAAggregator::aggregate_to_buffer( char * buffer, Grappa::impl::MessageBase ** message_ptr, size_t max, uint64_t * count_p,
+                                                std::vector< char * > * message_ends ) {
       size_t size = 0;
       size_t count = 0;
 
@@ -609,6 +876,9 @@ void RDMAAggregator::draw_routing_graph() {
           app_bytes_sent_histogram = new_buffer - buffer;
 #endif
 
+          // remember message boundaries for encoding
+          if( message_ends ) message_ends->push_back( new_buffer );
+
           // go to next messsage 
           Grappa::impl::MessageBase * next = message->next_;
 
@@ -748,6 +1018,18 @@ void RDMAAggregator::draw_routing_graph() {
       } else {
         // process buffer through normal path
         receive_buffer( buf );
+
+        // messages are all delivered, so the sender may queue more
+        int64_t credit = buf->get_credit();
+        if( credit > 0 && Grappa::locale_of( c ) != Grappa::mylocale() ) {
+          Locale from = Grappa::mylocale();
+          rdma_credit_returned_bytes += credit;
+          auto release = Grappa::message( c, [from, credit] {
+              global_rdma_aggregator.release_credit( from, credit );
+            });
+          release.mark_urgent();
+          release.enqueue();
+        }
       }
 
       // // once we're done, send ack to give permission to send again,
@@ -831,7 +1113,7 @@ void RDMAAggregator::draw_routing_graph() {
           DVLOG(5) << __PRETTY_FUNCTION__ // << "/" << sequence_number
                    << ": received " << size << "-byte buffer slice at " << (void*) buf << " to deaggregate";
 
-          global_rdma_aggregator.deaggregate_buffer( buf, size );
+          global_rdma_aggregator.deaggregate_slice( buf, size );
 
           DVLOG(5) << __PRETTY_FUNCTION__ // << "/" << sequence_number 
                    << ": done deaggregating " << size << "-byte buffer slice at " << (void*) buf;
@@ -869,7 +1151,7 @@ void RDMAAggregator::draw_routing_graph() {
             my_buf = current_buf;
           }
 
-          current_buf += counts[locale_core];
+          current_buf += counts[locale_core] & ~encoded_slice_bit;
         }
       }
 
@@ -879,7 +1161,7 @@ void RDMAAggregator::draw_routing_graph() {
                  << ": deaggregating my own " << counts[ Grappa::locale_mycore() ] << "-byte buffer slice at " << (void*) buf;
 
         Grappa::impl::global_scheduler.set_no_switch_region( true );
-        deaggregate_buffer( my_buf, counts[ Grappa::locale_mycore() ] );
+        deaggregate_slice( my_buf, counts[ Grappa::locale_mycore() ] );
         Grappa::impl::global_scheduler.set_no_switch_region( false );
 
         DVLOG(5) << __func__ << "/" << sequence_number 
@@ -1032,13 +1314,20 @@ void RDMAAggregator::draw_routing_graph() {
     Core current_source_core_;
     
     bool done;
+
+    // walk urgent lists instead of bulk lists?
+    bool urgent_;
+
+    inline Grappa::impl::MessageList& list( CoreData * cd ) const {
+      return urgent_ ? cd->urgent_messages_ : cd->messages_;
+    }
     
   public:
     MessageListChooser() = delete;
     MessageListChooser( const MessageListChooser& ) = delete;
     MessageListChooser( MessageListChooser&& ) = delete;
 
-    MessageListChooser( Core dest_start, Core dest_end, Core source_start, Core source_end ) 
+    MessageListChooser( Core dest_start, Core dest_end, Core source_start, Core source_end, bool urgent = false ) 
       : dest_cores_start_( dest_start )
       , dest_cores_end_( dest_end )
       , source_cores_start_( source_start )
@@ -1046,6 +1335,7 @@ void RDMAAggregator::draw_routing_graph() {
       , current_dest_core_( dest_cores_start_ )
       , current_source_core_( source_cores_start_ )
       , done( false )
+      , urgent_( urgent )
     { 
       DVLOG(4) << __func__ << "Initialized with dest range " << dest_cores_start_ << "/" << dest_cores_end_
                << " source range " << source_cores_start_ << "/" << source_cores_end_;
@@ -1089,13 +1379,50 @@ void RDMAAggregator::draw_routing_graph() {
             __builtin_prefetch( pf + 64, 1, prefetch_type );
 #endif
           }
-        } while( 0 == cd->messages_.raw_ && !done );
+        } while( 0 == list( cd ).raw_ && !done );
       }
       
       return cd;
     }
   };
 
+  /// Choose message lists of one priority class for a locale, then
+  /// for each locale routed through it.
+  class LocaleListChooser {
+  private:
+    MessageListChooser direct_;
+    const std::vector< Locale >& routed_locales_;
+    size_t routed_index_;
+    std::unique_ptr< MessageListChooser > routed_;
+    bool urgent_;
+
+  public:
+    LocaleListChooser( Locale locale, const std::vector< Locale >& routed_locales, bool urgent )
+      : direct_( locale * Grappa::locale_cores(), (locale+1) * Grappa::locale_cores(), 0, Grappa::locale_cores(), urgent )
+      , routed_locales_( routed_locales )
+      , routed_index_( 0 )
+      , routed_()
+      , urgent_( urgent )
+    { }
+
+    CoreData * get_next_list( Core * c ) {
+      CoreData * cd = direct_.get_next_list( c );
+      while( cd == NULL && routed_index_ < routed_locales_.size() ) {
+        if( !routed_ ) {
+          Core first_core = routed_locales_[ routed_index_ ] * Grappa::locale_cores();
+          routed_.reset( new MessageListChooser( first_core, first_core + Grappa::locale_cores(),
+                                                 0, Grappa::locale_cores(), urgent_ ) );
+        }
+        cd = routed_->get_next_list( c );
+        if( cd == NULL ) {
+          routed_.reset();
+          routed_index_++;
+        }
+      }
+      return cd;
+    }
+  };
+
 
   void RDMAAggregator::send_locale( Locale locale ) {
     rdma_send_start++;
@@ -1105,17 +1432,36 @@ void RDMAAggregator::draw_routing_graph() {
 
     int buffers_used_for_send = 0;
     int64_t bytes_sent = 0;
+    int64_t forwarded_bytes = 0;
 
     // this is the core we are sending to
     Core dest_core = dest_core_for_locale_[ locale ];
 
+    // racily reset byte count for adaptive flushing; messages enqueued
+    // from here on will be counted toward the next send.
+    CoreData * locale_core = localeCoreData( locale * Grappa::locale_cores() );
+    if( FLAGS_aggregator_adaptive_flush ) {
+      if( locale_core->locale_byte_count_ >= locale_core->flush_threshold_ ) {
+        rdma_adaptive_size_flushes++;
+      } else {
+        rdma_adaptive_timeout_flushes++;
+      }
+      locale_core->locale_byte_count_ = 0;
+    }
+
     bool all_message_lists_sent = false;
 
     Core first_core = locale * Grappa::locale_cores();
     Core max_core = first_core + Grappa::locale_cores();
     Core current_dest_core = -1;
 
-    MessageListChooser mlc( first_core, max_core, 0, Grappa::locale_cores() );
+    // urgent lists go first, in a buffer of their own, then bulk
+    // lists. after each locale's own lists come lists for locales we
+    // reach through it, written as forward records in the slice for
+    // the destination locale's last core.
+    LocaleListChooser urgent_mlc( locale, routed_through_locale_[ locale ], true );
+    LocaleListChooser mlc( locale, routed_through_locale_[ locale ], false );
+    bool urgent = true;
     DVLOG(3) << __PRETTY_FUNCTION__ << "/" << Grappa::impl::global_scheduler.get_current_thread() 
              << " MessageListChooser constructed at " << &mlc;
 
@@ -1123,6 +1469,9 @@ void RDMAAggregator::draw_routing_graph() {
     // list of messages we're working on
     Grappa::impl::MessageBase * messages_to_send = NULL;
 
+    // message boundaries in the current buffer, for encoding
+    std::vector< char * > message_ends;
+
     // send all available message lists for this locale, maybe in multiple 
     while( (!all_message_lists_sent) || (messages_to_send != NULL) ) {
 
@@ -1159,8 +1508,15 @@ void RDMAAggregator::draw_routing_graph() {
       size_t aggregated_size = 0;
       bool ready_to_send = false;
 
+      // bulk message bytes the receiver will return as credit
+      size_t credit_bytes = 0;
+
       int64_t count = 0;
 
+      // record message boundaries if we're going to encode this buffer
+      bool encode = should_encode();
+      message_ends.clear();
+
       DVLOG(4) << __func__ << "/" << sequence_number << ": " << "Preparing an active message in buffer " << b << " for locale " << locale;
 
       // fill the buffer
@@ -1176,10 +1532,29 @@ void RDMAAggregator::draw_routing_graph() {
 
 
           // get the next core struct with something to send
-          CoreData * core_data = mlc.get_next_list( &current_dest_core );
+          CoreData * core_data = NULL;
+          if( urgent ) {
+            core_data = urgent_mlc.get_next_list( &current_dest_core );
+            if( core_data == NULL ) {
+              urgent = false;
+              // bulk messages start over at the first core, so they
+              // need a new buffer to keep slices in core order
+              if( aggregated_size > 0 ) {
+                rdma_urgent_buffers++;
+                ready_to_send = true;
+                break;
+              }
+            }
+          }
+          if( !urgent ) {
+            core_data = mlc.get_next_list( &current_dest_core );
+          }
 
           // if we got something,
-          if( core_data != NULL ) {
+          if( core_data != NULL && urgent ) {
+            Grappa::impl::MessageList ml = grab_urgent_messages( core_data );
+            messages_to_send = get_pointer( &ml );
+          } else if( core_data != NULL ) {
             // prefetch and grab head of message list
             Grappa::impl::MessageList ml = grab_messages( core_data );
             issue_initial_prefetches( core_data );
@@ -1204,8 +1579,34 @@ void RDMAAggregator::draw_routing_graph() {
           Grappa::impl::MessageBase * prev_messages_to_send = messages_to_send;
           CHECK_EQ( messages_to_send->destination_, current_dest_core ) << "hmm. this doesn't seem right";
           static_assert(sizeof(size_t) == sizeof(uint64_t), "must be 64-bit");
-          char * end = aggregate_to_buffer( current_buf, &messages_to_send, remaining_size, &aggregate_counts_[current_dest_core] );
-          size_t current_aggregated_size = end - current_buf;
+
+          // leave room for a forward record header if these messages
+          // are going on to another locale
+          bool forwarding = current_dest_core < first_core || current_dest_core >= max_core;
+          int64_t header_size = forwarding ? sizeof(ForwardHeader) : 0;
+          if( remaining_size <= header_size ) {
+            ready_to_send = true;
+            break;
+          }
+
+          char * end = aggregate_to_buffer( current_buf + header_size, &messages_to_send, remaining_size - header_size,
+                                            &aggregate_counts_[current_dest_core],
+                                            encode ? &message_ends : NULL );
+          size_t current_aggregated_size = end - current_buf - header_size;
+          if( !urgent && FLAGS_aggregator_credit_bytes > 0 ) credit_bytes += current_aggregated_size;
+
+          // fill in the header if anything fit; otherwise drop it
+          if( forwarding && current_aggregated_size > 0 ) {
+            ForwardHeader * header = reinterpret_cast< ForwardHeader * >( current_buf );
+            header->gfp.raw = 0;
+            header->gfp.dest = max_core - 1;
+            header->gfp.fp = reinterpret_cast< intptr_t >( &deserialize_forward );
+            header->size = current_aggregated_size;
+            header->dest = current_dest_core;
+            header->urgent = urgent;
+            current_aggregated_size += header_size;
+            forwarded_bytes += current_aggregated_size;
+          }
           CHECK_LE( aggregated_size + current_aggregated_size, max_size );
           CHECK_GE( remaining_size, 0 );
 
@@ -1215,7 +1616,7 @@ void RDMAAggregator::draw_routing_graph() {
                    << " end-start=" << end - current_buf;
 
           // record how much this core has
-          int index = current_dest_core - first_core;
+          int index = forwarding ? Grappa::locale_cores() - 1 : current_dest_core - first_core;
           DVLOG(4) << __func__ << "/" << sequence_number 
                    << ": Recording " << current_aggregated_size << " bytes"
                    << " for core " << current_dest_core
@@ -1264,11 +1665,16 @@ void RDMAAggregator::draw_routing_graph() {
                << " to locale " << locale
                << " core " << dest_core;
 
+      if( encode && aggregated_size > 0 ) {
+        aggregated_size = encode_buffer( b, aggregated_size, message_ends );
+      }
+
       // for debugging
       b->set_next( reinterpret_cast<RDMABuffer*>( aggregated_size ) );
 
       b->set_source( Grappa::mycore() );
-      b->set_ack( b );
+      // with flow control off, no credit goes back
+      b->set_credit( FLAGS_aggregator_credit_bytes > 0 ? credit_bytes : 0 );
       
       if( aggregated_size > 0 ) {
         // we have a buffer. send.
@@ -1311,12 +1717,209 @@ void RDMAAggregator::draw_routing_graph() {
 
     rdma_bytes_sent_histogram = bytes_sent;
 
+    locale_core->route_bytes_ += bytes_sent;
+    locale_core->route_forwarded_bytes_ += forwarded_bytes;
+    rdma_forward_bytes_sent += forwarded_bytes;
+
+    if( FLAGS_aggregator_adaptive_flush ) {
+      adapt_flush_policy( locale_core, bytes_sent );
+    }
+
     active_send_workers_--;
     rdma_send_end++;
     --workers_active_send;
   }
 
 
+  // Track the round-trip latency of blocking delegates on this core,
+  // from what they've recorded in delegate_roundtrip_latency since we
+  // last looked.
+  void RDMAAggregator::update_reply_latency( Grappa::Timestamp now ) {
+    size_t roundtrips = delegate_roundtrip_latency.samples();
+    double roundtrip_ticks = delegate_roundtrip_latency.value();
+    // (a metrics reset just starts a new window)
+    if( roundtrips > last_roundtrips_ && roundtrip_ticks >= last_roundtrip_ticks_ ) {
+      const double alpha = 0.125;
+      double latency = ( roundtrip_ticks - last_roundtrip_ticks_ ) / ( roundtrips - last_roundtrips_ );
+      if( reply_latency_ == 0.0 ) {
+        reply_latency_ = latency;
+      } else {
+        reply_latency_ = (1.0 - alpha) * reply_latency_ + alpha * latency;
+      }
+      last_reply_seen_ = now;
+    }
+    last_roundtrips_ = roundtrips;
+    last_roundtrip_ticks_ = roundtrip_ticks;
+  }
+
+  // Retune flush parameters for a locale based on what we just sent.
+  //
+  // The size threshold grows while sends keep filling it and shrinks
+  // toward the observed fill when the timeout fires first. The timeout
+  // is set to roughly the time needed to reach the threshold at the
+  // smoothed injection rate, so busy destinations flush on size and
+  // quiet ones flush quickly instead of waiting for bytes that won't
+  // come. While tasks here are blocking on delegates, the timeout is
+  // also held to a quarter of their measured round trip; since that
+  // includes our own hold time, it settles near the network latency
+  // rather than shrinking to nothing.
+  void RDMAAggregator::adapt_flush_policy( CoreData * locale_core, int64_t bytes_sent ) {
+    Grappa::Timestamp now = Grappa::timestamp();
+    update_reply_latency( now );
+    Grappa::Timestamp interval = now - locale_core->last_sent_;
+
+    // skip first send and requested flushes, which zero last_sent_
+    if( locale_core->last_sent_ == 0 || interval <= 0 ) return;
+
+    // smoothed injection rate in bytes per tick
+    const double alpha = 0.125;
+    double rate = static_cast<double>( bytes_sent ) / interval;
+    if( locale_core->byte_rate_ == 0.0 ) {
+      locale_core->byte_rate_ = rate;
+    } else {
+      locale_core->byte_rate_ = (1.0 - alpha) * locale_core->byte_rate_ + alpha * rate;
+    }
+
+    int64_t threshold = locale_core->flush_threshold_;
+    if( bytes_sent >= threshold ) {
+      threshold += threshold / 4;
+    } else {
+      threshold -= (threshold - bytes_sent) / 4;
+    }
+    threshold = std::max( threshold, FLAGS_aggregator_adaptive_min_bytes );
+    threshold = std::min( threshold, FLAGS_aggregator_adaptive_max_bytes );
+
+    int64_t timeout = FLAGS_aggregator_adaptive_max_ticks;
+    if( locale_core->byte_rate_ > 0.0 ) {
+      double fill_ticks = threshold / locale_core->byte_rate_;
+      if( fill_ticks < timeout ) timeout = static_cast<int64_t>( fill_ticks );
+    }
+    if( reply_latency_ > 0.0 && now - last_reply_seen_ < FLAGS_aggregator_adaptive_max_ticks ) {
+      double reply_ticks = reply_latency_ / 4;
+      if( reply_ticks < timeout ) timeout = static_cast<int64_t>( reply_ticks );
+    }
+    timeout = std::max( timeout, FLAGS_aggregator_adaptive_min_ticks );
+
+    locale_core->flush_threshold_ = threshold;
+    locale_core->flush_timeout_ = timeout;
+
+    rdma_adaptive_flush_threshold += threshold;
+    rdma_adaptive_flush_timeout += timeout;
+
+    DVLOG(4) << __func__ << ": locale core data " << locale_core
+             << " sent " << bytes_sent << " bytes in " << interval << " ticks;"
+             << " threshold " << threshold << " timeout " << timeout;
+  }
+
+
+  // Should the buffer we are about to fill be encoded? In auto mode,
+  // encoding stays on while it pays for itself and is retried every
+  // so often while it's off, in case the traffic has changed.
+  bool RDMAAggregator::should_encode() {
+    switch( compression_mode_ ) {
+    case CompressionMode::On:
+      return true;
+    case CompressionMode::Auto:
+      if( compression_enabled_ ) return true;
+      if( --compression_countdown_ <= 0 ) {
+        compression_countdown_ = FLAGS_aggregator_compression_sample_interval;
+        return true;
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  // Encode each core's slice of a filled buffer in place. Slices that
+  // don't shrink are left alone; encoded slices are marked in the
+  // count array so the receiver knows to decode them.
+  size_t RDMAAggregator::encode_buffer( RDMABuffer * b, size_t aggregated_size, const std::vector< char * >& message_ends ) {
+    Grappa::Timestamp start = Grappa::force_tick();
+
+    uint32_t * counts = b->get_counts();
+    char * read = b->get_payload();
+    char * write = read;
+    size_t first = 0;
+
+    for( Core locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
+      uint32_t count = counts[ locale_core ];
+      if( count == 0 ) continue;
+      DCHECK_EQ( count & encoded_slice_bit, 0 );
+
+      // find the messages in this slice
+      char * slice_end = read + count;
+      size_t last = first;
+      while( last < message_ends.size() && message_ends[ last ] <= slice_end ) last++;
+      DCHECK_GT( last, first ) << "No message boundaries recorded for slice";
+
+      // encodings at least as large as the original are refused
+      size_t encoded = encoder_.encode( read, &message_ends[ first ], last - first, encode_scratch_, count - 1 );
+      if( encoded > 0 ) {
+        memcpy( write, encode_scratch_, encoded );
+        counts[ locale_core ] = encoded | encoded_slice_bit;
+        write += encoded;
+      } else {
+        memmove( write, read, count );
+        write += count;
+      }
+
+      read = slice_end;
+      first = last;
+    }
+
+    size_t encoded_size = write - b->get_payload();
+    Grappa::Timestamp ticks = Grappa::force_tick() - start;
+
+    rdma_compression_buffers++;
+    rdma_compression_bytes_in += aggregated_size;
+    rdma_compression_bytes_out += encoded_size;
+    rdma_compression_bytes_saved += aggregated_size - encoded_size;
+    rdma_compression_encode_ticks += ticks;
+
+    if( compression_mode_ == CompressionMode::Auto ) {
+      // decoding costs about as much as encoding, so charge for both
+      double rate = static_cast< double >( aggregated_size - encoded_size ) / ( 2.0 * std::max< Grappa::Timestamp >( ticks, 1 ) );
+      compression_savings_rate_ = 0.5 * compression_savings_rate_ + 0.5 * rate;
+      compression_enabled_ = compression_savings_rate_ > FLAGS_aggregator_compression_link_bytes_per_tick;
+      rdma_compression_enabled = compression_enabled_;
+    }
+
+    return encoded_size;
+  }
+
+  // Deserialize and call one core's slice of a received buffer,
+  // decoding it first if the sender encoded it.
+  void RDMAAggregator::deaggregate_slice( char * buffer, uint32_t count ) {
+    Grappa::impl::topology.record_received_bytes( count & ~encoded_slice_bit );
+
+    if( 0 == ( count & encoded_slice_bit ) ) {
+      deaggregate_buffer( buffer, count );
+      return;
+    }
+
+    Grappa::Timestamp start = Grappa::force_tick();
+
+    // a handler may deliver another slice while we're still using
+    // the scratch buffer, so fall back to a temporary one then
+    if( !decode_scratch_ ) decode_scratch_ = new char[ BUFFER_SIZE ];
+    bool nested = decode_scratch_busy_;
+    char * decoded = nested ? new char[ BUFFER_SIZE ] : decode_scratch_;
+    decode_scratch_busy_ = true;
+
+    size_t size = decoder_.decode( buffer, count & ~encoded_slice_bit, decoded, BUFFER_SIZE );
+    rdma_compression_decode_ticks += Grappa::force_tick() - start;
+    rdma_compression_slices_decoded++;
+
+    deaggregate_buffer( decoded, size );
+
+    if( nested ) {
+      delete [] decoded;
+    } else {
+      decode_scratch_busy_ = false;
+    }
+  }
+
   void RDMAAggregator::send_nt_buffer( Core dest, NTBuffer * buf ) {
     nt_mru_.reset(dest);
     auto buftuple = buf->take_buffer();
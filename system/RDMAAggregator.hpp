@@ -41,6 +41,8 @@
 
 #include <boost/dynamic_bitset.hpp>
 
+#include <vector>
+
 #include "Communicator.hpp"
 #include "Worker.hpp"
 #include "tasks/TaskingScheduler.hpp"
@@ -64,6 +66,9 @@
 
 #include "NTMessage.hpp"
 #include "NTBuffer.hpp"
+#include "MessageRing.hpp"
+#include "Rendezvous.hpp"
+#include "MessageCodec.hpp"
 
 // #include <boost/interprocess/containers/vector.hpp>
 
@@ -71,6 +76,11 @@ DECLARE_int64( target_size );
 DECLARE_int64( aggregator_target_size );
 DECLARE_int64( aggregator_autoflush_ticks );
 DECLARE_bool( enable_aggregation );
+DECLARE_bool( aggregator_adaptive_flush );
+DECLARE_bool( locale_message_rings );
+DECLARE_int64( aggregator_route_dimensions );
+DECLARE_bool( aggregator_urgent_immediate );
+DECLARE_int64( aggregator_credit_bytes );
 
 /// stats for application messages
 GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, app_messages_enqueue );
@@ -79,9 +89,24 @@ GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, app_messages_immediate );
 
 GRAPPA_DECLARE_METRIC( SummarizingMetric<int64_t>, app_nt_message_bytes );
 
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, app_messages_ring_enqueue );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, app_messages_ring_full );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, app_messages_ring_delivered );
+
 /// stats for RDMA Aggregator events
 GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_capacity_flushes );
 GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_requested_flushes );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_adaptive_size_flushes );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_adaptive_timeout_flushes );
+GRAPPA_DECLARE_METRIC( SummarizingMetric<int64_t>, rdma_adaptive_flush_threshold );
+GRAPPA_DECLARE_METRIC( SummarizingMetric<int64_t>, rdma_adaptive_flush_timeout );
+
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_urgent_immediate );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_urgent_enqueued );
+
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_credit_stalls );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_credit_stall_ticks );
+GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_credit_overdrafts );
 
 GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_poll );
 GRAPPA_DECLARE_METRIC( SimpleMetric<int64_t>, rdma_poll_send );
@@ -208,11 +233,28 @@ namespace Grappa {
       /// another cache line
       ///
 
-      /// racy updates, used only in source core for locale
+      /// added to atomically by every core in the locale; read and
+      /// (racily) reset only by the source core for locale
       size_t locale_byte_count_;
       Grappa::Timestamp earliest_message_for_locale_;
 
-      int64_t pad2[7];
+      /// adaptive flush policy state, updated only by the source core for locale
+      size_t flush_threshold_;
+      Grappa::Timestamp flush_timeout_;
+      double byte_rate_;
+
+      /// bytes sent to this locale, and how many of them were
+      /// forwarded on to other locales (source core for locale only)
+      int64_t route_bytes_;
+      int64_t route_forwarded_bytes_;
+
+      /// urgent messages for this core, sent before messages_
+      Grappa::impl::MessageList urgent_messages_;
+
+      /// flow control: bytes of bulk messages queued for this locale
+      /// plus bytes sent that it hasn't returned credit for yet
+      /// (shared by all cores in our locale)
+      int64_t credit_bytes_used_;
 
       
       CoreData() 
@@ -225,6 +267,13 @@ namespace Grappa {
         , remote_buffers_()
         , locale_byte_count_(0)
         , earliest_message_for_locale_(0)
+        , flush_threshold_( FLAGS_aggregator_target_size )
+        , flush_timeout_( FLAGS_aggregator_autoflush_ticks )
+        , byte_rate_( 0.0 )
+        , route_bytes_( 0 )
+        , route_forwarded_bytes_( 0 )
+        , urgent_messages_()
+        , credit_bytes_used_( 0 )
       { }
     } __attribute__ ((aligned(64)));
 
@@ -241,6 +290,19 @@ namespace Grappa {
 
       Core * source_core_for_locale_;
       Core * dest_core_for_locale_;
+
+      /// first locale on the way to each locale in the virtual topology
+      Locale * next_hop_for_locale_;
+      /// locales whose traffic is forwarded through each next-hop locale
+      std::vector< std::vector< Locale > > routed_through_locale_;
+
+      /// Next locale on a message's way from one locale to another.
+      Locale next_hop( Locale from, Locale to ) const;
+
+      /// Number of buffer sends between two locales.
+      int route_hops( Locale from, Locale to ) const;
+
+      void compute_next_hops();
       Core * core_partner_locales_;
       int core_partner_locale_count_;
 
@@ -249,6 +311,9 @@ namespace Grappa {
 
       void compute_route_map();
       void draw_routing_graph();
+
+      /// Deserializer for a run of messages forwarded through this locale
+      static char * deserialize_forward( char * t );
       void fill_free_pool( size_t num_buffers );
 
 
@@ -263,6 +328,54 @@ namespace Grappa {
       /// per-core storage
       CoreData * cores_;
 
+      /// serialized message rings for each pair of cores in this locale
+      MessageRing * rings_;
+
+      inline MessageRing * ring( Core from_locale_core, Core to_locale_core ) const {
+        return &rings_[ from_locale_core * Grappa::locale_cores() + to_locale_core ];
+      }
+
+      /// Serialize a message into the ring to a core in our
+      /// locale. Returns false if it must take the message list path instead.
+      inline bool ring_enqueue( Grappa::impl::MessageBase * m ) {
+        MessageRing * r = ring( Grappa::locale_mycore(), m->destination_ - Grappa::mylocale() * Grappa::locale_cores() );
+        size_t size = m->serialized_size();
+        char * p = r->reserve( size );
+        if( !p ) {
+          app_messages_ring_full++;
+          return false;
+        }
+        char * end = m->serialize_to( p, size );
+        DCHECK_GT( end - p, 0 ) << "Reserved space was not enough for message " << m;
+        r->commit( end - p );
+        app_messages_ring_enqueue++;
+
+        // payload is copied, so the sender may reuse the message now
+        m->mark_sent();
+        return true;
+      }
+
+      /// Deliver everything waiting in rings to this core.
+      bool ring_poll() {
+        bool useful = false;
+        Core me = Grappa::locale_mycore();
+        for( Core locale_source = 0; locale_source < Grappa::locale_cores(); ++locale_source ) {
+          MessageRing * r = ring( locale_source, me );
+          char * p = r->front();
+          if( p ) {
+            useful = true;
+            Grappa::impl::global_scheduler.set_no_switch_region( true );
+            do {
+              Grappa::impl::MessageBase::deserialize_and_call( p );
+              r->pop();
+              app_messages_ring_delivered++;
+            } while( (p = r->front()) != nullptr );
+            Grappa::impl::global_scheduler.set_no_switch_region( false );
+          }
+        }
+        return useful;
+      }
+
 
       /// Active message to deserialize/call all the entries in a buffer of received deserializers/functors
       static void deserialize_buffer_am( void * buf, int size, CommunicatorContext * c );
@@ -301,11 +414,42 @@ namespace Grappa {
       /// Chase a list of messages and serialize them into a buffer.
       /// Modifies pointer to list to support size-limited-ish aggregation
       /// TODO: make this a hard limit?
-      char * aggregate_to_buffer( char * buffer, Grappa::impl::MessageBase ** message_ptr, size_t max = -1, uint64_t * count = NULL );
+      char * aggregate_to_buffer( char * buffer, Grappa::impl::MessageBase ** message_ptr, size_t max = -1, uint64_t * count = NULL,
+                                  std::vector< char * > * message_ends = NULL );
       
       // Deserialize and call a buffer of messages
       static char * deaggregate_buffer( char * buffer, size_t size );
 
+      /// high bit of a per-core count marks an encoded slice
+      static const uint32_t encoded_slice_bit = 1u << 31;
+
+      enum class CompressionMode { Off, On, Auto };
+      CompressionMode compression_mode_;
+      bool compression_enabled_;           ///< in auto mode, is encoding paying off?
+      int64_t compression_countdown_;      ///< buffers until next trial encoding
+      double compression_savings_rate_;    ///< smoothed bytes saved per tick of encode/decode
+      MessageCodec encoder_;
+      MessageCodec decoder_;
+      char * encode_scratch_;
+      char * decode_scratch_;
+      bool decode_scratch_busy_;
+
+      bool should_encode();
+
+      /// adaptive flushing: smoothed round trip of this core's blocking
+      /// delegates, in ticks, and when we last saw one complete
+      double reply_latency_;
+      Grappa::Timestamp last_reply_seen_;
+      size_t last_roundtrips_;
+      double last_roundtrip_ticks_;
+      void update_reply_latency( Grappa::Timestamp now );
+
+      /// Encode a filled buffer's slices in place; returns new payload size
+      size_t encode_buffer( RDMABuffer * b, size_t aggregated_size, const std::vector< char * >& message_ends );
+
+      /// Deserialize and call one core's slice of a received buffer
+      void deaggregate_slice( char * buffer, uint32_t count );
+
       /// Grab a list of messages to send
       inline Grappa::impl::MessageList grab_messages( Core c, Core sender ) {
         Grappa::impl::MessageList * dest_ptr = &(coreData( c, sender )->messages_);
@@ -341,6 +485,18 @@ namespace Grappa {
         return old_ml;
       }
 
+      inline Grappa::impl::MessageList grab_urgent_messages( CoreData * cd ) {
+        Grappa::impl::MessageList * dest_ptr = &(cd->urgent_messages_);
+        Grappa::impl::MessageList old_ml, new_ml;
+
+        do {
+          old_ml = *dest_ptr;
+          new_ml.raw_ = 0;
+        } while( !__sync_bool_compare_and_swap( &(dest_ptr->raw_), old_ml.raw_, new_ml.raw_ ) );
+
+        return old_ml;
+      }
+
       inline Grappa::impl::MessageList grab_messages( CoreData * cd ) {
         Grappa::impl::MessageList * dest_ptr = &(cd->messages_);
         Grappa::impl::MessageList old_ml, new_ml;
@@ -372,6 +528,9 @@ namespace Grappa {
       void send_locale_medium( Locale locale );
       void send_locale( Locale locale );
 
+      /// Retune size threshold and timeout for a locale after a send
+      void adapt_flush_policy( CoreData * locale_core, int64_t bytes_sent );
+
       void send_with_buffers( Core core,
                               MessageBase ** messages_to_send_ptr,
                               RDMABuffer * local_buf,
@@ -406,9 +565,21 @@ namespace Grappa {
         // 
         CHECK_NE( Grappa::mycore(), c );
 
+        CoreData * cd = localeCoreData(c);
+        Grappa::Timestamp timeout = FLAGS_aggregator_autoflush_ticks;
+
+        if( FLAGS_aggregator_adaptive_flush ) {
+          // have we reached the size limit chosen for this locale?
+          if( cd->locale_byte_count_ >= cd->flush_threshold_ ) {
+            return true;
+          }
+
+          timeout = cd->flush_timeout_;
+        }
+
         // have we timed out?
         Grappa::Timestamp current_ts = Grappa::timestamp();
-        if( current_ts - localeCoreData(c)->last_sent_ > FLAGS_aggregator_autoflush_ticks ) {
+        if( current_ts - cd->last_sent_ > timeout ) {
           return true;
         }
 
@@ -425,7 +596,8 @@ namespace Grappa {
         for( Core locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
           // check each of my cores' lists
           for( Core c = start; c < max; ++c ) {
-            if( coreData(c, locale_core)->messages_.raw_ != 0 ) {
+            if( coreData(c, locale_core)->messages_.raw_ != 0 ||
+                coreData(c, locale_core)->urgent_messages_.raw_ != 0 ) {
               return true;
             }
           }
@@ -473,6 +645,8 @@ namespace Grappa {
         , total_cores_( -1 )
         , source_core_for_locale_( NULL )
         , dest_core_for_locale_( NULL )
+        , next_hop_for_locale_( NULL )
+        , routed_through_locale_()
         , core_partner_locales_( NULL )
         , core_partner_locale_count_( 0 )
         , ntbuffers_( nullptr )
@@ -480,7 +654,21 @@ namespace Grappa {
         , received_buffer_list_()
         , free_buffer_list_()
         , cores_(NULL)
+        , rings_(NULL)
         , rdma_buffers_( NULL )
+        , compression_mode_( CompressionMode::Off )
+        , compression_enabled_( false )
+        , compression_countdown_( 0 )
+        , compression_savings_rate_( 0.0 )
+        , encoder_()
+        , decoder_()
+        , encode_scratch_( NULL )
+        , decode_scratch_( NULL )
+        , decode_scratch_busy_( false )
+        , reply_latency_( 0.0 )
+        , last_reply_seen_( 0 )
+        , last_roundtrips_( 0 )
+        , last_roundtrip_ticks_( 0.0 )
         , flush_cv_()
         , disable_flush_(false)
         , max_size_( (1 << 16) )
@@ -518,6 +706,16 @@ namespace Grappa {
         Core c = Grappa::mycore();
         // see if we have anything to receive
 
+        // try serialized rings from cores in our locale
+        if( FLAGS_locale_message_rings ) {
+          useful = ring_poll();
+        }
+
+        // deliver rendezvous payloads pulled from other locales
+        if( global_rendezvous.pending() ) {
+          useful |= global_rendezvous.poll();
+        }
+
         // try global queue
         if( localeCoreData(c)->messages_.raw_ != 0 ) {
           useful = true;
@@ -617,6 +815,17 @@ namespace Grappa {
         Core core = m->destination_;
         CoreData * dest = NULL;
 
+        // within our locale, try to serialize directly into the
+        // destination's ring. messages already delivered through
+        // the list path and headed back to be marked sent skip this.
+        if( FLAGS_locale_message_rings &&
+            !locale_enqueue &&
+            !m->is_delivered_ &&
+            Grappa::locale_of( core ) == Grappa::mylocale() &&
+            ring_enqueue( m ) ) {
+          return;
+        }
+
         if( locale_enqueue ) {
           dest = localeCoreData(core);
         } else {
@@ -624,7 +833,7 @@ namespace Grappa {
         }
 
         //CoreData * sender = &cores_[ dest->representative_core_ ];
-        CoreData * locale_core = localeCoreData( Grappa::locale_of( m->destination_ ) * Grappa::locale_cores() );
+        CoreData * locale_core = localeCoreData( next_hop_for_locale_[ Grappa::locale_of( m->destination_ ) ] * Grappa::locale_cores() );
 
         // possibly short circuit out of here when aggregation is disabled
         if( !FLAGS_enable_aggregation &&
@@ -634,6 +843,20 @@ namespace Grappa {
           return send_immediate( m );
         }
 
+        // latency-critical messages to other locales skip the bulk list
+        if( m->is_urgent_ &&
+            !locale_enqueue &&
+            Grappa::locale_of( m->destination_ ) != Grappa::mylocale() ) {
+          return enqueue_urgent( m, dest );
+        }
+
+        // bulk messages to other locales need flow-control credit
+        if( FLAGS_aggregator_credit_bytes > 0 &&
+            !locale_enqueue &&
+            Grappa::locale_of( m->destination_ ) != Grappa::mylocale() ) {
+          acquire_credit( m->serialized_size(), locale_core, m->destination_ );
+        }
+
 
         //Grappa::impl::MessageBase ** dest_ptr = &dest->messages_;
         Grappa::impl::MessageList * dest_ptr = &(dest->messages_);
@@ -675,8 +898,10 @@ namespace Grappa {
         
         app_messages_enqueue_cas += cas_count;
 
-        // // warning: racy
-        // locale_core->locale_byte_count_ += size;
+        // every core in the locale enqueues to this count
+        if( FLAGS_aggregator_adaptive_flush && !locale_enqueue ) {
+          __sync_fetch_and_add( &locale_core->locale_byte_count_, m->serialized_size() );
+        }
           
         dest->prefetch_queue_[ count % prefetch_dist ].size_ = size < max_size_ ? size : max_size_-1;
         set_pointer( &(dest->prefetch_queue_[ count % prefetch_dist ]), m );
@@ -798,10 +1023,62 @@ namespace Grappa {
         }
       }
 
+      /// Send an urgent message immediately if we can; otherwise put
+      /// it on the urgent list, which goes out in a buffer of its own
+      /// before any bulk messages, and ask for that locale to be flushed.
+      void enqueue_urgent( Grappa::impl::MessageBase * m, CoreData * dest ) {
+        if( FLAGS_aggregator_urgent_immediate &&
+            !global_scheduler.in_no_switch_region() &&
+            global_communicator.send_context_available() ) {
+          rdma_urgent_immediate++;
+          return send_immediate( m );
+        }
+
+        Grappa::impl::MessageList * dest_ptr = &(dest->urgent_messages_);
+        Grappa::impl::MessageList old_ml, new_ml;
+        set_pointer( &new_ml, m );
+        m->prefetch_ = NULL;
+        do {
+          old_ml = *dest_ptr;
+          new_ml.count_ = 1 + old_ml.count_;
+          m->next_ = get_pointer( &old_ml );
+        } while( !__sync_bool_compare_and_swap( &(dest_ptr->raw_), old_ml.raw_, new_ml.raw_ ) );
+
+        rdma_urgent_enqueued++;
+        flush( m->destination_ );
+      }
+
+      /// Charge a bulk message against its next-hop locale's credit
+      /// window. If the window is full, flush that locale and yield
+      /// until the receiver returns credit. Message handlers can't
+      /// block, so they overdraw the window instead.
+      void acquire_credit( size_t size, CoreData * locale_core, Core dest ) {
+        if( locale_core->credit_bytes_used_ >= FLAGS_aggregator_credit_bytes ) {
+          if( global_scheduler.in_no_switch_region() ) {
+            rdma_credit_overdrafts++;
+          } else {
+            rdma_credit_stalls++;
+            Grappa::Timestamp start = Grappa::force_tick();
+            flush( dest );
+            while( locale_core->credit_bytes_used_ >= FLAGS_aggregator_credit_bytes ) {
+              Grappa::yield();
+            }
+            rdma_credit_stall_ticks += Grappa::force_tick() - start;
+          }
+        }
+        __sync_fetch_and_add( &locale_core->credit_bytes_used_, size );
+      }
+
+      /// Give back credit for bytes a locale has delivered.
+      void release_credit( Locale locale, int64_t bytes ) {
+        int64_t used = __sync_sub_and_fetch( &localeCoreData( locale * Grappa::locale_cores() )->credit_bytes_used_, bytes );
+        DCHECK_GE( used, 0 ) << "returned more credit than was used";
+      }
+
       /// Flush one destination.
       void flush( Core c ) {
         rdma_requested_flushes++;
-        Locale locale = Grappa::locale_of(c);
+        Locale locale = next_hop_for_locale_[ Grappa::locale_of(c) ];
         if( source_core_for_locale_[ locale ] == Grappa::mycore() ) {
           Grappa::signal( &(localeCoreData( locale * Grappa::locale_cores() )->send_cv_) );
         } else {
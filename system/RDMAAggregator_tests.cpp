@@ -71,6 +71,11 @@ DECLARE_int64( rdma_buffers_per_core );
 
 DECLARE_int64( loop_threshold );
 
+DECLARE_int64( aggregator_adaptive_min_bytes );
+DECLARE_int64( aggregator_adaptive_max_bytes );
+DECLARE_int64( aggregator_adaptive_min_ticks );
+DECLARE_int64( aggregator_adaptive_max_ticks );
+
 BOOST_AUTO_TEST_SUITE( RDMAAggregator_tests );
 
 
@@ -85,6 +90,8 @@ GRAPPA_DEFINE_METRIC( SimpleMetric<double>, enqueued_messages_rate_per_core, 0.0
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, local_messages_per_locale, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<double>, local_messages_time, 0.0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<double>, local_messages_rate_per_locale, 0.0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<double>, local_ring_messages_time, 0.0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<double>, local_ring_messages_rate_per_locale, 0.0 );
 
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, remote_distributed_messages_per_locale, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, remote_distributed_buffers_per_locale, 0 );
@@ -220,6 +227,52 @@ BOOST_AUTO_TEST_CASE( test1 ) {
     // make earlier tests shut up
     Grappa::on_all_cores( [] { count = 6; } );
 
+    // check that adaptive flush timeouts follow measured delegate
+    // latency and stay within the configured bounds. This drives the
+    // policy directly with a scratch CoreData, and doesn't yield, so
+    // the aggregator's own sends can't consume the injected samples.
+    {
+      auto& agg = Grappa::impl::global_rdma_aggregator;
+      const int64_t min_ticks = FLAGS_aggregator_adaptive_min_ticks;
+      const int64_t max_ticks = FLAGS_aggregator_adaptive_max_ticks;
+      Grappa::impl::CoreData cd;
+
+      // send a byte at a time, far apart, so the fill time is never
+      // what limits the timeout
+      auto adapt = [&] {
+        cd.last_sent_ = Grappa::force_tick() - 10 * max_ticks;
+        agg.adapt_flush_policy( &cd, 1 );
+        BOOST_CHECK_GE( static_cast< int64_t >( cd.flush_threshold_ ), FLAGS_aggregator_adaptive_min_bytes );
+        BOOST_CHECK_LE( static_cast< int64_t >( cd.flush_threshold_ ), FLAGS_aggregator_adaptive_max_bytes );
+        BOOST_CHECK_GE( cd.flush_timeout_, min_ticks );
+        BOOST_CHECK_LE( cd.flush_timeout_, max_ticks );
+        return cd.flush_timeout_;
+      };
+
+      // start from no measured latency
+      agg.update_reply_latency( Grappa::force_tick() );
+      agg.reply_latency_ = 0.0;
+
+      // a quiet destination with no delegates waits as long as allowed
+      BOOST_CHECK_EQUAL( adapt(), max_ticks );
+
+      // round trips much slower than that don't change anything
+      delegate_roundtrip_latency += 8.0 * max_ticks;
+      BOOST_CHECK_EQUAL( adapt(), max_ticks );
+
+      // as round trips get faster, the timeout follows a quarter of
+      // the smoothed latency down to the floor
+      Grappa::Timestamp previous = max_ticks;
+      for( int i = 0; i < 100; ++i ) {
+        delegate_roundtrip_latency += 1.0;
+        Grappa::Timestamp timeout = adapt();
+        BOOST_CHECK_LE( timeout, previous );
+        BOOST_CHECK_LE( timeout, std::max< double >( min_ticks, agg.reply_latency_ / 4 ) );
+        previous = timeout;
+      }
+      BOOST_CHECK_EQUAL( previous, min_ticks );
+    }
+
 
   
   
@@ -250,102 +303,122 @@ BOOST_AUTO_TEST_CASE( test1 ) {
         }
       };
     
-      double start = Grappa::walltime();
+      // compare message list delivery with ring delivery. Rings are
+      // only allocated when --locale_message_rings is set at startup,
+      // so the ring pass needs that flag.
+      const bool rings_available = FLAGS_locale_message_rings;
+      for( bool use_rings : { false, true } ) {
+        if( use_rings && !rings_available ) {
+          LOG(INFO) << "Skipping message ring delivery; run with --locale_message_rings to compare";
+          continue;
+        }
+        Grappa::on_all_cores( [use_rings] { FLAGS_locale_message_rings = use_rings; } );
 
-      Grappa::Metrics::start_tracing();
+        double start = Grappa::walltime();
+
+        Grappa::Metrics::start_tracing();
       
-      Grappa::on_all_cores( [expected_messages_per_core, sent_messages_per_core] {
+        Grappa::on_all_cores( [expected_messages_per_core, sent_messages_per_core] {
           
-          LOG(INFO) << __PRETTY_FUNCTION__ << ": Starting.";
-          google::FlushLogFiles(google::GLOG_INFO);
-
-          // Grappa::ReuseMessage< LocalDelivery > m1;
-          // m1->source_core = 1234;
-          // m1->dest_core = Grappa::mycore();
-          // local_ce.enroll( 1 );
-          // m1.deliver_locally();
+            LOG(INFO) << __PRETTY_FUNCTION__ << ": Starting.";
+            google::FlushLogFiles(google::GLOG_INFO);
+
+            // Grappa::ReuseMessage< LocalDelivery > m1;
+            // m1->source_core = 1234;
+            // m1->dest_core = Grappa::mycore();
+            // local_ce.enroll( 1 );
+            // m1.deliver_locally();
         
-          LOG(INFO) << __PRETTY_FUNCTION__ << ": Constructing.";
-          google::FlushLogFiles(google::GLOG_INFO);
-          Grappa::ReuseMessageList< LocalDelivery > msgs( FLAGS_outstanding );
-          LOG(INFO) << __PRETTY_FUNCTION__ << ": Activating.";
-          google::FlushLogFiles(google::GLOG_INFO);
-          msgs.activate(); // allocate messages
+            LOG(INFO) << __PRETTY_FUNCTION__ << ": Constructing.";
+            google::FlushLogFiles(google::GLOG_INFO);
+            Grappa::ReuseMessageList< LocalDelivery > msgs( FLAGS_outstanding );
+            LOG(INFO) << __PRETTY_FUNCTION__ << ": Activating.";
+            google::FlushLogFiles(google::GLOG_INFO);
+            msgs.activate(); // allocate messages
 
-          { 
-            local_ce.reset();
-            local_count = 0;
-            local_ce.enroll( expected_messages_per_core );
-            LOG(INFO) << "Core " << Grappa::mycore() << " waiting for " << local_ce.get_count() << " updates.";
+            { 
+              local_ce.reset();
+              local_count = 0;
+              local_ce.enroll( expected_messages_per_core );
+              LOG(INFO) << "Core " << Grappa::mycore() << " waiting for " << local_ce.get_count() << " updates.";
 
-            Grappa::barrier();
+              Grappa::barrier();
 
 
-            if( FLAGS_disable_sending ) {
-              // keep aggregator from polling during sends or flushing for a bit.
-              Grappa::impl::global_rdma_aggregator.disable_everything_ = true;
-            }
+              if( FLAGS_disable_sending ) {
+                // keep aggregator from polling during sends or flushing for a bit.
+                Grappa::impl::global_rdma_aggregator.disable_everything_ = true;
+              }
 
-            if( FLAGS_disable_switching ) {
-              Grappa::impl::global_scheduler.set_no_switch_region( true );
-              LOG(INFO) << "switching disabled";
-            }
+              if( FLAGS_disable_switching ) {
+                Grappa::impl::global_scheduler.set_no_switch_region( true );
+                LOG(INFO) << "switching disabled";
+              }
 
-            LOG(INFO) << "sending messages";
+              LOG(INFO) << "sending messages";
 
-            for( int i = 0; i < sent_messages_per_core; ++i ) {
-              for( int locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
-              // Core locale_core = Grappa::locale_cores() - Grappa::mycore() - 1;
-                Core mycore = Grappa::mycore();
-                Core dest_core = locale_core + Grappa::mylocale() * Grappa::locale_cores();
-                if( FLAGS_send_to_self ) {
-                  dest_core = mycore;
-                }
+              for( int i = 0; i < sent_messages_per_core; ++i ) {
+                for( int locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
+                // Core locale_core = Grappa::locale_cores() - Grappa::mycore() - 1;
+                  Core mycore = Grappa::mycore();
+                  Core dest_core = locale_core + Grappa::mylocale() * Grappa::locale_cores();
+                  if( FLAGS_send_to_self ) {
+                    dest_core = mycore;
+                  }
 
-                //Core dest_core = (Grappa::locale_cores() - locale_core - 1) + Grappa::mylocale() * Grappa::locale_cores();
-                msgs.with_message( [mycore, dest_core] ( Grappa::ReuseMessage<LocalDelivery> * m ) {
-                    (*m)->source_core = mycore;
-                    (*m)->dest_core = dest_core;
-                    CHECK_EQ( Grappa::locale_of( mycore ), Grappa::locale_of( dest_core ) );
-                    m->enqueue( dest_core );
-                  } );
-                }
-            }
+                  //Core dest_core = (Grappa::locale_cores() - locale_core - 1) + Grappa::mylocale() * Grappa::locale_cores();
+                  msgs.with_message( [mycore, dest_core] ( Grappa::ReuseMessage<LocalDelivery> * m ) {
+                      (*m)->source_core = mycore;
+                      (*m)->dest_core = dest_core;
+                      CHECK_EQ( Grappa::locale_of( mycore ), Grappa::locale_of( dest_core ) );
+                      m->enqueue( dest_core );
+                    } );
+                  }
+              }
 
-            if( FLAGS_disable_switching ) {
-              Grappa::impl::global_scheduler.set_no_switch_region( false );
-              LOG(INFO) << "switching enabled";
-            }
+              if( FLAGS_disable_switching ) {
+                Grappa::impl::global_scheduler.set_no_switch_region( false );
+                LOG(INFO) << "switching enabled";
+              }
 
-            LOG(INFO) << "delivering messages";
+              LOG(INFO) << "delivering messages";
 
-            for( int locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
-              Grappa::impl::global_rdma_aggregator.flush( locale_core + Grappa::mylocale() * Grappa::locale_cores() );
-            }
+              for( int locale_core = 0; locale_core < Grappa::locale_cores(); ++locale_core ) {
+                Grappa::impl::global_rdma_aggregator.flush( locale_core + Grappa::mylocale() * Grappa::locale_cores() );
+              }
 
-            Grappa::yield();
+              Grappa::yield();
 
-            if( FLAGS_disable_sending ) {
-              // keep aggregator from polling during sends or flushing for a bit.
-              Grappa::impl::global_rdma_aggregator.disable_everything_ = false;
-            }
+              if( FLAGS_disable_sending ) {
+                // keep aggregator from polling during sends or flushing for a bit.
+                Grappa::impl::global_rdma_aggregator.disable_everything_ = false;
+              }
 
-            local_ce.wait();
+              local_ce.wait();
 
-            Grappa::barrier();
+              Grappa::barrier();
 
-            BOOST_CHECK_EQUAL( local_count, expected_messages_per_core );
-            CHECK_EQ( local_count, expected_messages_per_core ) << "Local message delivery";
-          }
+              BOOST_CHECK_EQUAL( local_count, expected_messages_per_core );
+              CHECK_EQ( local_count, expected_messages_per_core ) << "Local message delivery";
+            }
         
-          msgs.finish(); // clean up messages
-        } );
-      Grappa::Metrics::stop_tracing();
-
-      double time = Grappa::walltime() - start;
-      local_messages_per_locale = expected_messages_per_locale;
-      local_messages_time = time;
-      local_messages_rate_per_locale = expected_messages_per_locale / time;
+            msgs.finish(); // clean up messages
+          } );
+        Grappa::Metrics::stop_tracing();
+
+        double time = Grappa::walltime() - start;
+        local_messages_per_locale = expected_messages_per_locale;
+        if( use_rings ) {
+          local_ring_messages_time = time;
+          local_ring_messages_rate_per_locale = expected_messages_per_locale / time;
+        } else {
+          local_messages_time = time;
+          local_messages_rate_per_locale = expected_messages_per_locale / time;
+        }
+        LOG(INFO) << "Local delivery through " << (use_rings ? "message rings" : "message lists")
+                  << ": " << expected_messages_per_locale / time << " messages/s per locale";
+      }
+      Grappa::on_all_cores( [rings_available] { FLAGS_locale_message_rings = rings_available; } );
     }
 
 
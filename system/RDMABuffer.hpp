@@ -107,6 +107,11 @@ public:
 
   inline RDMABuffer * get_ack() { return reinterpret_cast< RDMABuffer * >( ack_ ); }
   inline void set_ack( RDMABuffer * ack ) { ack_ = reinterpret_cast< intptr_t >( ack ); }
+
+  /// aggregated buffers use the ack field to carry the flow-control
+  /// credit the receiver returns once it has delivered the buffer
+  inline size_t get_credit() { return ack_; }
+  inline void set_credit( size_t credit ) { ack_ = credit; }
   
   inline Core get_source() { return source_; }
   //inline void set_core( Core c ) { LOG(INFO) << this << " changed from " << core_ << " to " << c; core_ = c; }
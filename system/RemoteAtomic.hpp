@@ -0,0 +1,292 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Delegate.hpp"
+#include "ConditionVariableLocal.hpp"
+#include "Tasking.hpp"
+#include <unordered_map>
+#include <vector>
+
+DECLARE_bool( delegate_atomic_combining );
+
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_atomics);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_atomic_targets);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, delegate_atomics_combined);
+
+namespace Grappa {
+  namespace delegate {
+    /// @addtogroup Delegates
+    /// @{
+
+    /// Operations for the remote atomics below. Each replaces the value
+    /// `old` at the target with `apply(old, arg)`. Every operation here is
+    /// associative in the sense that
+    ///   apply(apply(old, a), b) == apply(old, apply(a, b)),
+    /// which is what lets operations on the same address be combined
+    /// into one before they are sent.
+    namespace op {
+      struct Add  { template< typename T > static T apply( T old, T arg ) { return old + arg; } };
+      struct Min  { template< typename T > static T apply( T old, T arg ) { return arg < old ? arg : old; } };
+      struct Max  { template< typename T > static T apply( T old, T arg ) { return old < arg ? arg : old; } };
+      struct Or   { template< typename T > static T apply( T old, T arg ) { return old | arg; } };
+      struct And  { template< typename T > static T apply( T old, T arg ) { return old & arg; } };
+      struct Xor  { template< typename T > static T apply( T old, T arg ) { return old ^ arg; } };
+      struct Swap { template< typename T > static T apply( T old, T arg ) { return arg; } };
+
+      /// Conditional write: set the value only if it is still
+      /// `Sentinel`, so the first write wins (e.g. BFS parents).
+      template< int64_t Sentinel = -1 >
+      struct WriteIfUnset {
+        template< typename T > static T apply( T old, T arg ) {
+          return old == static_cast<T>( Sentinel ) ? arg : old;
+        }
+      };
+    }
+
+    namespace impl {
+
+      template< typename Op, typename T >
+      inline T apply_at_home( T * p, T arg ) {
+        delegate_atomic_targets++;
+        T old = *p;
+        *p = Op::template apply<T>( old, arg );
+        return old;
+      }
+
+      /// One blocking atomic, returning once any cached copies of the
+      /// old value have been invalidated.
+      template< typename Op, typename T >
+      T fetch_and_apply_at( GlobalAddress<T> target, T arg ) {
+        Grappa::impl::InvalidationWait w;
+        auto wp = &w;
+        Core origin = mycore();
+        auto r = call( target.core(), [target, arg, origin, wp]() -> Grappa::impl::WithInvalidations<T> {
+          T * p = target.pointer();
+          T old = apply_at_home<Op>( p, arg );
+          return { old, Grappa::impl::global_coherent_cache.written( p, sizeof(T), origin, wp ) };
+        });
+        w.wait( r.invalidations );
+        return r.value;
+      }
+
+      /// One async atomic, completing `C` once any cached copies of the
+      /// old value have been invalidated.
+      template< typename Op, GlobalCompletionEvent * C, typename T >
+      void apply_at_async( GlobalAddress<T> target, T arg ) {
+        Grappa::impl::call_async_writing<C>( target.core(), [target, arg]( Core origin ) -> uint64_t {
+          T * p = target.pointer();
+          apply_at_home<Op>( p, arg );
+          return Grappa::impl::global_coherent_cache.written_async( p, sizeof(T), origin, C );
+        });
+      }
+
+      /// Combines blocking atomics issued by tasks on this core to the
+      /// same address. The first task to arrive yields once so others
+      /// can join, then sends a single operation with the combined
+      /// argument, and hands each participant the value it would have
+      /// seen had the operations been applied one at a time, in order.
+      template< typename Op, typename T >
+      class AtomicCombiner {
+        struct Participant {
+          T arg;
+          T result;
+          bool done;
+        };
+        struct Batch {
+          std::vector< Participant * > participants;
+          ConditionVariable cv;
+        };
+        std::unordered_map< intptr_t, Batch * > open;
+
+      public:
+        static AtomicCombiner& instance() {
+          static AtomicCombiner c;
+          return c;
+        }
+
+        T fetch_and_apply( GlobalAddress<T> target, T arg ) {
+          Participant me{ arg, T(), false };
+          auto it = open.find( target.raw_bits() );
+          if( it != open.end() ) {
+            delegate_atomics_combined++;
+            Batch * b = it->second;
+            b->participants.push_back( &me );
+            // b lives on the sender's stack; don't touch it once done
+            while( !me.done ) Grappa::wait( &b->cv );
+            return me.result;
+          }
+
+          Batch b;
+          b.participants.push_back( &me );
+          open[ target.raw_bits() ] = &b;
+          Grappa::yield();
+          open.erase( target.raw_bits() );
+
+          T combined = b.participants[0]->arg;
+          for( size_t i = 1; i < b.participants.size(); ++i ) {
+            combined = Op::template apply<T>( combined, b.participants[i]->arg );
+          }
+          T current = fetch_and_apply_at<Op>( target, combined );
+          for( auto p : b.participants ) {
+            p->result = current;
+            current = Op::template apply<T>( current, p->arg );
+            p->done = true;
+          }
+          broadcast( &b.cv );
+          return me.result;
+        }
+      };
+
+      /// Combines fire-and-forget atomics on this core to the same
+      /// address: the first one spawns a task that yields once and then
+      /// sends whatever has accumulated.
+      template< typename Op, typename T, GlobalCompletionEvent * C >
+      class AsyncAtomicCombiner {
+        std::unordered_map< intptr_t, T > pending;
+
+      public:
+        static AsyncAtomicCombiner& instance() {
+          static AsyncAtomicCombiner c;
+          return c;
+        }
+
+        void apply( GlobalAddress<T> target, T arg ) {
+          auto it = pending.find( target.raw_bits() );
+          if( it != pending.end() ) {
+            delegate_atomics_combined++;
+            it->second = Op::template apply<T>( it->second, arg );
+            return;
+          }
+          pending[ target.raw_bits() ] = arg;
+          // hold C open until the combined operation is sent
+          if( C ) C->enroll();
+          privateTask( [target] {
+            Grappa::yield();
+            auto& self = instance();
+            auto it = self.pending.find( target.raw_bits() );
+            T combined = it->second;
+            self.pending.erase( it );
+            apply_at_async<Op,C>( target, combined );
+            if( C ) C->complete();
+          });
+        }
+      };
+
+    } // namespace impl
+
+    /// Atomically replace the value at `target` with `Op::apply(value, arg)`
+    /// on its home core, and return the previous value. Operations from
+    /// tasks on this core to the same address are combined into one
+    /// message unless --delegate_atomic_combining is off.
+    /// @warning Target object must lie on a single node (not span blocks in global address space).
+    ///
+    /// @b Example:
+    /// @code
+    ///   // SSSP relaxation
+    ///   double old = delegate::fetch_and_apply<delegate::op::Min>(dist + v, d);
+    /// @endcode
+    template< typename Op, typename T, typename U >
+    T fetch_and_apply( GlobalAddress<T> target, U arg ) {
+      delegate_atomics++;
+      T a = static_cast<T>( arg );
+      if( target.core() != mycore() && FLAGS_delegate_atomic_combining ) {
+        return impl::AtomicCombiner<Op,T>::instance().fetch_and_apply( target, a );
+      }
+      // short-circuits if local
+      return impl::fetch_and_apply_at<Op>( target, a );
+    }
+
+    /// Atomically replace the value at `target` with `Op::apply(value, arg)`,
+    /// discarding the previous value. With SyncMode::Async this returns
+    /// right away, and completion is tracked by the GlobalCompletionEvent
+    /// `C`, as for delegate::increment(). Async operations to the same
+    /// address are combined before they are sent.
+    /// @warning Target object must lie on a single node (not span blocks in global address space).
+    template< typename Op,
+              SyncMode S = SyncMode::Blocking,
+              GlobalCompletionEvent * C = &Grappa::impl::local_gce,
+              typename T = decltype(nullptr),
+              typename U = decltype(nullptr) >
+    void apply( GlobalAddress<T> target, U arg ) {
+      if( S == SyncMode::Blocking ) {
+        fetch_and_apply<Op>( target, arg );
+        return;
+      }
+      delegate_atomics++;
+      T a = static_cast<T>( arg );
+      if( target.core() != mycore() && FLAGS_delegate_atomic_combining ) {
+        impl::AsyncAtomicCombiner<Op,T,C>::instance().apply( target, a );
+      } else {
+        // short-circuits if local
+        impl::apply_at_async<Op,C>( target, a );
+      }
+    }
+
+    template< typename T, typename U >
+    T fetch_and_min( GlobalAddress<T> target, U arg ) { return fetch_and_apply<op::Min>( target, arg ); }
+
+    template< typename T, typename U >
+    T fetch_and_max( GlobalAddress<T> target, U arg ) { return fetch_and_apply<op::Max>( target, arg ); }
+
+    template< typename T, typename U >
+    T fetch_and_or( GlobalAddress<T> target, U arg ) { return fetch_and_apply<op::Or>( target, arg ); }
+
+    template< typename T, typename U >
+    T fetch_and_and( GlobalAddress<T> target, U arg ) { return fetch_and_apply<op::And>( target, arg ); }
+
+    template< typename T, typename U >
+    T fetch_and_xor( GlobalAddress<T> target, U arg ) { return fetch_and_apply<op::Xor>( target, arg ); }
+
+    /// Write `value` to `target` and return what was there.
+    template< typename T, typename U >
+    T swap( GlobalAddress<T> target, U value ) { return fetch_and_apply<op::Swap>( target, value ); }
+
+    /// Lower the value at `target` to `arg` if `arg` is smaller.
+    template< SyncMode S = SyncMode::Blocking,
+              GlobalCompletionEvent * C = &Grappa::impl::local_gce,
+              typename T = decltype(nullptr),
+              typename U = decltype(nullptr) >
+    void atomic_min( GlobalAddress<T> target, U arg ) { apply<op::Min,S,C>( target, arg ); }
+
+    /// Raise the value at `target` to `arg` if `arg` is larger.
+    template< SyncMode S = SyncMode::Blocking,
+              GlobalCompletionEvent * C = &Grappa::impl::local_gce,
+              typename T = decltype(nullptr),
+              typename U = decltype(nullptr) >
+    void atomic_max( GlobalAddress<T> target, U arg ) { apply<op::Max,S,C>( target, arg ); }
+
+    /// @}
+  } // namespace delegate
+} // namespace Grappa
@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <climits>
+
+#include "Rendezvous.hpp"
+#include "Message.hpp"
+#include "LocaleSharedMemory.hpp"
+#include "Metrics.hpp"
+
+DEFINE_int64( rendezvous_threshold, 0, "Payloads of at least this many bytes are pulled by the receiver instead of copied into aggregation buffers (0 disables)" );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rendezvous_local_pulls, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rendezvous_remote_pulls, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<int64_t>, rendezvous_bytes_pulled, 0 );
+
+namespace Grappa {
+namespace impl {
+
+Rendezvous global_rendezvous;
+
+void Rendezvous::activate() {
+  // only MPI gives us one-sided access to other locales; with other
+  // transports, rendezvous is used within a locale only. Skip the
+  // window entirely when rendezvous is disabled.
+  remote_ = ( FLAGS_rendezvous_threshold > 0 &&
+              0 == strcmp( global_communicator.transport_name(), "mpi" ) );
+
+  if( remote_ ) {
+    window_base_ = static_cast< char * >( locale_shared_memory.get_base_address() );
+    MPI_CHECK( MPI_Win_create( window_base_, locale_shared_memory.get_size(), 1,
+                               MPI_INFO_NULL, global_communicator.grappa_comm, &window_ ) );
+    MPI_CHECK( MPI_Win_lock_all( MPI_MODE_NOCHECK, window_ ) );
+  }
+  active_ = true;
+}
+
+void Rendezvous::finish() {
+  CHECK( pending_ == NULL ) << "Finishing with rendezvous gets still outstanding";
+  active_ = false;
+  if( remote_ ) {
+    MPI_CHECK( MPI_Win_unlock_all( window_ ) );
+    MPI_CHECK( MPI_Win_free( &window_ ) );
+    remote_ = false;
+  }
+}
+
+void Rendezvous::issue( RendezvousGet * g ) {
+  DCHECK( remote_ ) << "Rendezvous descriptor from another locale without a window";
+  CHECK_LE( g->descriptor_.size, INT_MAX ) << "Rendezvous payload too large";
+  MPI_Aint displacement = g->descriptor_.payload - window_base_;
+  MPI_CHECK( MPI_Rget( g->buffer_, g->descriptor_.size, MPI_BYTE,
+                       g->descriptor_.source, displacement, g->descriptor_.size, MPI_BYTE,
+                       window_, &g->request_ ) );
+  rendezvous_remote_pulls++;
+  g->next_ = pending_;
+  pending_ = g;
+}
+
+void Rendezvous::complete( const RendezvousDescriptor& d ) {
+  if( Grappa::locale_of( d.source ) == Grappa::mylocale() ) rendezvous_local_pulls++;
+  rendezvous_bytes_pulled += d.size;
+
+  MessageBase * m = d.message;
+  if( d.source == Grappa::mycore() ) {
+    m->rendezvous_complete();
+  } else {
+    Grappa::send_heap_message( d.source, [m] {
+        m->rendezvous_complete();
+      });
+  }
+}
+
+bool Rendezvous::poll() {
+  bool useful = false;
+  RendezvousGet ** prev = &pending_;
+  while( *prev ) {
+    RendezvousGet * g = *prev;
+    int flag = 0;
+    MPI_CHECK( MPI_Test( &g->request_, &flag, MPI_STATUS_IGNORE ) );
+    if( flag ) {
+      *prev = g->next_;
+      g->deliver();
+      complete( g->descriptor_ );
+      delete g;
+      useful = true;
+    } else {
+      prev = &g->next_;
+    }
+  }
+  return useful;
+}
+
+} // namespace impl
+} // namespace Grappa
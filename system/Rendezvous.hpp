@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef __RENDEZVOUS_HPP__
+#define __RENDEZVOUS_HPP__
+
+#include <mpi.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "Communicator.hpp"
+#include "LocaleSharedMemory.hpp"
+
+DECLARE_int64( rendezvous_threshold );
+
+namespace Grappa {
+namespace impl {
+
+class MessageBase;
+
+/// @addtogroup Communication
+/// @{
+
+/// What the receiver of a rendezvous message needs to pull its
+/// payload. This is sent through the aggregator in place of the
+/// payload itself.
+struct RendezvousDescriptor {
+  char * payload;          ///< payload address in the source's locale shared memory
+  MessageBase * message;   ///< message to mark sent once the payload has been pulled
+  size_t size;             ///< payload size in bytes
+  Core source;             ///< core that owns the payload
+};
+
+/// A pull from another locale that has been issued but has not
+/// completed yet.
+class RendezvousGet {
+public:
+  RendezvousDescriptor descriptor_;
+  char * buffer_;
+  MPI_Request request_;
+  RendezvousGet * next_;
+
+  RendezvousGet( const RendezvousDescriptor& d )
+    : descriptor_( d )
+    , buffer_( new char[ d.size ] )
+    , request_( MPI_REQUEST_NULL )
+    , next_( NULL )
+  { }
+
+  virtual ~RendezvousGet() {
+    delete [] buffer_;
+  }
+
+  /// Call the message handler on the pulled payload.
+  virtual void deliver() = 0;
+};
+
+template< typename T >
+class RendezvousGetImpl : public RendezvousGet {
+private:
+  T storage_;
+public:
+  RendezvousGetImpl( const T& t, const RendezvousDescriptor& d )
+    : RendezvousGet( d )
+    , storage_( t )
+  { }
+
+  virtual void deliver() {
+    storage_( buffer_, descriptor_.size );
+  }
+};
+
+/// Rendezvous protocol for large payloads. Instead of copying the
+/// payload into an aggregation buffer, the sender sends a descriptor
+/// and keeps the payload pinned; the receiver pulls the payload
+/// directly from the sender's locale shared memory (with a plain
+/// load within a locale, or an MPI one-sided get across locales) and
+/// then tells the sender its message has been sent.
+class Rendezvous {
+private:
+  MPI_Win window_;              ///< window over this core's view of locale shared memory
+  char * window_base_;
+  bool active_;
+  bool remote_;                 ///< can we pull from other locales?
+
+  RendezvousGet * pending_;     ///< gets issued but not yet completed
+
+  void issue( RendezvousGet * g );
+  void complete( const RendezvousDescriptor& d );
+
+public:
+  Rendezvous()
+    : window_( MPI_WIN_NULL )
+    , window_base_( NULL )
+    , active_( false )
+    , remote_( false )
+    , pending_( NULL )
+  { }
+
+  /// Collective: expose locale shared memory for one-sided gets.
+  void activate();
+
+  /// Collective: tear down the window.
+  void finish();
+
+  /// Should a payload of this size to this core be pulled by the
+  /// receiver instead of copied into the aggregation buffer? Only
+  /// payloads in locale shared memory can be pulled: that's all the
+  /// window covers, and the only memory mapped by other local cores.
+  /// Anything else is copied.
+  inline bool use_for( Core dest, const void * payload, size_t size ) const {
+    return active_
+      && FLAGS_rendezvous_threshold > 0
+      && size >= FLAGS_rendezvous_threshold
+      && ( remote_ || Grappa::locale_of( dest ) == Grappa::mylocale() )
+      && locale_shared_memory.contains( payload )
+      && locale_shared_memory.contains( static_cast< const char * >( payload ) + size - 1 );
+  }
+
+  /// Called on the receiver when a descriptor arrives.
+  template< typename T >
+  inline void receive( T& t, const RendezvousDescriptor& d ) {
+    if( Grappa::locale_of( d.source ) == Grappa::mylocale() ) {
+      // source's locale shared memory is mapped at the same address here
+      t( d.payload, d.size );
+      complete( d );
+    } else {
+      issue( new RendezvousGetImpl< T >( t, d ) );
+    }
+  }
+
+  /// Are any pulls from other locales outstanding?
+  inline bool pending() const { return pending_ != NULL; }
+
+  /// Deliver any pulls that have completed.
+  bool poll();
+};
+
+/// global Rendezvous instance
+extern Rendezvous global_rendezvous;
+
+/// @}
+
+} // namespace impl
+} // namespace Grappa
+
+#endif
@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <boost/test/unit_test.hpp>
+
+#include "Grappa.hpp"
+#include "Message.hpp"
+#include "Collective.hpp"
+#include "Delegate.hpp"
+#include "Rendezvous.hpp"
+
+BOOST_AUTO_TEST_SUITE( Rendezvous_tests );
+
+using namespace Grappa;
+
+static int64_t received_count = 0;
+static int64_t received_sum = 0;
+
+void check_payloads( size_t size ) {
+  BOOST_MESSAGE( "payloads of " << size << " bytes" );
+
+  on_all_cores( []{
+      received_count = 0;
+      received_sum = 0;
+    });
+
+  int64_t * payload = locale_alloc< int64_t >( size / sizeof(int64_t) );
+  int64_t expected = 0;
+  for( int64_t i = 0; i < size / sizeof(int64_t); ++i ) {
+    payload[i] = i;
+    expected += i;
+  }
+
+  for( Core c = 1; c < cores(); ++c ) {
+    // blocks until the payload has been copied or pulled
+    auto m = send_message( c, []( void * buf, size_t size ) {
+        int64_t * p = static_cast< int64_t * >( buf );
+        for( int64_t i = 0; i < size / sizeof(int64_t); ++i ) {
+          received_sum += p[i];
+        }
+        received_count++;
+      }, payload, size );
+  }
+
+  for( Core c = 1; c < cores(); ++c ) {
+    while( delegate::read( make_global( &received_count, c ) ) == 0 ) {
+      Grappa::yield();
+    }
+    BOOST_CHECK_EQUAL( delegate::read( make_global( &received_count, c ) ), 1 );
+    BOOST_CHECK_EQUAL( delegate::read( make_global( &received_sum, c ) ), expected );
+  }
+
+  locale_free( payload );
+}
+
+void check_private_payloads( size_t size ) {
+  BOOST_MESSAGE( "private payloads of " << size << " bytes" );
+
+  // payloads outside locale shared memory aren't in the window and
+  // aren't mapped by other local cores, so they must never be pulled
+  std::vector< int64_t > vec( size / sizeof(int64_t) );
+  int64_t * heap = new int64_t[ size / sizeof(int64_t) ];
+  void * mallocd = malloc( size );
+  for( Core c = 0; c < cores(); ++c ) {
+    BOOST_CHECK( !impl::global_rendezvous.use_for( c, vec.data(), size ) );
+    BOOST_CHECK( !impl::global_rendezvous.use_for( c, heap, size ) );
+    BOOST_CHECK( !impl::global_rendezvous.use_for( c, mallocd, size ) );
+  }
+  free( mallocd );
+  delete [] heap;
+
+  // while the same size from locale shared memory is
+  int64_t * shared = locale_alloc< int64_t >( size / sizeof(int64_t) );
+  for( Core c = 1; c < cores(); ++c ) {
+    if( locale_of( c ) == mylocale() ) {
+      BOOST_CHECK( impl::global_rendezvous.use_for( c, shared, size ) );
+    }
+  }
+  // a range that runs off the end of the segment is not
+  char * end = static_cast< char * >( impl::locale_shared_memory.get_base_address() )
+    + impl::locale_shared_memory.get_size();
+  BOOST_CHECK( !impl::global_rendezvous.use_for( 1, end - size / 2, size ) );
+  locale_free( shared );
+}
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  Grappa::init( GRAPPA_TEST_ARGS );
+  Grappa::run([]{
+    on_all_cores( []{ FLAGS_rendezvous_threshold = 1 << 12; } );
+
+    check_payloads( 1 << 8 );   // copied into aggregation buffers
+    check_payloads( 1 << 16 );  // pulled by the receiver
+    check_payloads( 1 << 20 );
+
+    check_private_payloads( 1 << 16 );
+
+    Metrics::merge_and_dump_to_file();
+  });
+  Grappa::finalize();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "GlobalAllocator.hpp"
+#include "Collective.hpp"
+#include "Barrier.hpp"
+#include "Delegate.hpp"
+#include "LocaleSharedMemory.hpp"
+#include "Metrics.hpp"
+
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, replica_reads);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, replica_hits);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, replica_blocks_fetched);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, replica_bytes_fetched);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, replica_bytes_allocated);
+
+namespace Grappa {
+
+/// @addtogroup Containers
+/// @{
+
+namespace impl {
+  /// one block of global memory, as returned by a delegate call
+  struct ReplicaBlock {
+    char data[ BLOCK_SIZE ];
+  };
+}
+
+/// Read-only replica of a linear global array, shared by the cores of
+/// each locale. Blocks are copied into locale shared memory the first
+/// time any core in the locale touches them, after which reads are
+/// plain loads. The array must not be written while it is replicated;
+/// nothing checks this.
+///
+/// Create with replicate() and read through the symmetric address:
+/// @code
+///   auto r = replicate(table, n);
+///   forall(keys, nkeys, [r](int64_t& k){ k = r->read(k); });
+///   r->destroy();
+/// @endcode
+template< typename T >
+class Replica {
+protected:
+  enum : uint8_t { ABSENT = 0, FETCHING = 1, PRESENT = 2 };
+
+  GlobalAddress<Replica> self;
+  GlobalAddress<T> base;
+  size_t n;
+
+  /// start of the block containing base[0]
+  GlobalAddress<char> first_block;
+  size_t nblocks;
+
+  /// shared by all cores in the locale; allocated by its first core
+  char * copy;
+  volatile uint8_t * state;
+
+  Replica( GlobalAddress<Replica> self, GlobalAddress<T> base, size_t n )
+    : self(self), base(base), n(n)
+    , first_block( base.block_min().first_byte() )
+    , nblocks( ( (base + n).first_byte() - first_block + block_size - 1 ) / block_size )
+    , copy(nullptr), state(nullptr)
+  { }
+
+  /// make sure a block is in this locale's copy
+  void fetch( size_t b ) {
+    if( state[b] == PRESENT ) return;
+
+    if( __sync_bool_compare_and_swap( &state[b], ABSENT, FETCHING ) ) {
+      auto block = first_block + b * block_size;
+      auto data = delegate::call( block.core(), [block]() -> impl::ReplicaBlock {
+        impl::ReplicaBlock r;
+        ::memcpy( r.data, block.pointer(), block_size );
+        return r;
+      });
+      ::memcpy( copy + b * block_size, data.data, block_size );
+      replica_blocks_fetched++;
+      replica_bytes_fetched += block_size;
+      __sync_synchronize();
+      state[b] = PRESENT;
+    } else {
+      // another task in this locale is fetching it
+      while( state[b] != PRESENT ) Grappa::yield();
+    }
+  }
+
+public:
+  // for static construction
+  Replica() {}
+
+  static GlobalAddress<Replica> create( GlobalAddress<T> base, size_t n ) {
+    CHECK( base.is_linear() ) << "only linear global arrays can be replicated";
+    auto self = symmetric_global_alloc<Replica>();
+    on_all_cores([self,base,n]{
+      auto r = new (self.localize()) Replica(self, base, n);
+      if( locale_mycore() == 0 ) {
+        r->copy = locale_alloc_aligned<char>( block_size, r->nblocks * block_size );
+        r->state = locale_alloc<uint8_t>( r->nblocks );
+        ::memset( const_cast<uint8_t*>( r->state ), ABSENT, r->nblocks );
+        replica_bytes_allocated += r->nblocks * block_size;
+      }
+      barrier();
+      if( locale_mycore() != 0 ) {
+        auto leader = mylocale() * locale_cores();
+        r->copy = delegate::call( leader, [self]{ return self->copy; } );
+        r->state = delegate::call( leader, [self]{ return self->state; } );
+      }
+    });
+    return self;
+  }
+
+  /// Read element i. The first read of each block in a locale costs a
+  /// delegate call to its home; after that it is a local load.
+  T read( size_t i ) {
+    DCHECK_LT( i, n );
+    replica_reads++;
+    size_t first = ( (base + i).first_byte() - first_block );
+    size_t last = first + sizeof(T) - 1;
+    bool hit = true;
+    for( size_t b = first / block_size; b <= last / block_size; ++b ) {
+      if( state[b] != PRESENT ) {
+        hit = false;
+        fetch( b );
+      }
+    }
+    if( hit ) replica_hits++;
+    T result;
+    ::memcpy( &result, copy + first, sizeof(T) );
+    return result;
+  }
+
+  T operator[]( size_t i ) { return read(i); }
+
+  GlobalAddress<T> begin() const { return base; }
+  size_t size() const { return n; }
+
+  /// Drop every locale's copy, so the array may be written again.
+  void destroy() {
+    auto self = this->self;
+    call_on_all_cores([self]{
+      if( locale_mycore() == 0 ) {
+        locale_free( self->copy );
+        locale_free( const_cast<uint8_t*>( self->state ) );
+      }
+      self->~Replica();
+    });
+    global_free( self );
+  }
+
+} GRAPPA_BLOCK_ALIGNED;
+
+/// Mark a linear global array read-only and replicate it lazily in
+/// each locale. See Replica.
+template< typename T >
+GlobalAddress< Replica<T> > replicate( GlobalAddress<T> base, size_t n ) {
+  return Replica<T>::create( base, n );
+}
+
+/// @}
+
+} // namespace Grappa
@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+/// Tests for read-only replicas of global arrays
+
+#include <boost/test/unit_test.hpp>
+#include "Grappa.hpp"
+#include "ParallelLoop.hpp"
+#include "GlobalAllocator.hpp"
+#include "Replica.hpp"
+#include "Metrics.hpp"
+
+using namespace Grappa;
+
+BOOST_AUTO_TEST_SUITE( Replica_tests );
+
+DEFINE_int64(nelems, 1000, "number of elements in test array");
+
+struct Triple {
+  int64_t a, b, c;
+};
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  Grappa::init( GRAPPA_TEST_ARGS );
+  Grappa::run([]{
+    const int64_t N = FLAGS_nelems;
+
+    auto xs = global_alloc<int64_t>(N);
+    forall(xs, N, [](int64_t i, int64_t& x){ x = 3*i; });
+
+    auto r = replicate(xs, N);
+    BOOST_CHECK_EQUAL( r->size(), N );
+
+    // read every element from every core, twice; the second pass
+    // should all be hits
+    on_all_cores([r,N]{
+      for( int pass = 0; pass < 2; ++pass ) {
+        for( int64_t i = 0; i < N; ++i ) {
+          BOOST_CHECK_EQUAL( r->read(i), 3*i );
+        }
+      }
+    });
+
+    uint64_t fetched = sum_all_cores([]{ return replica_blocks_fetched.value(); });
+    // each locale fetches each block at most once
+    BOOST_CHECK_LE( fetched, locales() * ( N * sizeof(int64_t) / block_size + 2 ) );
+    r->destroy();
+
+    // elements that straddle blocks
+    auto ts = global_alloc<Triple>(N);
+    forall(ts, N, [](int64_t i, Triple& t){ t.a = i; t.b = 2*i; t.c = 3*i; });
+    auto rt = replicate(ts, N);
+    forall(0, N, [rt](int64_t i){
+      Triple t = rt->read(i);
+      BOOST_CHECK_EQUAL( t.a, i );
+      BOOST_CHECK_EQUAL( t.b, 2*i );
+      BOOST_CHECK_EQUAL( t.c, 3*i );
+    });
+    rt->destroy();
+
+    global_free(xs);
+    global_free(ts);
+    Metrics::merge_and_print();
+  });
+  Grappa::finalize();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
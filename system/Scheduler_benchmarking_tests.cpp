@@ -86,6 +86,77 @@ BOOST_AUTO_TEST_CASE( test1 ) {
     // average time per context switch
     BOOST_MESSAGE( (runtime / iters) * BILLION << " ns / switch" );
 
+    // check that the adaptive active worker limit stays within its
+    // bounds, shrinks when delegate latency climbs while workers wait
+    // to run, and grows when the core idles with every allowed worker
+    // busy and tasks waiting
+    {
+      BOOST_MESSAGE( "testing adaptive active worker limit" );
+      auto& sched = Grappa::impl::global_scheduler;
+      const uint64_t saved_min = FLAGS_adaptive_workers_min;
+      const uint64_t saved_max = FLAGS_adaptive_workers_max;
+      const uint64_t min_workers = 4;
+      const uint64_t max_workers = 12;
+      FLAGS_adaptive_workers_min = min_workers;
+      FLAGS_adaptive_workers_max = max_workers;
+      sched.allow_active_workers( -1 );
+
+      // drive the controller with our own clock, with intervals long
+      // enough that real idle time between calls doesn't matter
+      const Grappa::Timestamp interval = 1L << 40;
+      Grappa::Timestamp ts = Grappa::force_tick();
+      auto adapt = [&] {
+        ts += interval;
+        sched.adapt_active_workers( ts );
+        uint64_t limit = sched.max_allowed_active();
+        BOOST_CHECK_GE( limit, min_workers );
+        BOOST_CHECK_LE( limit, max_workers );
+        return limit;
+      };
+      sched.adapt_active_workers( ts );  // (first call only takes samples)
+      adapt();
+
+      // keep more tasks than the limit allows busy yielding, so
+      // workers are always waiting in the ready queue and tasks are
+      // waiting for workers
+      bool done = false;
+      const int64_t n = 2 * max_workers;
+      Grappa::CompletionEvent ce( n );
+      for( int64_t i = 0; i < n; ++i ) {
+        Grappa::spawn( [&done,&ce] {
+            while( !done ) Grappa::yield();
+            ce.complete();
+          } );
+      }
+      for( int64_t i = 0; i < 4 * n; ++i ) Grappa::yield();
+
+      // set the best latency seen, then report much worse
+      delegate_roundtrip_latency += 100.0;
+      uint64_t previous = adapt();
+      for( int i = 0; i < 32; ++i ) {
+        delegate_roundtrip_latency += 1000.0;
+        uint64_t limit = adapt();
+        BOOST_CHECK_LE( limit, previous );
+        previous = limit;
+      }
+      BOOST_CHECK_EQUAL( previous, min_workers );
+
+      // now spend half of each interval idle
+      for( int i = 0; i < 32; ++i ) {
+        *(sched.stats.state_timers[ Grappa::impl::TaskingScheduler::TaskingSchedulerMetrics::StateIdle ]) += interval / 2;
+        uint64_t limit = adapt();
+        BOOST_CHECK_GE( limit, previous );
+        previous = limit;
+      }
+      BOOST_CHECK_EQUAL( previous, max_workers );
+
+      done = true;
+      ce.wait();
+      FLAGS_adaptive_workers_min = saved_min;
+      FLAGS_adaptive_workers_max = saved_max;
+      sched.allow_active_workers( -1 );
+    }
+
     BOOST_MESSAGE( "user main is exiting" );
   });
   Grappa::finalize();
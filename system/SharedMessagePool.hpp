@@ -92,4 +92,15 @@ inline PayloadMessage<T> * send_heap_message(Core dest, T t, void * payload, siz
   return m;
 }
 
+/// Same as send_heap_message, but sent ahead of bulk traffic. Use for
+/// small latency-critical messages like completions and steal requests.
+template< typename T >
+inline Message<T> * send_urgent_heap_message(Core dest, T t) {
+  auto *m = new (SharedMessagePool::alloc(sizeof(Message<T>))) Message<T>(dest, t);
+  m->delete_after_send();
+  m->mark_urgent();
+  m->enqueue();
+  return m;
+}
+
 } // namespace Grappa
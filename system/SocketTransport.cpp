@@ -0,0 +1,500 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "SocketTransport.hpp"
+#include "Communicator.hpp"
+
+namespace Grappa {
+namespace impl {
+
+/// address of a core's listening socket, exchanged at startup
+struct SocketAddress {
+  char host[ 256 ];
+  int32_t port;
+};
+
+static void write_fully( int fd, const void * buf, size_t size ) {
+  const char * p = static_cast< const char * >( buf );
+  while( size > 0 ) {
+    ssize_t n = write( fd, p, size );
+    if( n < 0 && errno == EINTR ) continue;
+    PCHECK( n > 0 ) << "Socket write failed";
+    p += n;
+    size -= n;
+  }
+}
+
+static void read_fully( int fd, void * buf, size_t size ) {
+  char * p = static_cast< char * >( buf );
+  while( size > 0 ) {
+    ssize_t n = read( fd, p, size );
+    if( n < 0 && errno == EINTR ) continue;
+    PCHECK( n > 0 ) << "Socket read failed";
+    p += n;
+    size -= n;
+  }
+}
+
+static int connect_to( const SocketAddress& address ) {
+  struct addrinfo hints;
+  struct addrinfo * result = NULL;
+  memset( &hints, 0, sizeof(hints) );
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port[ 16 ];
+  snprintf( port, sizeof(port), "%d", address.port );
+  int err = getaddrinfo( address.host, port, &hints, &result );
+  CHECK_EQ( err, 0 ) << "Couldn't resolve " << address.host << ": " << gai_strerror( err );
+
+  int fd = -1;
+  for( struct addrinfo * rp = result; rp != NULL; rp = rp->ai_next ) {
+    fd = socket( rp->ai_family, rp->ai_socktype, rp->ai_protocol );
+    if( fd < 0 ) continue;
+    if( 0 == connect( fd, rp->ai_addr, rp->ai_addrlen ) ) break;
+    close( fd );
+    fd = -1;
+  }
+  freeaddrinfo( result );
+  PCHECK( fd >= 0 ) << "Couldn't connect to " << address.host << ":" << address.port;
+  return fd;
+}
+
+static void set_nonblocking( int fd ) {
+  int flags = fcntl( fd, F_GETFL, 0 );
+  PCHECK( flags >= 0 );
+  PCHECK( 0 == fcntl( fd, F_SETFL, flags | O_NONBLOCK ) );
+}
+
+/// completions are recorded in the context itself
+static inline void complete( CommunicatorContext * c, int source, int tag, int size ) {
+  c->transport_status.source = source;
+  c->transport_status.tag = tag;
+  c->transport_status.size = size;
+  c->transport_done = true;
+}
+
+/// take the completion recorded in c, if any
+static inline bool test( CommunicatorContext * c, TransportStatus * status ) {
+  if( !c->transport_done ) return false;
+  *status = c->transport_status;
+  c->transport_done = false;
+  return true;
+}
+
+
+SocketTransport::SocketTransport()
+  : mycore_( -1 )
+  , cores_( -1 )
+  , listen_fd_( -1 )
+  , connections_()
+  , pollfds_()
+  , posted_receives_()
+  , unexpected_()
+  , barrier_arrivals_( 0 )
+  , barrier_releases_( 0 )
+  , barrier_notified_( false )
+{ }
+
+void SocketTransport::init( Communicator * communicator ) {
+  mycore_ = communicator->mycore;
+  cores_ = communicator->cores;
+
+  Connection blank;
+  blank.send_fd = -1;
+  blank.receive_fd = -1;
+  blank.header_received = 0;
+  blank.target = NULL;
+  blank.unexpected = NULL;
+  blank.body_received = 0;
+  connections_.assign( cores_, blank );
+
+  // listen on any port
+  listen_fd_ = socket( AF_INET, SOCK_STREAM, 0 );
+  PCHECK( listen_fd_ >= 0 ) << "Couldn't create listening socket";
+  int one = 1;
+  setsockopt( listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_ANY );
+  addr.sin_port = 0;
+  PCHECK( 0 == bind( listen_fd_, reinterpret_cast< struct sockaddr * >( &addr ), sizeof(addr) ) );
+  PCHECK( 0 == listen( listen_fd_, cores_ ) );
+
+  socklen_t addr_size = sizeof(addr);
+  PCHECK( 0 == getsockname( listen_fd_, reinterpret_cast< struct sockaddr * >( &addr ), &addr_size ) );
+
+  // exchange addresses
+  SocketAddress mine;
+  memset( &mine, 0, sizeof(mine) );
+  PCHECK( 0 == gethostname( mine.host, sizeof(mine.host) - 1 ) );
+  mine.port = ntohs( addr.sin_port );
+
+  std::vector< SocketAddress > addresses( cores_ );
+  MPI_CHECK( MPI_Allgather( &mine, sizeof(SocketAddress), MPI_BYTE,
+                            &addresses[0], sizeof(SocketAddress), MPI_BYTE,
+                            communicator->grappa_comm ) );
+
+  // connect to lower-numbered cores; these land in their listen backlog
+  for( int c = 0; c < mycore_; ++c ) {
+    int fd = connect_to( addresses[c] );
+    int32_t me = mycore_;
+    write_fully( fd, &me, sizeof(me) );
+    connections_[c].send_fd = fd;
+    connections_[c].receive_fd = fd;
+  }
+
+  // accept connections from higher-numbered cores
+  for( int i = mycore_ + 1; i < cores_; ++i ) {
+    int fd = accept( listen_fd_, NULL, NULL );
+    PCHECK( fd >= 0 ) << "Accept failed";
+    int32_t peer = -1;
+    read_fully( fd, &peer, sizeof(peer) );
+    CHECK( peer > mycore_ && peer < cores_ ) << "Unexpected connection from core " << peer;
+    connections_[peer].send_fd = fd;
+    connections_[peer].receive_fd = fd;
+  }
+  close( listen_fd_ );
+  listen_fd_ = -1;
+
+  // sends to self go through a socketpair
+  int sv[2];
+  PCHECK( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) );
+  connections_[mycore_].send_fd = sv[0];
+  connections_[mycore_].receive_fd = sv[1];
+
+  pollfds_.resize( cores_ );
+  for( int c = 0; c < cores_; ++c ) {
+    set_nonblocking( connections_[c].send_fd );
+    if( connections_[c].receive_fd != connections_[c].send_fd ) {
+      set_nonblocking( connections_[c].receive_fd );
+    } else {
+      setsockopt( connections_[c].send_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+    }
+    pollfds_[c].fd = connections_[c].receive_fd;
+    pollfds_[c].events = POLLIN;
+    pollfds_[c].revents = 0;
+  }
+
+  DVLOG(2) << "Socket transport on " << mine.host << ":" << mine.port << " connected to " << cores_ << " cores";
+
+  MPI_CHECK( MPI_Barrier( communicator->grappa_comm ) );
+}
+
+void SocketTransport::finish() {
+  for( int c = 0; c < cores_; ++c ) {
+    if( connections_[c].receive_fd != connections_[c].send_fd ) {
+      close( connections_[c].receive_fd );
+    }
+    close( connections_[c].send_fd );
+    if( connections_[c].unexpected ) free( connections_[c].unexpected );
+  }
+  for( auto& u : unexpected_ ) {
+    free( u.buf );
+  }
+  unexpected_.clear();
+  connections_.clear();
+  pollfds_.clear();
+}
+
+
+void SocketTransport::progress_sends( int dest ) {
+  Connection& conn = connections_[dest];
+  while( !conn.sends.empty() ) {
+    PendingSend& s = conn.sends.front();
+    const size_t body_size = s.header.size;
+    const size_t total = sizeof(Header) + body_size;
+
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if( s.sent < sizeof(Header) ) {
+      iov[iovcnt].iov_base = reinterpret_cast< char * >( &s.header ) + s.sent;
+      iov[iovcnt].iov_len = sizeof(Header) - s.sent;
+      iovcnt++;
+      if( body_size > 0 ) {
+        iov[iovcnt].iov_base = s.c->buf;
+        iov[iovcnt].iov_len = body_size;
+        iovcnt++;
+      }
+    } else {
+      size_t offset = s.sent - sizeof(Header);
+      iov[iovcnt].iov_base = static_cast< char * >( s.c->buf ) + offset;
+      iov[iovcnt].iov_len = body_size - offset;
+      iovcnt++;
+    }
+
+    ssize_t n = writev( conn.send_fd, iov, iovcnt );
+    if( n < 0 ) {
+      if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) return;
+      PLOG(FATAL) << "Socket send to core " << dest << " failed";
+    }
+
+    s.sent += n;
+    if( s.sent < total ) return; // socket buffer is full; try again later
+
+    if( s.c ) {
+      complete( s.c, dest, s.header.tag, s.header.size );
+    }
+    conn.sends.pop_front();
+  }
+}
+
+void SocketTransport::header_complete( int source ) {
+  Connection& conn = connections_[source];
+
+  if( conn.header.tag == barrier_tag ) {
+    if( mycore_ == 0 ) {
+      barrier_arrivals_++;
+    } else {
+      barrier_releases_++;
+    }
+    conn.header_received = 0;
+    return;
+  }
+
+  conn.body_received = 0;
+  if( !posted_receives_.empty() ) {
+    conn.target = posted_receives_.front();
+    posted_receives_.pop_front();
+    CHECK_LE( conn.header.size, conn.target->size ) << "Received buffer too large for receive context";
+  } else {
+    conn.unexpected = static_cast< char * >( malloc( std::max< int32_t >( conn.header.size, 1 ) ) );
+    CHECK_NOTNULL( conn.unexpected );
+  }
+
+  if( conn.header.size == 0 ) {
+    body_complete( source );
+  }
+}
+
+void SocketTransport::body_complete( int source ) {
+  Connection& conn = connections_[source];
+  if( conn.target ) {
+    complete( conn.target, source, conn.header.tag, conn.header.size );
+  } else {
+    Unexpected u = { source, conn.header, conn.unexpected };
+    unexpected_.push_back( u );
+  }
+  conn.target = NULL;
+  conn.unexpected = NULL;
+  conn.header_received = 0;
+  conn.body_received = 0;
+}
+
+void SocketTransport::progress_receive( int source ) {
+  Connection& conn = connections_[source];
+  while( true ) {
+    ssize_t n;
+    if( conn.header_received < sizeof(Header) ) {
+      n = read( conn.receive_fd,
+                reinterpret_cast< char * >( &conn.header ) + conn.header_received,
+                sizeof(Header) - conn.header_received );
+    } else {
+      char * dest = conn.target ? static_cast< char * >( conn.target->buf ) : conn.unexpected;
+      n = read( conn.receive_fd, dest + conn.body_received, conn.header.size - conn.body_received );
+    }
+
+    if( n < 0 ) {
+      if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) return;
+      PLOG(FATAL) << "Socket receive from core " << source << " failed";
+    }
+    if( n == 0 ) {
+      // peers only close their connections after the final barrier
+      LOG(FATAL) << "Core " << source << " closed its connection unexpectedly";
+    }
+
+    if( conn.header_received < sizeof(Header) ) {
+      conn.header_received += n;
+      if( conn.header_received == sizeof(Header) ) {
+        header_complete( source );
+      }
+    } else {
+      conn.body_received += n;
+      if( conn.body_received == conn.header.size ) {
+        body_complete( source );
+      }
+    }
+  }
+}
+
+void SocketTransport::progress() {
+  for( int c = 0; c < cores_; ++c ) {
+    if( !connections_[c].sends.empty() ) {
+      progress_sends( c );
+    }
+  }
+
+  int ready = ::poll( &pollfds_[0], pollfds_.size(), 0 );
+  if( ready < 0 ) {
+    PCHECK( errno == EINTR ) << "Socket poll failed";
+    return;
+  }
+  for( int c = 0; c < cores_ && ready > 0; ++c ) {
+    if( pollfds_[c].revents ) {
+      ready--;
+      progress_receive( c );
+    }
+  }
+}
+
+
+void SocketTransport::post_send( CommunicatorContext * c, int dest, size_t size, int tag ) {
+  DCHECK_GE( dest, 0 );
+  DCHECK_LT( dest, cores_ );
+  c->transport_done = false;
+  PendingSend s;
+  s.c = c;
+  s.header.tag = tag;
+  s.header.size = size;
+  s.sent = 0;
+  connections_[dest].sends.push_back( s );
+  progress_sends( dest );
+}
+
+void SocketTransport::send_control( int dest, int32_t tag ) {
+  PendingSend s;
+  s.c = NULL;
+  s.header.tag = tag;
+  s.header.size = 0;
+  s.sent = 0;
+  connections_[dest].sends.push_back( s );
+  progress_sends( dest );
+}
+
+void SocketTransport::post_receive( CommunicatorContext * c ) {
+  c->transport_done = false;
+  if( !unexpected_.empty() ) {
+    // something already arrived; hand it over right away
+    Unexpected u = unexpected_.front();
+    unexpected_.pop_front();
+    CHECK_LE( u.header.size, c->size ) << "Received buffer too large for receive context";
+    memcpy( c->buf, u.buf, u.header.size );
+    free( u.buf );
+    complete( c, u.source, u.header.tag, u.header.size );
+  } else {
+    posted_receives_.push_back( c );
+  }
+}
+
+bool SocketTransport::test_send( CommunicatorContext * c, TransportStatus * status ) {
+  if( !test( c, status ) ) return false;
+  status->size = c->size;
+  return true;
+}
+
+bool SocketTransport::test_receive( CommunicatorContext * c, TransportStatus * status ) {
+  return test( c, status );
+}
+
+void SocketTransport::cancel( CommunicatorContext * c ) {
+  auto it = std::find( posted_receives_.begin(), posted_receives_.end(), c );
+  if( it != posted_receives_.end() ) posted_receives_.erase( it );
+
+  // sends that haven't started can be dropped; partial sends must finish
+  for( auto& conn : connections_ ) {
+    for( auto s = conn.sends.begin(); s != conn.sends.end(); ++s ) {
+      if( s->c == c && s->sent == 0 ) {
+        conn.sends.erase( s );
+        break;
+      }
+    }
+  }
+
+  c->transport_done = false;
+}
+
+
+void SocketTransport::barrier_notify() {
+  barrier_notified_ = true;
+  if( mycore_ != 0 ) {
+    send_control( 0, barrier_tag );
+  }
+}
+
+bool SocketTransport::barrier_try() {
+  progress();
+  if( !barrier_notified_ ) return false;
+
+  if( mycore_ == 0 ) {
+    if( barrier_arrivals_ >= cores_ - 1 ) {
+      barrier_arrivals_ -= cores_ - 1;
+      for( int c = 1; c < cores_; ++c ) {
+        send_control( c, barrier_tag );
+      }
+      barrier_notified_ = false;
+      return true;
+    }
+  } else if( barrier_releases_ > 0 ) {
+    barrier_releases_--;
+    barrier_notified_ = false;
+    return true;
+  }
+  return false;
+}
+
+void SocketTransport::barrier() {
+  barrier_notify();
+  while( !barrier_try() ) {
+    ;
+  }
+
+  // make sure releases go out before we return, since the caller may
+  // not poll again for a while. everyone else is still in the barrier
+  // reading, so this will drain.
+  if( mycore_ == 0 ) {
+    for( int c = 1; c < cores_; ++c ) {
+      while( !connections_[c].sends.empty() ) {
+        progress();
+      }
+    }
+  }
+}
+
+} // namespace impl
+} // namespace Grappa
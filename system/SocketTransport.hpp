@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <poll.h>
+
+#include "Transport.hpp"
+
+namespace Grappa {
+namespace impl {
+
+/// Transport built on TCP sockets, with one connection per pair of
+/// cores (and a socketpair for sends to self). Each buffer is framed
+/// with a small header carrying its tag and size. Incoming buffers are
+/// read directly into posted receive contexts when one is available,
+/// and into temporary storage otherwise.
+///
+/// MPI is still used to exchange addresses at startup, since it is
+/// what launches the job and sets up core and locale numbering.
+class SocketTransport : public Transport {
+  struct Header {
+    int32_t tag;
+    int32_t size;
+  };
+
+  /// tag for barrier control messages; never matched to a receive
+  static const int32_t barrier_tag = -1;
+
+  struct PendingSend {
+    CommunicatorContext * c;  ///< null for control messages
+    Header header;
+    size_t sent;              ///< bytes written so far, including header
+  };
+
+  struct Connection {
+    int send_fd;
+    int receive_fd;
+
+    std::deque< PendingSend > sends;
+
+    // state of buffer currently being received
+    Header header;
+    size_t header_received;
+    CommunicatorContext * target;  ///< posted receive being filled, if any
+    char * unexpected;             ///< temporary storage otherwise
+    size_t body_received;
+  };
+
+  struct Unexpected {
+    int source;
+    Header header;
+    char * buf;
+  };
+
+  int mycore_;
+  int cores_;
+  int listen_fd_;
+
+  std::vector< Connection > connections_;
+  std::vector< struct pollfd > pollfds_;
+
+  std::deque< CommunicatorContext * > posted_receives_;
+  std::deque< Unexpected > unexpected_;
+
+  // barrier state
+  int64_t barrier_arrivals_;
+  int64_t barrier_releases_;
+  bool barrier_notified_;
+
+  void send_control( int dest, int32_t tag );
+  void progress_sends( int dest );
+  void progress_receive( int source );
+  void header_complete( int source );
+  void body_complete( int source );
+
+public:
+  SocketTransport();
+
+  virtual const char * name() const { return "sockets"; }
+
+  virtual void init( Communicator * communicator );
+  virtual void finish();
+
+  virtual void progress();
+
+  virtual void post_send( CommunicatorContext * c, int dest, size_t size, int tag );
+  virtual void post_receive( CommunicatorContext * c );
+  virtual bool test_send( CommunicatorContext * c, TransportStatus * status );
+  virtual bool test_receive( CommunicatorContext * c, TransportStatus * status );
+  virtual void cancel( CommunicatorContext * c );
+
+  virtual void barrier();
+  virtual void barrier_notify();
+  virtual bool barrier_try();
+};
+
+} // namespace impl
+} // namespace Grappa
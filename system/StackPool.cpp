@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "StackPool.hpp"
+#include "LocaleSharedMemory.hpp"
+#include "Worker.hpp"
+#include "Metrics.hpp"
+
+DEFINE_bool( stack_pool, true, "Carve Worker stacks out of a pooled reservation and recycle them instead of allocating each one" );
+DEFINE_int64( stack_pool_chunk, 64, "Number of stacks to reserve at once when the pool runs dry" );
+DEFINE_int64( stack_pool_warm, 64, "Number of freed stacks to keep committed; colder ones have their pages returned to the system" );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, stack_pool_reserved, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, stack_pool_reused, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, stack_pool_released_cold, 0 );
+
+namespace Grappa {
+namespace impl {
+
+/// global StackPool instance
+StackPool stack_pool;
+
+/// Drop the pages backing a range of locale shared memory, so they
+/// will be zero and uncommitted until touched again.
+static void discard_pages( void * addr, size_t len ) {
+#ifdef MADV_REMOVE
+  // the mapping is shared, so DONTNEED alone would leave the pages in the segment
+  if( 0 == madvise( addr, len, MADV_REMOVE ) ) return;
+#endif
+  if( 0 != madvise( addr, len, MADV_DONTNEED ) ) {
+    DVLOG(3) << "madvise failed on " << addr << "; len=" << len << "; errno=" << errno;
+  }
+}
+
+void StackPool::init( size_t ssize_arg, size_t count ) {
+  CHECK_EQ( ssize_arg % 4096, 0 ) << "stack size must be a multiple of the page size";
+  ssize = ssize_arg;
+  slot_size = ssize + 4096 * 2;
+  reserve( count );
+}
+
+void StackPool::reserve( size_t count ) {
+  size_t bytes = slot_size * count;
+  char * region = static_cast< char * >( locale_shared_memory.allocate_aligned( bytes, 4096 ) );
+  CHECK_NOTNULL( region );
+
+  // this memory may have been used before; don't commit it until a Worker runs on it
+  discard_pages( region, bytes );
+
+#ifdef GUARD_PAGES_ON_STACK
+  // guard pages stay armed for as long as the slot is in the pool
+  for( char * slot = region; slot < region + bytes; slot += slot_size ) {
+    checked_mprotect( slot, 4096, PROT_NONE );
+    checked_mprotect( slot + ssize + 4096, 4096, PROT_NONE );
+  }
+#endif
+
+  next_slot = region;
+  reservation_end = region + bytes;
+  stack_pool_reserved += count;
+  DVLOG(3) << "Reserved " << count << " stacks of " << ssize << " bytes at " << (void*) region;
+}
+
+void StackPool::make_cold( char * base ) {
+  discard_pages( base + 4096, ssize );
+  stack_pool_released_cold++;
+}
+
+void * StackPool::allocate() {
+  if( !free_stacks.empty() ) {
+    char * base = free_stacks.back();
+    free_stacks.pop_back();
+    // warm stacks are always at the back
+    if( warm_count > 0 ) warm_count--;
+    stack_pool_reused++;
+    return base;
+  }
+
+  if( next_slot == reservation_end ) {
+    reserve( FLAGS_stack_pool_chunk );
+  }
+  char * base = next_slot;
+  next_slot += slot_size;
+  return base;
+}
+
+void StackPool::release( void * base ) {
+  free_stacks.push_back( static_cast< char * >( base ) );
+  warm_count++;
+  if( warm_count > static_cast< size_t >( FLAGS_stack_pool_warm ) ) {
+    // the coldest warm stack is just below the warm set
+    make_cold( free_stacks[ free_stacks.size() - warm_count ] );
+    warm_count--;
+  }
+}
+
+} // namespace impl
+} // namespace Grappa
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <gflags/gflags.h>
+#include <vector>
+#include <cstddef>
+
+DECLARE_bool( stack_pool );
+
+namespace Grappa {
+namespace impl {
+
+/// Pool of Worker stacks carved out of large reservations in locale
+/// shared memory. Each slot is a stack with a guard page on either
+/// side. Pages are only committed when a Worker first touches them,
+/// and freed stacks are handed out again most-recently-used first so
+/// their top pages are likely still in cache. Stacks that fall out of
+/// the warm set have their pages returned to the system.
+class StackPool {
+private:
+  /// usable bytes per stack
+  size_t ssize;
+
+  /// bytes per slot, including guard pages
+  size_t slot_size;
+
+  /// next never-used slot in the current reservation, and its end
+  char * next_slot;
+  char * reservation_end;
+
+  /// freed stacks; the back is the most recently used
+  std::vector< char * > free_stacks;
+
+  /// how many freed stacks still hold committed pages
+  size_t warm_count;
+
+  void reserve( size_t count );
+  void make_cold( char * base );
+
+public:
+  StackPool()
+    : ssize( 0 )
+    , slot_size( 0 )
+    , next_slot( NULL )
+    , reservation_end( NULL )
+    , free_stacks()
+    , warm_count( 0 )
+  { }
+
+  /// Set the stack size and reserve space for count stacks up front.
+  void init( size_t ssize, size_t count );
+
+  /// Can this pool provide stacks of this size?
+  bool serves( size_t size ) const { return slot_size != 0 && size == ssize; }
+
+  /// Get a stack; returns the base of the slot, including the bottom guard page.
+  void * allocate();
+
+  /// Return a stack obtained from allocate() to the pool.
+  void release( void * base );
+
+  size_t free_stacks_count() const { return free_stacks.size(); }
+};
+
+/// global StackPool instance
+extern StackPool stack_pool;
+
+} // namespace impl
+} // namespace Grappa
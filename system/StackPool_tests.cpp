@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+
+#include "Grappa.hpp"
+#include "StackPool.hpp"
+
+DECLARE_int64( stack_pool_warm );
+
+BOOST_AUTO_TEST_SUITE( StackPool_tests );
+
+using namespace Grappa;
+
+static const size_t stack_size = 4096 * 4;
+static int probe_pipe[2];
+
+/// Can we read this page? Passing it to write() makes the kernel
+/// report EFAULT instead of us taking a fault.
+bool readable( char * page ) {
+  ssize_t result = write( probe_pipe[1], page, 1 );
+  if( result == 1 ) {
+    char c;
+    CHECK_EQ( read( probe_pipe[0], &c, 1 ), 1 );
+    return true;
+  }
+  CHECK_EQ( errno, EFAULT );
+  return false;
+}
+
+/// Check that a slot's stack is usable and, in builds with guard
+/// pages, that the pages on either side of it are still guarded.
+void check_slot( char * base ) {
+  BOOST_CHECK( readable( base + 4096 ) );
+  BOOST_CHECK( readable( base + stack_size ) );
+#ifdef GUARD_PAGES_ON_STACK
+  BOOST_CHECK( !readable( base ) );
+  BOOST_CHECK( !readable( base + stack_size + 4096 ) );
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  Grappa::init( GRAPPA_TEST_ARGS );
+  Grappa::run([]{
+    CHECK_EQ( pipe( probe_pipe ), 0 );
+
+    impl::StackPool pool;
+    pool.init( stack_size, 4 );
+    BOOST_CHECK( pool.serves( stack_size ) );
+    BOOST_CHECK( !pool.serves( stack_size * 2 ) );
+
+    // take more stacks than the first reservation holds, and use them
+    const int n = 6;
+    char * stacks[ n ];
+    for( int i = 0; i < n; ++i ) {
+      stacks[i] = static_cast< char * >( pool.allocate() );
+      memset( stacks[i] + 4096, i + 1, stack_size );
+      check_slot( stacks[i] );
+    }
+    for( int i = 0; i < n; ++i ) {
+      for( int j = 0; j < i; ++j ) BOOST_CHECK( stacks[i] != stacks[j] );
+    }
+
+    BOOST_MESSAGE( "recycling warm stacks" );
+    for( int i = 0; i < n; ++i ) {
+      pool.release( stacks[i] );
+      check_slot( stacks[i] );
+    }
+    BOOST_CHECK_EQUAL( pool.free_stacks_count(), static_cast< size_t >( n ) );
+
+    // most recently released first, with their contents still there
+    for( int i = n-1; i >= 0; --i ) {
+      char * base = static_cast< char * >( pool.allocate() );
+      BOOST_CHECK_EQUAL( (void*) base, (void*) stacks[i] );
+      BOOST_CHECK_EQUAL( base[ 4096 ], i + 1 );
+      check_slot( base );
+    }
+    BOOST_CHECK_EQUAL( pool.free_stacks_count(), 0 );
+
+    BOOST_MESSAGE( "recycling cold stacks" );
+    const int64_t saved_warm = FLAGS_stack_pool_warm;
+    FLAGS_stack_pool_warm = 2;
+    for( int i = 0; i < n; ++i ) {
+      pool.release( stacks[i] );
+    }
+
+    // the oldest ones had their pages dropped, but kept their guards
+    for( int i = n-1; i >= 0; --i ) {
+      char * base = static_cast< char * >( pool.allocate() );
+      BOOST_CHECK_EQUAL( (void*) base, (void*) stacks[i] );
+      if( i >= n-2 ) BOOST_CHECK_EQUAL( base[ 4096 ], i + 1 );
+      check_slot( base );
+    }
+    FLAGS_stack_pool_warm = saved_warm;
+
+    close( probe_pipe[0] );
+    close( probe_pipe[1] );
+  });
+  Grappa::finalize();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
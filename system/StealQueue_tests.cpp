@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+#include <boost/test/unit_test.hpp>
+
+#include "Grappa.hpp"
+#include "Delegate.hpp"
+#include "CompletionEvent.hpp"
+#include "Collective.hpp"
+#include "tasks/StealQueue.hpp"
+
+DECLARE_string( load_balance );
+DECLARE_int64( steal_queue_size );
+
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, stealq_direct_steals);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, stealq_request_messages);
+
+DEFINE_int64( waves, 256, "Rounds of public tasks spawned on core 0" );
+DEFINE_int64( tasks_per_wave, 32, "Public tasks spawned per round; must fit in the steal queue" );
+
+BOOST_AUTO_TEST_SUITE( StealQueue_tests );
+
+using namespace Grappa;
+
+//
+// Core 0 spawns public tasks in waves while every other core steals.
+// Thieves in core 0's locale take tasks straight out of locale shared
+// memory, except the last, which sends steal requests (as do cores in
+// other locales), so direct and message steals race on the same
+// queues. The queue is small, so its indices wrap around many times.
+//
+
+int64_t * runs;
+uint64_t direct_steals;
+uint64_t steal_requests;
+
+BOOST_AUTO_TEST_CASE( test1 ) {
+  // defaults for this test; the command line can still override them
+  FLAGS_load_balance = "steal";
+  FLAGS_steal_queue_size = 64;
+
+  Grappa::init( GRAPPA_TEST_ARGS );
+  Grappa::run([]{
+    CHECK_LE( 2 * FLAGS_tasks_per_wave, FLAGS_steal_queue_size );
+    on_all_cores([]{
+      FLAGS_steal_locale_direct = locale_cores() <= 2 || locale_mycore() < locale_cores() - 1;
+    });
+
+    const int64_t n = FLAGS_waves * FLAGS_tasks_per_wave;
+    runs = new int64_t[ n ];
+    for( int64_t i = 0; i < n; ++i ) runs[i] = 0;
+
+    for( int64_t w = 0; w < FLAGS_waves; ++w ) {
+      CompletionEvent ce( FLAGS_tasks_per_wave );
+      auto ce_addr = make_global( &ce );
+      for( int64_t t = 0; t < FLAGS_tasks_per_wave; ++t ) {
+        auto run_addr = make_global( &runs[ w * FLAGS_tasks_per_wave + t ] );
+        spawn<unbound>([run_addr, ce_addr]{
+          // give thieves time to find us
+          for( volatile int k = 0; k < 1000; ++k );
+          delegate::fetch_and_add( run_addr, 1 );
+          complete( ce_addr );
+        });
+      }
+      ce.wait();
+    }
+
+    int64_t bad = 0;
+    for( int64_t i = 0; i < n; ++i ) {
+      if( runs[i] != 1 ) bad++;
+    }
+    BOOST_CHECK_EQUAL( bad, 0 );
+
+    on_all_cores([]{
+      direct_steals = stealq_direct_steals.value();
+      steal_requests = stealq_request_messages.value();
+    });
+    uint64_t total_direct = reduce< uint64_t, collective_add >( &direct_steals );
+    uint64_t total_requests = reduce< uint64_t, collective_add >( &steal_requests );
+    BOOST_MESSAGE( "direct steals: " << total_direct << ", steal requests: " << total_requests );
+    BOOST_CHECK( total_direct > 0 );
+    if( locale_cores() > 2 || cores() > locale_cores() ) BOOST_CHECK( total_requests > 0 );
+
+    delete [] runs;
+    Grappa::Metrics::merge_and_print();
+  });
+  Grappa::finalize();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -168,6 +168,9 @@ namespace Grappa {
 
     /// Get the current value
     inline T value() const { return value_; }
+
+    /// Get the number of values recorded
+    inline size_t samples() const { return n; }
     
     // <sugar>
     template<typename U>
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Tasking.hpp"
+#include "Message.hpp"
+#include "Addressing.hpp"
+
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, tasks_spawned_near_local);
+GRAPPA_DECLARE_METRIC(SimpleMetric<uint64_t>, tasks_spawned_near_remote);
+
+namespace Grappa {
+  /// @addtogroup Tasking
+  /// @{
+  
+  namespace impl {
+    /// Spawn a task on this core that stays in this locale.
+    template< TaskMode B, typename TF >
+    void spawn_in_locale( TF tf ) {
+      if (B == TaskMode::Bound) {
+        privateTask(tf);
+      } else {
+        localePublicTask(tf);
+      }
+    }
+  }
+  
+  /// Spawn a task near the data it will touch: on the core that owns
+  /// `hint`. A bound task runs there; an unbound one may only be
+  /// stolen by cores in that locale, so it never moves away from the
+  /// data's memory. If `hint` is remote, the task is carried there in
+  /// a message; otherwise this is as cheap as a regular spawn.
+  ///
+  /// Example:
+  /// @code
+  ///   // update a vertex where it lives instead of with delegates
+  ///   Grappa::spawn_near( vertices+v, [v]{ update( v ); } );
+  ///   Grappa::spawn_near<unbound>( vertices+v, [v]{ update( v ); } );
+  /// @endcode
+  template< TaskMode B = TaskMode::Bound,
+            typename T = decltype(nullptr),
+            typename TF = decltype(nullptr) >
+  void spawn_near( GlobalAddress<T> hint, TF tf ) {
+    Core owner = hint.core();
+    if (owner == mycore()) {
+      tasks_spawned_near_local++;
+      impl::spawn_in_locale<B>(tf);
+    } else {
+      tasks_spawned_near_remote++;
+      send_heap_message(owner, [tf]{
+        impl::spawn_in_locale<B>(tf);
+      });
+    }
+  }
+  
+  /// @}
+} // namespace Grappa
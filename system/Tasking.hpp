@@ -172,6 +172,51 @@ namespace Grappa {
     Grappa::impl::global_task_manager.spawnPublic(Grappa::impl::task_functor_proxy<TF>, args[0], args[1], args[2]);
   }
 
+  /// Spawn a task that may be stolen, but only by cores in this
+  /// locale, so it stays close to data in this locale. The task must
+  /// be 24 bytes or less, as for publicTask().
+  ///
+  /// @see Grappa::spawn_near for usage.
+  template < typename TF >
+  void localePublicTask( TF tf ) {
+    tasks_created++;
+    CHECK_LE( sizeof(tf), 24) << "Functor argument to localePublicTask too large to be automatically coerced.";
+    
+    uint64_t args[3];
+    new (reinterpret_cast<TF*>(&args[0])) TF(tf);
+    Grappa::impl::global_task_manager.spawnLocalePublic(Grappa::impl::task_functor_proxy<TF>, args[0], args[1], args[2]);
+  }
+
+  /// Spawn a continuation: a short task visible to this Core only
+  /// that usually runs to completion without blocking. Continuations
+  /// don't get a Worker each; they wait in a queue and run back to
+  /// back on a shared runner Worker, so an outstanding continuation
+  /// costs a task queue entry rather than a stack. A continuation may
+  /// still block: it then keeps the runner's stack, and a new runner
+  /// takes over the rest of the queue. Storage is handled as in
+  /// privateTask().
+  ///
+  /// Example:
+  /// @code
+  ///   Grappa::spawn_continuation( [&ce] { ce.complete(); } );
+  /// @endcode
+  template < typename TF >
+  void spawn_continuation( TF tf ) {
+    tasks_created++;
+    if( sizeof( tf ) > 24 ) { // if it's too big to fit in a task queue entry
+      DVLOG(4) << "Heap allocated continuation of size " << sizeof(tf);
+      tasks_heap_allocated++;
+      TF * tp = new TF(tf);
+      Grappa::impl::global_scheduler.spawn_continuation(
+        Grappa::impl::createTask( Grappa::impl::task_heapfunctor_proxy<TF>, tp, tp, tp ) );
+    } else {
+      uint64_t args[3];
+      new (reinterpret_cast<TF*>(&args[0])) TF(tf);
+      Grappa::impl::global_scheduler.spawn_continuation(
+        Grappa::impl::createTask( Grappa::impl::task_functor_proxy<TF>, args[0], args[1], args[2] ) );
+    }
+  }
+
   /// @b internal
   template < typename TF >
   void spawn_worker( TF && tf ) {
@@ -38,6 +38,16 @@
 #include "Delegate.hpp"
 #include "CompletionEvent.hpp"
 
+DECLARE_string( load_balance );
+DECLARE_int32( steal_remote_after );
+DECLARE_int32( steal_remote_victims );
+
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, session_steal_successes_ );
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, session_steal_fails_ );
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, local_steal_attempts_ );
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, remote_steal_attempts_ );
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, steal_escalations_ );
+
 BOOST_AUTO_TEST_SUITE( Tasking_tests );
 
 using namespace Grappa;
@@ -116,6 +126,125 @@ BOOST_AUTO_TEST_CASE( test1 ) {
       BOOST_CHECK( array[i] >= 0 );
     }
   
+    BOOST_MESSAGE( "testing continuations" );
+    {
+      const int64_t n = 10000;
+      const int64_t nblocking = 16;
+      int64_t ran = 0;
+      int64_t resumed = 0;
+      CompletionEvent ce( n + nblocking );
+
+      for (int64_t i=0; i<n; i++) {
+        spawn_continuation([&ran,&ce]{
+          ran++;
+          ce.complete();
+        });
+        // a few of them block, and must still finish
+        if ( i % (n/nblocking) == 0 ) {
+          spawn_continuation([&resumed,&ce]{
+            Grappa::yield();
+            resumed++;
+            ce.complete();
+          });
+        }
+      }
+      ce.wait();
+
+      BOOST_CHECK_EQUAL( ran, n );
+      BOOST_CHECK_EQUAL( resumed, nblocking );
+    }
+
+    BOOST_MESSAGE( "testing delayed tasks" );
+    {
+      const int64_t n = 64;
+      CompletionEvent ce( n );
+      int64_t early = 0;
+
+      for (int64_t i=0; i<n; i++) {
+        spawn([i,&early,&ce]{
+          // spread deadlines across several levels of the timer wheel
+          Timestamp ticks = (1L << (i % 24)) + i;
+          Timestamp deadline = Grappa::force_tick() + ticks;
+          Grappa::delay_for( ticks );
+          if ( Grappa::force_tick() < deadline ) early++;
+          ce.complete();
+        });
+      }
+      ce.wait();
+
+      BOOST_CHECK_EQUAL( early, 0 );
+    }
+
+    BOOST_MESSAGE( "testing spawn_near" );
+    {
+      const int64_t n = 16;
+      CompletionEvent ce( 2*n );
+      auto ce_addr = make_global( &ce );
+
+      for (int64_t i=0; i<n; i++) {
+        Core target = i % cores();
+        auto hint = make_global( &num_finished, target );
+        spawn_near( hint, [ce_addr,target]{
+          BOOST_CHECK_EQUAL( mycore(), target );
+          complete( ce_addr );
+        });
+        spawn_near<unbound>( hint, [ce_addr,target]{
+          BOOST_CHECK_EQUAL( locale_of( mycore() ), locale_of( target ) );
+          complete( ce_addr );
+        });
+      }
+      ce.wait();
+    }
+
+    if ( FLAGS_load_balance.compare( "hsteal" ) == 0 ) {
+      BOOST_MESSAGE( "testing hierarchical stealing" );
+      on_all_cores([]{
+        session_steal_successes_ = 0;
+        session_steal_fails_ = 0;
+        local_steal_attempts_ = 0;
+        remote_steal_attempts_ = 0;
+        steal_escalations_ = 0;
+      });
+
+      // give the other cores something to steal from us
+      const int64_t n = 1024;
+      CompletionEvent ce( n );
+      auto ce_addr = make_global( &ce );
+      for (int64_t i=0; i<n; i++) {
+        spawn<unbound>([ce_addr]{
+          for (int j=0; j<8; j++) yield();
+          complete( ce_addr );
+        });
+      }
+      ce.wait();
+
+      on_all_cores([]{
+        uint64_t sessions = session_steal_successes_.value() + session_steal_fails_.value();
+        uint64_t escalations = steal_escalations_.value();
+        uint64_t remote_attempts = remote_steal_attempts_.value();
+        VLOG(1) << "hierarchical stealing: " << sessions << " sessions, "
+                << local_steal_attempts_.value() << " local attempts, "
+                << escalations << " escalations, "
+                << remote_attempts << " remote attempts";
+
+        // each escalation tries only a few remote victims
+        BOOST_CHECK_LE( remote_attempts, escalations * FLAGS_steal_remote_victims );
+
+        // and comes only after --steal_remote_after failed local
+        // sessions in a row (some may have failed before the reset)
+        if ( locale_cores() > 1 ) {
+          BOOST_CHECK_LE( escalations * FLAGS_steal_remote_after,
+                          sessions + FLAGS_steal_remote_after - 1 );
+        }
+
+        // with nowhere else to go, we never leave the locale
+        if ( locales() == 1 ) {
+          BOOST_CHECK_EQUAL( escalations, 0u );
+          BOOST_CHECK_EQUAL( remote_attempts, 0u );
+        }
+      });
+    }
+  
     Metrics::merge_and_print();
   });
   Grappa::finalize();
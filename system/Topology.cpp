@@ -0,0 +1,254 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#include <glog/logging.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "Topology.hpp"
+
+DEFINE_bool( set_affinity, false, "Pin each core's process to its own CPU, physical cores first (see affinity_policy)" );
+DEFINE_string( affinity_policy, "compact", "How to place a locale's cores on sockets: compact (fill a socket first) or scatter (alternate sockets)" );
+DEFINE_bool( numa_bind, true, "When pinned, bind each core's slice of the global heap and its message pools to its NUMA node" );
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, numa_bound_bytes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, numa_bind_failures, 0 );
+
+// bytes of network traffic delivered to cores on each socket; divide
+// by run time for the inbound bandwidth each socket sustained
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, socket0_received_bytes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, socket1_received_bytes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, socket2_received_bytes, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, socket3_received_bytes, 0 );
+
+// no libnuma dependency; these match <numaif.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace Grappa {
+namespace impl {
+
+/// global Topology instance
+Topology topology;
+
+/// parse a sysfs CPU or node list like "0-3,8-11"
+static std::vector< int > parse_list( const std::string& s ) {
+  std::vector< int > result;
+  std::stringstream ss( s );
+  std::string range;
+  while( std::getline( ss, range, ',' ) ) {
+    if( range.empty() || range == "\n" ) continue;
+    int first = 0, last = 0;
+    if( 2 == sscanf( range.c_str(), "%d-%d", &first, &last ) ) {
+      for( int i = first; i <= last; ++i ) result.push_back( i );
+    } else if( 1 == sscanf( range.c_str(), "%d", &first ) ) {
+      result.push_back( first );
+    }
+  }
+  return result;
+}
+
+static bool read_line( const std::string& path, std::string * line ) {
+  std::ifstream in( path.c_str() );
+  return static_cast< bool >( std::getline( in, *line ) );
+}
+
+static int read_int( const std::string& path, int otherwise ) {
+  std::string line;
+  if( !read_line( path, &line ) ) return otherwise;
+  return atoi( line.c_str() );
+}
+
+void Topology::discover_sysfs() {
+  std::string online;
+  CHECK( read_line( "/sys/devices/system/cpu/online", &online ) );
+
+  for( int cpu : parse_list( online ) ) {
+    std::stringstream dir;
+    dir << "/sys/devices/system/cpu/cpu" << cpu << "/topology/";
+    CPU c;
+    c.cpu = cpu;
+    c.socket = std::max( 0, read_int( dir.str() + "physical_package_id", 0 ) );
+    c.core = read_int( dir.str() + "core_id", cpu );
+    c.node = 0;
+    placement.push_back( c );
+  }
+
+  // find each CPU's NUMA node, if the kernel has NUMA support
+  num_nodes = 1;
+  if( DIR * d = opendir( "/sys/devices/system/node" ) ) {
+    while( struct dirent * e = readdir( d ) ) {
+      int node = 0;
+      if( 1 != sscanf( e->d_name, "node%d", &node ) ) continue;
+      num_nodes = std::max( num_nodes, node + 1 );
+      std::string cpulist;
+      if( !read_line( std::string("/sys/devices/system/node/") + e->d_name + "/cpulist", &cpulist ) ) continue;
+      for( int cpu : parse_list( cpulist ) ) {
+        for( auto& c : placement ) {
+          if( c.cpu == cpu ) c.node = node;
+        }
+      }
+    }
+    closedir( d );
+  }
+}
+
+void Topology::discover_fallback() {
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  for( long cpu = 0; cpu < std::max( 1L, n ); ++cpu ) {
+    CPU c = { static_cast< int >( cpu ), 0, static_cast< int >( cpu ), 0 };
+    placement.push_back( c );
+  }
+  num_nodes = 1;
+}
+
+void Topology::order_placement() {
+  std::set< int > socket_ids;
+  for( auto& c : placement ) socket_ids.insert( c.socket );
+  num_sockets = socket_ids.size();
+
+  // physical cores first: the first thread of each (socket, core) pair
+  // gets rank 0, its first sibling rank 1, and so on
+  std::sort( placement.begin(), placement.end(), []( const CPU& a, const CPU& b ) {
+      return a.socket != b.socket ? a.socket < b.socket
+        : a.core != b.core ? a.core < b.core
+        : a.cpu < b.cpu;
+    });
+  std::vector< int > thread_rank( placement.size(), 0 );
+  for( size_t i = 1; i < placement.size(); ++i ) {
+    if( placement[i].socket == placement[i-1].socket && placement[i].core == placement[i-1].core ) {
+      thread_rank[i] = thread_rank[i-1] + 1;
+    }
+  }
+
+  // within each thread rank, compact keeps sockets together and
+  // scatter deals cores out to sockets in turn
+  bool scatter = ( FLAGS_affinity_policy == "scatter" );
+  CHECK( scatter || FLAGS_affinity_policy == "compact" ) << "unknown affinity_policy " << FLAGS_affinity_policy;
+  std::vector< std::pair< std::vector< int64_t >, CPU > > keyed;
+  for( size_t i = 0; i < placement.size(); ++i ) {
+    int count = 0;
+    for( size_t j = 0; j < i; ++j ) {
+      if( placement[j].socket == placement[i].socket && thread_rank[j] == thread_rank[i] ) count++;
+    }
+    std::vector< int64_t > key = scatter
+      ? std::vector< int64_t >{ thread_rank[i], count, placement[i].socket }
+      : std::vector< int64_t >{ thread_rank[i], placement[i].socket, count };
+    keyed.push_back( std::make_pair( key, placement[i] ) );
+  }
+  std::stable_sort( keyed.begin(), keyed.end(), []( const std::pair< std::vector< int64_t >, CPU >& a,
+                                                     const std::pair< std::vector< int64_t >, CPU >& b ) {
+                      return a.first < b.first;
+                    });
+  for( size_t i = 0; i < keyed.size(); ++i ) placement[i] = keyed[i].second;
+}
+
+void Topology::discover() {
+  placement.clear();
+  std::string line;
+  if( read_line( "/sys/devices/system/cpu/online", &line ) ) {
+    discover_sysfs();
+  } else {
+    discover_fallback();
+  }
+  order_placement();
+  VLOG(2) << "Found " << placement.size() << " CPUs on "
+          << num_sockets << " sockets and " << num_nodes << " NUMA nodes";
+}
+
+void Topology::pin( Core locale_core ) {
+  const CPU& c = cpu_for( locale_core );
+  if( static_cast< size_t >( Grappa::locale_cores() ) > placement.size() && locale_core == 0 ) {
+    LOG(WARNING) << "More cores than CPUs in locale; some CPUs will be shared";
+  }
+#ifdef CPU_SET
+  cpu_set_t mask;
+  CPU_ZERO( &mask );
+  CPU_SET( c.cpu, &mask );
+  if( 0 != sched_setaffinity( 0, sizeof(mask), &mask ) ) {
+    LOG(WARNING) << "Couldn't pin core " << Grappa::mycore() << " to CPU " << c.cpu << "; errno=" << errno;
+    return;
+  }
+#endif
+  my_cpu = c.cpu;
+  my_socket = c.socket;
+  my_node = c.node;
+
+  // socket ids aren't always dense, so count this core under its position among sockets
+  std::set< int > lower;
+  for( auto& other : placement ) if( other.socket < c.socket ) lower.insert( other.socket );
+  int socket_index = lower.size();
+
+  SimpleMetric<uint64_t> * per_socket[ max_sockets ] = {
+    &socket0_received_bytes, &socket1_received_bytes,
+    &socket2_received_bytes, &socket3_received_bytes };
+  my_socket_received_bytes = per_socket[ std::min( socket_index, max_sockets - 1 ) ];
+
+  VLOG(2) << "Core " << Grappa::mycore() << " pinned to CPU " << c.cpu
+          << " (socket " << c.socket << ", core " << c.core << ", node " << c.node << ")";
+}
+
+void Topology::bind_local( void * addr, size_t size ) {
+  if( !FLAGS_numa_bind || my_node < 0 || num_nodes < 2 ) return;
+  CHECK_LT( my_node, 64 ) << "only 64 NUMA nodes supported";
+#if defined(__linux__) && defined(SYS_mbind)
+  // only whole pages can be bound; leave partial ones at the ends to first touch
+  const uintptr_t page = 4096;
+  uintptr_t start = ( reinterpret_cast< uintptr_t >( addr ) + page - 1 ) & ~( page - 1 );
+  uintptr_t end = ( reinterpret_cast< uintptr_t >( addr ) + size ) & ~( page - 1 );
+  if( end <= start ) return;
+
+  unsigned long mask = 1UL << my_node;
+  long rc = syscall( SYS_mbind, start, end - start, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0 );
+  if( rc != 0 ) {
+    numa_bind_failures++;
+    DVLOG(3) << "mbind of " << (void*) start << " to node " << my_node << " failed; errno=" << errno;
+  } else {
+    numa_bound_bytes += end - start;
+  }
+#endif
+}
+
+} // namespace impl
+} // namespace Grappa
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <gflags/gflags.h>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "Communicator.hpp"
+#include "Metrics.hpp"
+
+DECLARE_bool( set_affinity );
+DECLARE_bool( numa_bind );
+
+namespace Grappa {
+namespace impl {
+
+/// Processors and NUMA nodes of this machine, read from sysfs, and
+/// where this core's process runs and keeps its memory.
+///
+/// Cores in a locale are placed on physical cores first, one per
+/// core_id, before any hyperthread siblings are used. With the
+/// compact policy consecutive locale cores fill one socket before
+/// moving to the next; with scatter they alternate between sockets.
+class Topology {
+public:
+  static const int max_sockets = 4;
+
+  struct CPU {
+    int cpu;
+    int socket;
+    int core;
+    int node;
+  };
+
+private:
+  /// online CPUs, in the order locale cores are placed on them
+  std::vector< CPU > placement;
+
+  int num_sockets;
+  int num_nodes;
+
+  /// where this core was pinned; -1 if it wasn't
+  int my_cpu;
+  int my_socket;
+  int my_node;
+
+  SimpleMetric<uint64_t> * my_socket_received_bytes;
+
+  void discover_sysfs();
+  void discover_fallback();
+  void order_placement();
+
+public:
+  Topology()
+    : placement()
+    , num_sockets( 1 )
+    , num_nodes( 1 )
+    , my_cpu( -1 )
+    , my_socket( 0 )
+    , my_node( -1 )
+    , my_socket_received_bytes( NULL )
+  { }
+
+  /// Read the machine's layout. Call once, before pinning.
+  void discover();
+
+  /// Pin this process to the CPU chosen for this locale core.
+  void pin( Core locale_core );
+
+  /// Ask the kernel to put the pages of a region on this core's NUMA
+  /// node. Must be called before the region is first touched to
+  /// have any effect; does nothing unless this core is pinned.
+  void bind_local( void * addr, size_t size );
+
+  /// CPU this core runs on in the placement, for any core in the locale
+  const CPU& cpu_for( Core locale_core ) const {
+    return placement[ locale_core % placement.size() ];
+  }
+
+  int sockets() const { return num_sockets; }
+  int nodes() const { return num_nodes; }
+  int socket() const { return my_socket; }
+  int node() const { return my_node; }
+
+  /// Count bytes of network traffic delivered to this core's socket.
+  inline void record_received_bytes( size_t bytes ) {
+    if( my_socket_received_bytes ) (*my_socket_received_bytes) += bytes;
+  }
+};
+
+/// global Topology instance
+extern Topology topology;
+
+} // namespace impl
+} // namespace Grappa
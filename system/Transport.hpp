@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+
+/// Abstract point-to-point transport used by Communicator to move
+/// buffers between cores. Communicator owns the pools of
+/// CommunicatorContexts and decides when to post and retire them; a
+/// Transport only moves bytes and reports completion.
+
+struct CommunicatorContext;
+class Communicator;
+
+namespace Grappa {
+namespace impl {
+
+/// Information about a completed operation
+struct TransportStatus {
+  int source;
+  int tag;
+  int size;    ///< bytes received (receives only)
+};
+
+class Transport {
+public:
+  virtual ~Transport() { }
+
+  virtual const char * name() const = 0;
+
+  /// Set up connections. Called at the end of Communicator::init(),
+  /// once job geometry is known.
+  virtual void init( Communicator * communicator ) = 0;
+
+  /// Tear down connections. Called from Communicator::finish().
+  virtual void finish() = 0;
+
+  /// Make progress on outstanding operations. Called before each
+  /// round of completion tests.
+  virtual void progress() { }
+
+  /// Start sending size bytes of c->buf to dest.
+  virtual void post_send( CommunicatorContext * c, int dest, size_t size, int tag ) = 0;
+
+  /// Make c->buf available to receive the next incoming buffer from any source.
+  virtual void post_receive( CommunicatorContext * c ) = 0;
+
+  /// Has the send posted with this context finished?
+  virtual bool test_send( CommunicatorContext * c, TransportStatus * status ) = 0;
+
+  /// Has the receive posted with this context been filled?
+  virtual bool test_receive( CommunicatorContext * c, TransportStatus * status ) = 0;
+
+  /// Abandon an outstanding operation at shutdown.
+  virtual void cancel( CommunicatorContext * c ) = 0;
+
+  /// Blocking barrier across all cores
+  virtual void barrier() = 0;
+
+  /// Two-phase barrier: start...
+  virtual void barrier_notify() = 0;
+  /// ...and check for completion.
+  virtual bool barrier_try() = 0;
+};
+
+/// Construct the transport named by --transport.
+Transport * make_transport();
+
+} // namespace impl
+} // namespace Grappa
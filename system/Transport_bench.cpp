@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+
+/// Point-to-point benchmark for comparing transports. Run it once with
+/// --transport=mpi and once with --transport=sockets (the
+/// bench-transports target does both) and compare the metrics.
+
+#include "Grappa.hpp"
+#include "CompletionEvent.hpp"
+#include "Collective.hpp"
+#include "Delegate.hpp"
+#include "LocaleSharedMemory.hpp"
+#include "Metrics.hpp"
+
+DEFINE_int64( roundtrips, 1 << 14, "Number of blocking delegate round trips timed on core 0" );
+DEFINE_int64( messages, 1 << 16, "Number of messages each core sends to its neighbor" );
+DEFINE_int64( message_bytes, 1024, "Payload size of each message" );
+
+using namespace Grappa;
+
+GRAPPA_DEFINE_METRIC( SimpleMetric<double>, transport_bench_roundtrip_us, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<double>, transport_bench_messages_per_sec, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<double>, transport_bench_bytes_per_sec, 0 );
+
+int main(int argc, char* argv[]) {
+  Grappa::init(&argc, &argv);
+  Grappa::run([]{
+    CHECK_GT( Grappa::cores(), 1 ) << "need at least two cores";
+    LOG(INFO) << "transport: " << global_communicator.transport_name();
+
+    // latency: blocking round trips to the farthest core
+    {
+      Core dest = Grappa::cores() - 1;
+      double start = Grappa::walltime();
+      for( int64_t i = 0; i < FLAGS_roundtrips; ++i ) {
+        delegate::call( dest, []{} );
+      }
+      double runtime = Grappa::walltime() - start;
+      transport_bench_roundtrip_us = runtime / FLAGS_roundtrips * 1e6;
+    }
+
+    // throughput: every core sends to its neighbor at once
+    double runtime = 0;
+    on_all_cores([&runtime]{
+      Core dest = ( Grappa::mycore() + 1 ) % Grappa::cores();
+      char * buf = locale_alloc< char >( FLAGS_message_bytes );
+      memset( buf, 0, FLAGS_message_bytes );
+      CompletionEvent ce( FLAGS_messages );
+      auto ce_addr = make_global( &ce );
+
+      Grappa::barrier();
+      double start = Grappa::walltime();
+      for( int64_t i = 0; i < FLAGS_messages; ++i ) {
+        send_heap_message( dest, [ce_addr]( void * payload, size_t size ) {
+          complete( ce_addr );
+        }, buf, FLAGS_message_bytes );
+      }
+      ce.wait();
+      double mine = Grappa::walltime() - start;
+
+      double slowest = Grappa::allreduce< double, collective_max >( mine );
+      if( Grappa::mycore() == 0 ) runtime = slowest;
+      locale_free( buf );
+    });
+
+    double total = static_cast< double >( FLAGS_messages ) * Grappa::cores();
+    transport_bench_messages_per_sec = total / runtime;
+    transport_bench_bytes_per_sec = total * FLAGS_message_bytes / runtime;
+
+    Grappa::Metrics::merge_and_print();
+  });
+  Grappa::finalize();
+  return 0;
+}
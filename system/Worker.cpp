@@ -40,6 +40,7 @@
 #include "PerformanceTools.hpp"
 #include <stdlib.h> // valloc
 #include "LocaleSharedMemory.hpp"
+#include "StackPool.hpp"
 
 DEFINE_int64( stack_size, MIN_STACK_SIZE, "Default stack size" );
 
@@ -139,7 +140,12 @@ void coro_spawn(Worker * me, Worker * c, coro_func f, size_t ssize) {
   c->idle = 0;
 
   // allocate stack and guard page
-  c->base = Grappa::impl::locale_shared_memory.allocate_aligned( ssize+4096*2, 4096 );
+  bool pooled = FLAGS_stack_pool && stack_pool.serves( ssize );
+  if( pooled ) {
+    c->base = stack_pool.allocate();
+  } else {
+    c->base = Grappa::impl::locale_shared_memory.allocate_aligned( ssize+4096*2, 4096 );
+  }
   CHECK_NOTNULL( c->base );
   c->ssize = ssize;
 
@@ -159,14 +165,19 @@ void coro_spawn(Worker * me, Worker * c, coro_func f, size_t ssize) {
   c->valgrind_stack_id = VALGRIND_STACK_REGISTER( (char *) c->base + 4096, c->stack );
 #endif
 
-  // clear stack
-  memset(c->base, 0, ssize+4096*2);
+  if( !pooled ) {
+    // clear stack
+    memset(c->base, 0, ssize+4096*2);
 
 #ifdef GUARD_PAGES_ON_STACK
-  // arm guard page
-  checked_mprotect( c->base, 4096, PROT_NONE );
-  checked_mprotect( (char*)c->base + ssize + 4096, 4096, PROT_NONE );
+    // arm guard page
+    checked_mprotect( c->base, 4096, PROT_NONE );
+    checked_mprotect( (char*)c->base + ssize + 4096, 4096, PROT_NONE );
 #endif
+  }
+  // pooled stacks are left untouched, so their pages are only
+  // committed as the Worker grows into them; the pool keeps their
+  // guard pages armed
 
   // set up coroutine to be able to run next time we're switched in
   makestack(&me->stack, &c->stack, f, c);
@@ -217,16 +228,21 @@ void destroy_coro(Worker * c) {
   }
 #endif
   if( c->base != NULL ) {
-    // disarm guard page
-    checked_mprotect( c->base, 4096, PROT_READ | PROT_WRITE );
-    checked_mprotect( (char*)c->base + c->ssize + 4096, 4096, PROT_READ | PROT_WRITE );
 #ifdef CORO_PROTECT_UNUSED_STACK
     // enable writes to stack so we can deallocate
     checked_mprotect( (void*)((intptr_t)c->base + 4096), c->ssize, PROT_READ | PROT_WRITE );
     checked_mprotect( (void*)(c), 4096, PROT_READ | PROT_WRITE );
 #endif
     remove_coro(c); // remove from debugging list of coros
-    Grappa::impl::locale_shared_memory.deallocate(c->base);
+    if( FLAGS_stack_pool && stack_pool.serves( c->ssize ) ) {
+      // keep the stack, guard pages and all, for the next Worker
+      stack_pool.release(c->base);
+    } else {
+      // disarm guard page
+      checked_mprotect( c->base, 4096, PROT_READ | PROT_WRITE );
+      checked_mprotect( (char*)c->base + c->ssize + 4096, 4096, PROT_READ | PROT_WRITE );
+      Grappa::impl::locale_shared_memory.deallocate(c->base);
+    }
   }
 }
 
@@ -85,6 +85,9 @@ class Worker {
   // next thread field for wait queues
   Worker * next;
 
+  // when a sleeping Worker should be woken (see TimerWheel)
+  int64_t wakeup;
+
   /* use for just assertions? */
   // status flags; bit fields to save space
   //TODO State runstate;
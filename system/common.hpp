@@ -95,6 +95,10 @@ namespace Grappa {
   /// Specify whether an operation blocks until complete, or returns "immediately".
   enum class SyncMode { Blocking /*default*/, Async };
     
+  /// Specify whether parallel loops split their iterations into tasks up front (eager),
+  /// or only when there is no other work around to balance (lazy).
+  enum class SplitMode { Eager /*default*/, Lazy };
+    
   
 /// "Universal" wallclock time (works at least for Mac, and most Linux)
 inline double walltime(void) {
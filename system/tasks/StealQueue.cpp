@@ -37,6 +37,8 @@
 #include "DictOut.hpp"
 
 
+DEFINE_bool( steal_locale_direct, true, "Steal from cores in our own locale directly through locale shared memory, instead of with request/reply messages" );
+
 /* metrics */
 
 // work steal network usage
@@ -45,6 +47,12 @@ GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_reply_total_bytes, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_request_messages, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_request_total_bytes, 0);
 
+// direct steals within a locale
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_direct_steals, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_direct_steal_fails, 0);
+GRAPPA_DEFINE_METRIC(SummarizingMetric<uint64_t>, stealq_direct_steal_elements, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, stealq_direct_cas_failures, 0);
+
 // work share network usage 
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, workshare_request_messages, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, workshare_request_total_bytes, 0);
@@ -85,6 +93,16 @@ void StealMetrics::record_steal_request( size_t msg_bytes ) {
   stealq_request_total_bytes += msg_bytes;
 }
 
+void StealMetrics::record_direct_steal( int64_t amount, int64_t cas_failures ) {
+  if ( amount > 0 ) {
+    stealq_direct_steals += 1;
+    stealq_direct_steal_elements += amount;
+  } else {
+    stealq_direct_steal_fails += 1;
+  }
+  stealq_direct_cas_failures += cas_failures;
+}
+
 void StealMetrics::record_workshare_request( size_t msg_bytes ) {
   workshare_request_messages += 1;
   workshare_request_total_bytes += msg_bytes;
@@ -61,13 +61,13 @@
 #include <Message.hpp>
 #include <ExternalCountPayloadMessage.hpp>
 
-#define RECLAIM_SPACE 1
 
 
 #define MIN_INT(a, b) ( (a) < (b) ) ? (a) : (b)
 
 // Load balancing parameter
 DECLARE_int32( chunk_size );
+DECLARE_bool( steal_locale_direct );
 
 #define SS_NSTATES 1
 
@@ -127,8 +127,22 @@ namespace Grappa {
       static void record_workshare_reply_nack( size_t msg_bytes );
       static void record_globalq_data_pull_reply( size_t msg_bytes, uint64_t amount );
       static void record_globalq_data_pull_request( size_t msg_bytes, uint64_t amount );
+      static void record_direct_steal( int64_t amount, int64_t cas_failures );
   };
 
+/// Ends of one core's StealQueue. These live in locale shared memory,
+/// so a thief in the same locale can steal from the queue directly:
+/// the queue is a Chase-Lev deque, where the owner pushes and pops at
+/// top and thieves claim elements at bottom with a CAS. Both indices
+/// only grow; elements are at index % size in the circular stack.
+struct StealQueueIndices {
+  volatile int64_t top;     ///< owner end; written only by the owner
+  volatile int64_t bottom;  ///< steal end; advanced only by CAS
+  void * stack;             ///< element storage, also in locale shared memory
+  int64_t size;             ///< capacity in elements
+  char pad[ 64 - 4 * sizeof(int64_t) ];
+};
+
 
 
 /// Bounded queue that knows how to share elements
@@ -140,9 +154,10 @@ template <typename T>
     private:
       uint64_t stackSize;     /* total space avail (in number of elements) */
       uint64_t workAvail;     /* elements available for stealing */
-      uint64_t bottom;   /* index of start of shared portion of stack */
-      uint64_t top;           /* index of stack top */
+      StealQueueIndices * indices;        /* our top and bottom, in locale shared memory */
+      StealQueueIndices * locale_indices; /* indices of every queue in our locale */
       uint64_t numVictimSegments; /* number of steals reserved from the bottom of the stack */
+      int64_t victimFloor;        /* lowest index that may still be waiting to be sent to a thief */
       uint64_t maxStackDepth;                      /* stack stats */ 
       uint64_t nNodes, maxTreeDepth, nVisited, nLeaves;        /* tree stats: (num pushed, max depth, num popped, leaves)  */
       uint64_t nAcquire, nRelease, nStealPackets, nFail;  /* steal stats */
@@ -176,16 +191,12 @@ template <typename T>
       /// void pull_global_data_reply( GlobalAddress< Signaler > * signal, T * received_elements, size_t elements_size );
 
       /* The number of elements that have been released
-       * below <bottom> but not yet copied out. Reclaiming
-       * array space is only allowed if this is zero 
+       * below <bottom> but not yet copied out.
        */
       uint64_t numPendingElements;
 
-      /* The stack is a non-circular array. This routine
-       * reclaims empty space without copying elements
-       * if it is safe.
-       */
-      void reclaimSpace();
+      /// claim one element at the bottom of a queue in our locale
+      static int steal_one( StealQueueIndices * victim, T * result );
 
       // work sharing dispatch
       /// static void workShareRequest_am ( workShareRequest_args * args, size_t args_size, void * payload, size_t payload_size );
@@ -199,13 +210,13 @@ template <typename T>
       /// Output stream of queue state
       std::ostream& dump ( std::ostream& o) const {
         std::stringstream ss;
-        for ( uint64_t i = top; i>bottom; i-- ) {
-          ss << stack[i-1];
+        for ( int64_t i = indices->top; i>indices->bottom; i-- ) {
+          ss << stack[(i-1) % stackSize];
           ss << ",\n";
         }
         return o << "StealQueue[depth=" << depth()
-          << "; indices(top= " << top 
-          << " bottom=" << bottom << ")"
+          << "; indices(top= " << indices->top 
+          << " bottom=" << indices->bottom << ")"
           << "; stackSize=" << stackSize 
           << "; contents=\n" << ss.str() << "]";
       }
@@ -213,7 +224,7 @@ template <typename T>
       void dump_range( uint64_t stop, uint64_t start ) {
         std::stringstream ss;
         for ( uint64_t i = start; i>stop; i-- ) {
-          ss << stack[i-1];
+          ss << stack[(i-1) % stackSize];
           ss << ",\n";
         }
         VLOG(5) << "Steal range: " << ss.str();
@@ -234,14 +245,35 @@ template <typename T>
 
         CHECK( stack!= NULL ) << "Request for " << nbytes << " bytes for stealStack failed";
 
+        // one core on each locale allocates everyone's indices; the
+        // rest attach once it's done
+        if( global_communicator.locale_mycore == 0 ) {
+          locale_indices = Grappa::impl::locale_shared_memory.segment.construct<StealQueueIndices>("StealQueueIndices")[global_communicator.locale_cores]();
+        }
+        global_communicator.barrier();
+        if( global_communicator.locale_mycore != 0 ) {
+          std::pair< StealQueueIndices *, boost::interprocess::managed_shared_memory::size_type > p;
+          p = Grappa::impl::locale_shared_memory.segment.find<StealQueueIndices>("StealQueueIndices");
+          CHECK_EQ( p.second, global_communicator.locale_cores );
+          locale_indices = p.first;
+        }
+        indices = &locale_indices[ global_communicator.locale_mycore ];
+
         mkEmpty();
+        indices->stack = stack;
+        indices->size = stackSize;
 
+        // make sure no thief sees our queue before it's ready
+        global_communicator.barrier();
       }
 
       /// Constructor allocates uninitialized queue
       StealQueue( ) 
         : stackSize( -1 )
+          , indices( NULL )
+          , locale_indices( NULL )
           , numVictimSegments( 0 )
+          , victimFloor( 0 )
           , maxStackDepth( 0 )
           , nNodes( 0 ), maxTreeDepth( 0 ), nVisited( 0 ), nLeaves( 0 )
           , nAcquire( 0 ), nRelease( 0 ), nStealPackets( 0 ), nFail( 0 )
@@ -251,8 +283,7 @@ template <typename T>
 
       void mkEmpty(); 
       void push( T c); 
-      T peek( ); 
-      void pop( ); 
+      bool pop( T * result ); 
       uint64_t topPosn( ) const;
       uint64_t depth( ) const; 
       void release( int k ); 
@@ -275,6 +306,7 @@ template <typename T>
 
       // work stealing API
       int64_t steal_locally( Core victim, int64_t max_steal );
+      int64_t steal_direct( Core victim, int64_t max_steal );
 
       // work sharing API
       /// int64_t workShare( Core target, uint64_t amount );
@@ -290,60 +322,83 @@ static int maxint(int x, int y) { return (x>y)?x:y; }
 /// Push onto top of local stack
 template <typename T>
 inline void StealQueue<T>::push( T c ) {
-  CHECK( top < stackSize ) << "push: overflow (top:" << top << " stackSize:" << stackSize << ")";
+  int64_t top = indices->top;
+  CHECK( top - indices->bottom < (int64_t) stackSize ) << "push: overflow (top:" << top << " bottom:" << indices->bottom << " stackSize:" << stackSize << ")";
+  CHECK( numVictimSegments == 0 || top - victimFloor < (int64_t) stackSize )
+    << "push: would overwrite elements not yet sent to a thief (top:" << top << " floor:" << victimFloor << ")";
 
   VLOG(5) << "stack[" << top << "] <-- push";
-  stack[top] = c; 
-  top++;
+  stack[top % stackSize] = c; 
+
+  // element must be visible before a thief can see the new top
+  __sync_synchronize();
+  indices->top = top + 1;
   nNodes++;
-  maxStackDepth = maxint(top, maxStackDepth);
+  maxStackDepth = maxint(depth(), maxStackDepth);
   //s->maxTreeDepth = maxint(s->maxTreeDepth, c->height); //XXX dont want to deref c here (expensive for just a bookkeeping operation
 
   DVLOG(5) << "after push:" << *this;
 }
 
-/// get top element
+/// local pop. The last element may race with a thief in our locale;
+/// whoever advances bottom first gets it.
+///
+/// @return false if the queue was empty (or a thief got there first)
 template <typename T>
-inline T StealQueue<T>::peek( ) {
-  CHECK(top > bottom) << "peek: empty local stack";
-  return stack[top-1];
-}
+inline bool StealQueue<T>::pop( T * result ) {
+  int64_t top = indices->top - 1;
+  indices->top = top;
+
+  // publish the new top before looking at bottom
+  __sync_synchronize();
+  int64_t bottom = indices->bottom;
+
+  if ( top < bottom ) {
+    // empty
+    indices->top = bottom;
+    return false;
+  }
 
-/// local pop
-template <typename T>
-inline void StealQueue<T>::pop( ) {
-  CHECK(top > bottom) << "pop: empty local stack";
+  *result = stack[top % stackSize];
+
+  if ( top == bottom ) {
+    // last element: claim it the way a thief would
+    bool won = __sync_bool_compare_and_swap( &indices->bottom, bottom, bottom + 1 );
+    indices->top = bottom + 1;
+    if ( !won ) return false;
+  }
 
 #if DEBUG
   // 0 out the popped element (to detect errors)
-  memset( &stack[top-1], 0, sizeof(T) );
+  memset( &stack[top % stackSize], 0, sizeof(T) );
 #endif
 
-  top--;
   nVisited++;
 
   DVLOG(5) << "after pop:" << *this;
+  return true;
 }
 
 /// number of elements in the queue
 template <typename T>
 inline uint64_t StealQueue<T>::depth() const {
-  return (top - bottom);
+  int64_t d = indices->top - indices->bottom;
+  return d > 0 ? d : 0;
 }
 
 /// set queue to empty
 template <typename T>
 inline void StealQueue<T>::mkEmpty( ) {
-  bottom = 0;
-  top    = 0;
+  indices->bottom = 0;
+  indices->top    = 0;
 }
 
 /// local top position:  stack index of top element
 template <typename T>
 uint64_t StealQueue<T>::topPosn() const
 {
-  CHECK ( top > bottom ) << "ss_topPosn: empty local stack";
-  return top - 1;
+  CHECK ( depth() > 0 ) << "ss_topPosn: empty local stack";
+  return (indices->top - 1) % stackSize;
 }
 
 
@@ -367,7 +422,64 @@ static bool pendingWorkShare = false;
 static bool pendingGlobalPush = false;
           
 
+/// Claim the element at the bottom of a queue in our locale.
+/// @return 1 if we got it, 0 if the queue was empty, -1 if another
+///         thief or the owner got it first
+template <typename T>
+inline int StealQueue<T>::steal_one( StealQueueIndices * victim, T * result ) {
+  int64_t bottom = victim->bottom;
+  __sync_synchronize();
+  int64_t top = victim->top;
+  if ( bottom >= top ) return 0;
+
+  *result = static_cast<T*>( victim->stack )[ bottom % victim->size ];
+  return __sync_bool_compare_and_swap( &victim->bottom, bottom, bottom + 1 ) ? 1 : -1;
+}
+
+/// Steal elements from the StealQueue<T> of another core in our
+/// locale, straight out of locale shared memory. The victim doesn't
+/// take part.
+/// @tparam T type of the queue elements
+/// @param victim target Core to steal from; must be in our locale
+/// @param max_steal max steal amount
+/// 
+/// @return amount stolen
+template <typename T>
+int64_t StealQueue<T>::steal_direct( Core victim, int64_t max_steal ) {
+  CHECK_EQ( Grappa::locale_of( victim ), Grappa::mylocale() ) << "Can only steal directly within a locale";
+  StealQueueIndices * victim_indices = &locale_indices[ victim - Grappa::mylocale() * Grappa::locale_cores() ];
+
+  // take half of what's there, like a remote steal
+  const int64_t victimHalfWorkAvail = (victim_indices->top - victim_indices->bottom) / 2;
+  const int64_t stealAmt = MIN_INT( victimHalfWorkAvail, max_steal );
+
+  int64_t stolen = 0;
+  int64_t cas_failures = 0;
+  while ( stolen < stealAmt ) {
+    T t;
+    int got = steal_one( victim_indices, &t );
+    if ( got > 0 ) {
+#if DEBUG
+      t.on_stolen();
+#endif
+      push( t );
+      stolen++;
+    } else if ( got < 0 ) {
+      cas_failures++;
+    } else {
+      break;
+    }
+  }
+
+  if ( stolen == 0 ) nFail++;
+  StealMetrics::record_direct_steal( stolen, cas_failures );
+  VLOG(5) << "Direct steal from Core" << victim << " got " << stolen;
+  return stolen;
+}
+
 /// Steal elements from the StealQueue<T> located at the victim Core.
+/// Victims in our own locale are stolen from directly (unless
+/// --steal_locale_direct=false); others get a request message.
 /// @tparam T type of the queue elements
 /// @param victim target Core to steal from
 /// @param max_steal max steal amount
@@ -377,13 +489,9 @@ template <typename T>
 int64_t StealQueue<T>::steal_locally( Core victim, int64_t max_steal ) {
   Core origin = global_communicator.mycore;
   CHECK( victim != origin ) << "Cannot steal from self";
-  
-  // if the bottom of the stack is not currently claimed
-  // (pending copy to the network), then can try reclaiming space  
-  if ( numVictimSegments == 0 ) {
-#ifdef RECLAIM_SPACE
-    reclaimSpace(); 
-#endif
+
+  if ( FLAGS_steal_locale_direct && Grappa::locale_of( victim ) == Grappa::mylocale() ) {
+    return steal_direct( victim, max_steal );
   }
   
   FullEmpty<int64_t> result;
@@ -391,37 +499,60 @@ int64_t StealQueue<T>::steal_locally( Core victim, int64_t max_steal ) {
 //  int64_t start_time = Grappa::timestamp();
 
   StealMetrics::record_steal_request(8+24);//FIXME: size
-  /* Send steal request */
-  Grappa::send_message( victim, [ &result, origin, max_steal ] {
+  /* Send steal request, ahead of bulk traffic to the victim */
+  auto request = Grappa::message( victim, [ &result, origin, max_steal ] {
     /* ON VICTIM */
-    int victimBottom = steal_queue.bottom;
-    int victimTop = steal_queue.top;
-
-    const int victimHalfWorkAvail = (victimTop - victimBottom) / 2;
-    const int stealAmt = MIN_INT( victimHalfWorkAvail, max_steal );
+    // thieves in our locale may be advancing bottom at the same time,
+    // so reserve the chunk with a CAS
+    StealQueueIndices * indices = steal_queue.indices;
+    int64_t victimBottom;
+    int64_t stealAmt;
+    do {
+      victimBottom = indices->bottom;
+      int64_t victimTop = indices->top;
+
+      const int64_t victimHalfWorkAvail = (victimTop - victimBottom) / 2;
+      stealAmt = MIN_INT( victimHalfWorkAvail, max_steal );
+
+      // the chunk is sent straight from the stack, so it can't wrap
+      const int64_t untilWrap = steal_queue.stackSize - (victimBottom % steal_queue.stackSize);
+      stealAmt = MIN_INT( stealAmt, untilWrap );
+
+      // tasks bound to our locale stay here; only take what's below the first one
+      if ( Grappa::locale_of( origin ) != Grappa::mylocale() ) {
+        for ( int64_t i=0; i<stealAmt; i++ ) {
+          if ( steal_queue.stack[ (victimBottom + i) % steal_queue.stackSize ].locale_bound() ) {
+            stealAmt = i;
+            break;
+          }
+        }
+      }
+    } while ( stealAmt > 0 &&
+              !__sync_bool_compare_and_swap( &indices->bottom, victimBottom, victimBottom + stealAmt ) );
     bool ok = stealAmt > 0;
 
-    VLOG(4) << "Victim of thief=" << origin << " victimHalfWorkAvail=" << victimHalfWorkAvail;
+    VLOG(4) << "Victim of thief=" << origin << " stealAmt=" << stealAmt;
     if (ok) {
 
-    /* reserve a chunk */
-    steal_queue.bottom = victimBottom + stealAmt;
-
-
     //GRAPPA_EVENT(steal_victim_ev, "Steal victim", 1, scheduler, stealAmt);
 
     T* victimStackBase = steal_queue.stack;
-    T* victimStealStart = victimStackBase + victimBottom;
+    T* victimStealStart = victimStackBase + (victimBottom % steal_queue.stackSize);
 
     steal_queue.dump_range( victimBottom, victimBottom+stealAmt );
 #if DEBUG
-    for (uint64_t i=victimBottom; i<victimBottom+stealAmt; i++) {
-      steal_queue.stack[i].on_stolen();
+    for (int64_t i=0; i<stealAmt; i++) {
+      victimStealStart[i].on_stolen();
     }
 #endif
     
     StealMetrics::record_steal_reply(8+16);//FIXME: size
 
+    // pushes must not wrap around onto the chunk until it's sent
+    if ( steal_queue.numVictimSegments == 0 ) {
+      steal_queue.victimFloor = victimBottom;
+    }
+
     /* Send successful steal reply */
     Grappa::send_heap_message( origin, [&result, stealAmt] ( void * payload, size_t payload_size ) {
       /* ON ORIGIN */
@@ -436,29 +567,16 @@ int64_t StealQueue<T>::steal_locally( Core victim, int64_t max_steal ) {
       //VT_COUNT_UNSIGNED_VAL( thiefStack->steal_success_ev_vt, k );
 #endif
 
-      // if the bottom of the stack is not currently claimed
-      // then can try reclaiming space again
-      if ( steal_queue.numVictimSegments == 0 ) {
-#ifdef RECLAIM_SPACE
-        steal_queue.reclaimSpace();
-#endif
+      // push one at a time, since our stack is circular
+      for ( int64_t i=0; i<stealAmt; i++ ) {
+        steal_queue.push( stolen_work[i] );
       }
-
-      CHECK( steal_queue.top + stealAmt < steal_queue.stackSize ) << "steal reply: overflow (top:" << steal_queue.top << " stackSize:" << steal_queue.stackSize << " amt:" << stealAmt << ")";
-      std::memcpy(&steal_queue.stack[steal_queue.top], stolen_work, payload_size);
       
-      VLOG(5) << "Steal packet returns with amt=" << stealAmt;
-
-      steal_queue.top += stealAmt;
       VLOG(5) << "Steal packet returns with amt=" << stealAmt 
         << "\n after put on stack: " << steal_queue;
 
       result.writeEF( stealAmt );
-#ifdef RECLAIM_SPACE
     }, victimStealStart, stealAmt*sizeof(T), &steal_queue.numVictimSegments ); // success reply
-#else
-    }, victimStealStart, stealAmt*sizeof(T) );// success reply
-#endif
 
 #if DEBUG
     // FIXME: do not block; use mark_sent to memset payload
@@ -469,13 +587,15 @@ int64_t StealQueue<T>::steal_locally( Core victim, int64_t max_steal ) {
     } else {
        StealMetrics::record_steal_reply(8+8);//FIXME: size
       /* Send failed steal reply */
-      send_heap_message( origin, [&result] { 
+      send_urgent_heap_message( origin, [&result] { 
         /* ON ORIGIN */
         steal_queue.nFail++;
         result.writeEF( 0 );
         }); // failure reply
     }
   }); // request
+  request.mark_urgent();
+  request.enqueue();
 
   // wait for result
   GRAPPA_PROFILE_THREAD_START( stealprof, global_scheduler.get_current_thread() );
@@ -557,15 +677,6 @@ int64_t StealQueue<T>::steal_locally( Core victim, int64_t max_steal ) {
 ///   int amount;
 /// };
 /// 
-template <typename T>
-void StealQueue<T>::reclaimSpace() {
-  // reclaim space if the queue is empty
-  // and there is no pending transfer below 'bottom' (workshare or pending global q pull)
-  if ( depth() == 0 && !pendingWorkShare && numPendingElements == 0 ) {
-    DVLOG(5) << "reclaiming space top=" << top << ", bottom=" << bottom;
-    mkEmpty();
-  }
-}
 /// 
 /// template <typename T>
 /// void StealQueue<T>::workShareReplyFewer( int amountDenied ) {
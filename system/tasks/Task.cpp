@@ -43,8 +43,11 @@
 #include "../Grappa.hpp"
 
 DEFINE_int32( chunk_size, 10, "Max amount of work transfered per load balance" );
-DEFINE_string( load_balance, "none", "Type of dynamic load balancing {none (default), steal, share, gq}" );
+DEFINE_string( load_balance, "none", "Type of dynamic load balancing {none (default), steal, hsteal, share, gq}" );
+DEFINE_int32( steal_remote_after, 4, "With --load_balance=hsteal, failed rounds of stealing from cores in our locale before trying cores in other locales" );
+DEFINE_int32( steal_remote_victims, 1, "With --load_balance=hsteal, cores in other locales to try each time stealing escalates" );
 DEFINE_uint64( global_queue_threshold, 1024, "Threshold to trigger release of tasks to global queue" );
+DEFINE_int64( steal_queue_size, 0, "Capacity of each core's public task queue in tasks; 0 picks one that fits the memory footprint" );
 
 size_t steal_queue_size = 1L<<19;  // previous values: 500000
 
@@ -58,6 +61,15 @@ GRAPPA_DEFINE_METRIC(SummarizingMetric<uint64_t>, steal_amt_, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, single_steal_fails_, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, session_steal_successes_, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, session_steal_fails_,0);
+
+// hierarchical stealing, per level
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, local_steal_attempts_, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, local_steal_successes_, 0);
+GRAPPA_DEFINE_METRIC(SummarizingMetric<uint64_t>, local_steal_amt_, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, remote_steal_attempts_, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, remote_steal_successes_, 0);
+GRAPPA_DEFINE_METRIC(SummarizingMetric<uint64_t>, remote_steal_amt_, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, steal_escalations_, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, acquire_successes_,0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, acquire_fails_,0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, releases_,0);
@@ -92,6 +104,8 @@ GRAPPA_DEFINE_METRIC(CallbackMetric<uint64_t>, private_queue_size, []() {
 
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, tasks_heap_allocated, 0);
 GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, tasks_created, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, tasks_spawned_near_local, 0);
+GRAPPA_DEFINE_METRIC(SimpleMetric<uint64_t>, tasks_spawned_near_remote, 0);
 
 namespace Grappa {
   namespace impl {
@@ -113,6 +127,12 @@ TaskManager global_task_manager;
   , gqPushLock( true )
   , gqPullLock( true )
   , nextVictimIndex( 0 )
+  , doHierarchicalSteal( false )
+  , localVictims()
+  , remoteVictims()
+  , nextLocalVictimIndex( 0 )
+  , nextRemoteVictimIndex( 0 )
+  , localStealFailures( 0 )
 {
     
 }
@@ -145,6 +165,9 @@ void TaskManager::init ( Core localId_arg, Core * neighbors_arg, Core numLocalNo
     doSteal = false; doShare = false; doGQ = false;
   } else if ( FLAGS_load_balance.compare( "steal" ) == 0 ) {
     doSteal = true; doShare = false; doGQ = false;
+  } else if ( FLAGS_load_balance.compare( "hsteal" ) == 0 ) {
+    doSteal = true; doShare = false; doGQ = false;
+    doHierarchicalSteal = true;
   } else if ( FLAGS_load_balance.compare( "share" ) == 0 ) {
     CHECK( false ) << "--load_balance=share currently unsupported; see tasks/StealQueue.hpp";
     doSteal = false; doShare = true; doGQ = false;
@@ -152,7 +175,7 @@ void TaskManager::init ( Core localId_arg, Core * neighbors_arg, Core numLocalNo
     CHECK( false ) << "--load_balance=gq currently unsupported; see tasks/StealQueue.hpp";
     doSteal = false; doShare = false; doGQ = true;
   } else {
-    CHECK( false ) << "load_balance=" << FLAGS_load_balance << "; must be {none, steal, share, gq}";
+    CHECK( false ) << "load_balance=" << FLAGS_load_balance << "; must be {none, steal, hsteal, share, gq}";
   }
 
   fast_srand(0);
@@ -161,6 +184,7 @@ void TaskManager::init ( Core localId_arg, Core * neighbors_arg, Core numLocalNo
   neighbors = neighbors_arg;
   numLocalNodes = numLocalNodes_arg;
   chunkSize = FLAGS_chunk_size;
+  if ( FLAGS_steal_queue_size > 0 ) steal_queue_size = FLAGS_steal_queue_size;
 
   // initialize neighbors to steal permutation
   srandom(0);
@@ -170,6 +194,24 @@ void TaskManager::init ( Core localId_arg, Core * neighbors_arg, Core numLocalNo
     neighbors[ri] = neighbors[i-1];
     neighbors[i-1] = temp;
   }
+
+  // split the permutation by locale for hierarchical stealing; every
+  // core sees the same order, so start each core at a different place
+  if ( doHierarchicalSteal ) {
+    localVictims.clear();
+    remoteVictims.clear();
+    for ( Core i=0; i<numLocalNodes; i++ ) {
+      Core v = neighbors[i];
+      if ( v == localId ) continue;
+      if ( Grappa::locale_of( v ) == Grappa::locale_of( localId ) ) {
+        localVictims.push_back( v );
+      } else {
+        remoteVictims.push_back( v );
+      }
+    }
+    nextLocalVictimIndex = localVictims.empty() ? 0 : localId % localVictims.size();
+    nextRemoteVictimIndex = remoteVictims.empty() ? 0 : localId % remoteVictims.size();
+  }
 }
 
 void TaskManager::activate () {
@@ -293,10 +335,9 @@ bool TaskManager::tryConsumeLocal( Task * result ) {
   } else {
     checkWorkShare();
 
-    if ( publicHasEle() ) {
+    // a thief in our locale may take the last task out from under us
+    if ( publicHasEle() && publicQ.pop( result ) ) {
       DVLOG(5) << "consuming local task";
-      *result = publicQ.peek();
-      publicQ.pop( );
       TaskManagerMetrics::record_public_task_dequeue();
       return true;
     } else {
@@ -319,7 +360,9 @@ inline void TaskManager::checkPull() {
       int goodSteal = 0;
       Core victimId = -1;
 
-      for ( int64_t tryCount=0; 
+      if ( doHierarchicalSteal ) {
+        goodSteal = stealHierarchical( &victimId );
+      } else for ( int64_t tryCount=0; 
           tryCount < numLocalNodes && !goodSteal && !(publicHasEle() || privateHasEle() || workDone);
           tryCount++ ) {
 
@@ -378,6 +421,56 @@ inline void TaskManager::checkPull() {
 }
 
 
+/// One session of hierarchical stealing. Try each other core in our
+/// locale once; those requests never leave the locale's shared memory.
+/// Only after --steal_remote_after such sessions fail in a row (or
+/// right away, if we're alone in our locale) try a few cores in other
+/// locales.
+///
+/// @param victimId set to the last core we tried
+///
+/// @return amount stolen
+int64_t TaskManager::stealHierarchical( Core * victimId ) {
+  int64_t goodSteal = 0;
+
+  for ( size_t tryCount=0;
+      tryCount < localVictims.size() && !goodSteal && !(publicHasEle() || privateHasEle() || workDone);
+      tryCount++ ) {
+    Core v = localVictims[nextLocalVictimIndex];
+    *victimId = v;
+    nextLocalVictimIndex = (nextLocalVictimIndex+1) % localVictims.size();
+
+    goodSteal = publicQ.steal_locally(v, chunkSize);
+    TaskManagerMetrics::record_local_steal( goodSteal );
+  }
+
+  if ( goodSteal ) {
+    localStealFailures = 0;
+    return goodSteal;
+  }
+
+  if ( remoteVictims.empty() ||
+      ( !localVictims.empty() && ++localStealFailures < FLAGS_steal_remote_after ) ) {
+    return 0;
+  }
+
+  TaskManagerMetrics::record_steal_escalation();
+  localStealFailures = 0;
+
+  for ( int64_t tryCount=0;
+      tryCount < FLAGS_steal_remote_victims && !goodSteal && !(publicHasEle() || privateHasEle() || workDone);
+      tryCount++ ) {
+    Core v = remoteVictims[nextRemoteVictimIndex];
+    *victimId = v;
+    nextRemoteVictimIndex = (nextRemoteVictimIndex+1) % remoteVictims.size();
+
+    goodSteal = publicQ.steal_locally(v, chunkSize);
+    TaskManagerMetrics::record_remote_steal( goodSteal );
+  }
+
+  return goodSteal;
+}
+
 /// Blocking dequeue of any Task from the global Task pool.
 /// Only returns when there is work or when
 /// the system has no more work.
@@ -455,6 +548,32 @@ void TaskManagerMetrics::record_failed_steal() {
   single_steal_fails_++;
 }
 
+void TaskManagerMetrics::record_local_steal( int64_t amount ) {
+  local_steal_attempts_++;
+  if ( amount > 0 ) {
+    local_steal_successes_++;
+    local_steal_amt_ += amount;
+    record_successful_steal( amount );
+  } else {
+    record_failed_steal();
+  }
+}
+
+void TaskManagerMetrics::record_remote_steal( int64_t amount ) {
+  remote_steal_attempts_++;
+  if ( amount > 0 ) {
+    remote_steal_successes_++;
+    remote_steal_amt_ += amount;
+    record_successful_steal( amount );
+  } else {
+    record_failed_steal();
+  }
+}
+
+void TaskManagerMetrics::record_steal_escalation() {
+  steal_escalations_++;
+}
+
 void TaskManagerMetrics::record_successful_acquire() {
   acquire_successes_++;
 }
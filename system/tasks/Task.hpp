@@ -36,6 +36,7 @@
 
 #include <iostream>
 #include <deque>
+#include <vector>
 #include "Worker.hpp"
 
 #define PRIVATEQ_LIFO 1
@@ -61,9 +62,19 @@ class Task {
     void* arg1;
     void* arg2;
 
+    /// Tasks spawned near their data may only be stolen by cores in
+    /// the same locale. Function pointers are user-space addresses, so
+    /// this flag lives in the top bit of fn_p.
+    static const uintptr_t locale_bound_bit = 1UL << 63;
+
+    void (* function() const)(void*,void*,void*) {
+      return reinterpret_cast< void (*)(void*,void*,void*) >( reinterpret_cast< uintptr_t >( fn_p ) & ~locale_bound_bit );
+    }
+
     std::ostream& dump ( std::ostream& o ) const {
       return o << "Task{"
-        << " fn_p=" << fn_p
+        << " fn_p=" << (void*)function()
+        << ( locale_bound() ? " (locale bound)" : "" )
         << ", arg0=" << std::dec << arg0
         << ", arg1=" << std::dec << arg1
         << ", arg2=" << std::dec << arg2
@@ -89,8 +100,19 @@ class Task {
     /// Execute the task.
     /// Calls the function pointer on the provided arguments.
     void execute( ) {
-      CHECK( fn_p!=NULL ) << "fn_p=" << (void*)fn_p << "\narg0=" << (void*)arg0 << "\narg1=" << (void*)arg1 << "\narg2=" << (void*)arg2;
-      fn_p( arg0, arg1, arg2 );  // NOTE: this executes 1-parameter function's with 3 args
+      auto fn = function();
+      CHECK( fn!=NULL ) << "fn_p=" << (void*)fn << "\narg0=" << (void*)arg0 << "\narg1=" << (void*)arg1 << "\narg2=" << (void*)arg2;
+      fn( arg0, arg1, arg2 );  // NOTE: this executes 1-parameter function's with 3 args
+    }
+
+    /// Keep this task within its locale when it is stolen.
+    void bind_to_locale( ) {
+      fn_p = reinterpret_cast< void (*)(void*,void*,void*) >( reinterpret_cast< uintptr_t >( fn_p ) | locale_bound_bit );
+    }
+
+    /// May this task only be stolen by cores in its locale?
+    bool locale_bound( ) const {
+      return ( reinterpret_cast< uintptr_t >( fn_p ) & locale_bound_bit ) != 0;
     }
 
     void on_stolen( ) {
@@ -124,6 +146,9 @@ class TaskManagerMetrics {
     static void record_failed_steal_session();
     static void record_successful_steal( int64_t amount );
     static void record_failed_steal();
+    static void record_local_steal( int64_t amount );
+    static void record_remote_steal( int64_t amount );
+    static void record_steal_escalation();
     static void record_successful_acquire();
     static void record_failed_acquire();
     static void record_release();
@@ -179,6 +204,20 @@ class TaskManager {
     /// next victim to steal from (for selection by pseudo-random permutation)
     int64_t nextVictimIndex;
 
+    /// hierarchical stealing on/off
+    bool doHierarchicalSteal;
+
+    /// victims in our own locale and in other locales, each in
+    /// pseudo-random order (for hierarchical stealing)
+    std::vector<Core> localVictims;
+    std::vector<Core> remoteVictims;
+    size_t nextLocalVictimIndex;
+    size_t nextRemoteVictimIndex;
+
+    /// steal sessions that have failed within our locale since the
+    /// last success or escalation to a remote victim
+    int64_t localStealFailures;
+
     /// load balancing batch size
     int chunkSize;
 
@@ -206,6 +245,7 @@ class TaskManager {
     // helper operations; called each in once place
     // for sampling profiler to distinguish code by function
     void checkPull();
+    int64_t stealHierarchical( Core * victimId );
     void tryPushToGlobal();
     void checkWorkShare();
 
@@ -243,6 +283,9 @@ class TaskManager {
     template < typename A0, typename A1, typename A2 > 
       void spawnPublic( void (*f)(A0, A1, A2), A0 arg0, A1 arg1, A2 arg2 );
 
+    template < typename A0, typename A1, typename A2 >
+      void spawnLocalePublic( void (*f)(A0, A1, A2), A0 arg0, A1 arg1, A2 arg2 );
+
     /*TODO return value?*/ 
     template < typename A0, typename A1, typename A2 > 
       void spawnLocalPrivate( void (*f)(A0, A1, A2), A0 arg0, A1 arg1, A2 arg2 );
@@ -302,6 +345,24 @@ inline void TaskManager::spawnPublic( void (*f)(A0, A1, A2), A0 arg0, A1 arg1, A
   push_public_task( newtask );
 }
 
+/// Create a task in the global task pool that may only be stolen by
+/// cores in this locale.
+///
+/// @tparam A0 type of first task argument
+/// @tparam A1 type of second task argument
+/// @tparam A2 type of third task argument
+///
+/// @param f function pointer for the new task
+/// @param arg0 first task argument
+/// @param arg1 second task argument
+/// @param arg2 third task argument
+template < typename A0, typename A1, typename A2 > 
+inline void TaskManager::spawnLocalePublic( void (*f)(A0, A1, A2), A0 arg0, A1 arg1, A2 arg2 ) {
+  Task newtask = createTask(f, arg0, arg1, arg2 );
+  newtask.bind_to_locale();
+  push_public_task( newtask );
+}
+
 
 /// Create a task in the local private task pool.
 /// Should NOT be called from the context of an AM handler.
@@ -35,21 +35,47 @@
 #include "Task.hpp"
 
 #include <gflags/gflags.h>
+#include <algorithm>
 #include "../PerformanceTools.hpp"
 
 /// TODO: this should be based on some actual time-related metric so behavior is predictable across machines
 DEFINE_int64( periodic_poll_ticks,          0, "number of ticks to wait before polling periodic queue for one core (set to 0 for auto-growth)");
 DEFINE_int64( periodic_poll_ticks_base, 28000, "number of ticks to wait before polling periodic queue for one core (see _growth for increase)");
 DEFINE_int64( periodic_poll_ticks_growth, 281, "number of ticks to add per core");
+DEFINE_int32( timer_wheel_resolution_bits, 10, "log2 of the number of ticks covered by one slot of the scheduler's timer wheel" );
+DEFINE_int64( idle_sleep_max_us, 1, "longest the scheduler will sleep when idle and not polling, if no timer is due sooner" );
 
 DEFINE_bool(poll_on_idle, true, "have tasking layer poll aggregator if it has nothing better to do");
 
 DEFINE_uint64( readyq_prefetch_distance, 4, "How far ahead in the ready queue to prefetch contexts" );
 
+DEFINE_bool( adaptive_workers, false, "Adjust the active worker limit as the job runs, from delegate latency, ready queue length and idle time" );
+DEFINE_int64( adaptive_workers_interval_ticks, 10000000, "Ticks between adjustments of the active worker limit" );
+DEFINE_uint64( adaptive_workers_min, 16, "Fewest active workers the adaptive controller will allow" );
+DEFINE_uint64( adaptive_workers_max, 0, "Most workers the adaptive controller will allow, spawning more as needed (0 means num_starting_workers)" );
+DEFINE_double( adaptive_workers_idle_high, 0.10, "Grow the active worker limit when more than this fraction of an interval was idle while every allowed worker was busy and tasks were waiting" );
+DEFINE_double( adaptive_workers_latency_factor, 2.0, "Shrink the active worker limit when delegate latency exceeds this multiple of the best seen while workers wait in the ready queue" );
+
+DECLARE_uint64( num_starting_workers );
+
 GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, scheduler_context_switches, 0 );
 GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, scheduler_count, 0);
 GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, scheduler_samples, 0);
 
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, continuations_spawned, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, continuations_run, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, continuations_promoted, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, continuation_runners_spawned, 0 );
+
+// adaptive worker control: the limit chosen at each step, and why
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, adaptive_active_workers, 0 );
+GRAPPA_DEFINE_METRIC( SummarizingMetric<uint64_t>, adaptive_active_workers_chosen, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, adaptive_workers_grown, 0 );
+GRAPPA_DEFINE_METRIC( SimpleMetric<uint64_t>, adaptive_workers_shrunk, 0 );
+GRAPPA_DEFINE_METRIC( SummarizingMetric<double>, adaptive_workers_idle_fraction, 0.0 );
+
+GRAPPA_DECLARE_METRIC( SummarizingMetric<double>, delegate_roundtrip_latency );
+
 // set in sample()
 GRAPPA_DEFINE_METRIC( SummarizingMetric<uint64_t>, active_tasks_sampled, 0);
 GRAPPA_DEFINE_METRIC( SummarizingMetric<uint64_t>, ready_tasks_sampled, 0);
@@ -73,17 +99,28 @@ TaskingScheduler global_scheduler;
 /// init() must subsequently be called before fully initialized.
   TaskingScheduler::TaskingScheduler ( )
   : readyQ ( )
-  , periodicQ ( )
+  , timers ( )
   , unassignedQ ( )
+  , continuationQ ( )
+  , continuation_runner ( NULL )
+  , continuation_runner_idle ( false )
+  , continuation_executing ( false )
+  , spareRunnerQ ( )
   , master ( NULL )
   , current_thread ( NULL )
   , nextId ( 1 )
   , num_idle ( 0 )
   , num_active_tasks( 0 )
+  , max_allowed_active_workers( 0 )
+  , adaptive_prev_ts( 0 )
+  , adaptive_prev_idle_ticks( 0 )
+  , adaptive_prev_latency_sum( 0.0 )
+  , adaptive_prev_latency_samples( 0 )
+  , adaptive_best_latency( 0.0 )
+  , active_workers_pinned( false )
   , task_manager ( NULL )
   , num_workers ( 0 )
   , work_args( NULL )
-  , previous_periodic_ts( 0 ) 
   , periodic_poll_ticks( 0 ) 
   , in_no_switch_region_( false )
   , prev_ts( 0 )
@@ -109,6 +146,7 @@ void TaskingScheduler::init ( Worker * master_arg, TaskManager * taskman ) {
   } else {
     periodic_poll_ticks = FLAGS_periodic_poll_ticks;
   }
+  timers.init( Grappa::force_tick(), FLAGS_timer_wheel_resolution_bits );
 }
 
 /// Give control to the scheduler until task layer
@@ -201,6 +239,146 @@ void workerLoop ( Worker * me, void* args ) {
 }
 
 
+/// Adjust the active worker limit from what happened since the last
+/// call. If the core sat idle while every allowed worker was busy and
+/// tasks were waiting, remote latency isn't being hidden, so allow
+/// more workers. If workers are queueing for the CPU and delegate
+/// latency has climbed well above the best we've seen, the extra
+/// workers are only adding delay (and cache and stack pressure), so
+/// allow fewer.
+void TaskingScheduler::adapt_active_workers( Grappa::Timestamp current_ts ) {
+  Grappa::Timestamp elapsed = current_ts - adaptive_prev_ts;
+  adaptive_prev_ts = current_ts;
+
+  uint64_t idle_ticks = stats.state_timers[ TaskingSchedulerMetrics::StateIdle ]->value()
+    + stats.state_timers[ TaskingSchedulerMetrics::StateIdleUseful ]->value();
+  double idle_fraction = static_cast<double>( idle_ticks - adaptive_prev_idle_ticks ) / elapsed;
+  adaptive_prev_idle_ticks = idle_ticks;
+
+  double latency_sum = delegate_roundtrip_latency.value();
+  size_t latency_samples = delegate_roundtrip_latency.samples();
+  double latency = 0.0;
+  if( latency_samples > adaptive_prev_latency_samples ) {
+    latency = ( latency_sum - adaptive_prev_latency_sum ) / ( latency_samples - adaptive_prev_latency_samples );
+    if( adaptive_best_latency == 0.0 || latency < adaptive_best_latency ) {
+      adaptive_best_latency = latency;
+    }
+  }
+  adaptive_prev_latency_sum = latency_sum;
+  adaptive_prev_latency_samples = latency_samples;
+
+  // leave explicit limits (and the first interval, with no history) alone
+  if( active_workers_pinned || elapsed == current_ts ) return;
+
+  adaptive_workers_idle_fraction += idle_fraction;
+
+  const uint64_t min_workers = FLAGS_adaptive_workers_min;
+  const uint64_t max_workers = std::max( min_workers, FLAGS_adaptive_workers_max > 0
+                                         ? FLAGS_adaptive_workers_max
+                                         : FLAGS_num_starting_workers );
+  uint64_t limit = max_allowed_active_workers;
+  uint64_t ready = readyQ.length();
+
+  if( idle_fraction > FLAGS_adaptive_workers_idle_high &&
+      num_active_tasks >= limit &&
+      task_manager->local_available() ) {
+    limit += std::max< uint64_t >( 1, limit / 4 );
+    adaptive_workers_grown++;
+  } else if( latency > FLAGS_adaptive_workers_latency_factor * adaptive_best_latency &&
+             ready > limit / 2 ) {
+    limit -= std::max< uint64_t >( 1, limit / 8 );
+    adaptive_workers_shrunk++;
+  }
+  limit = std::min( std::max( limit, min_workers ), max_workers );
+
+  // the pool may need more workers to reach the new limit
+  if( limit > num_workers ) {
+    createWorkers( limit - num_workers );
+  }
+
+  if( limit != max_allowed_active_workers ) {
+    DVLOG(2) << "Active worker limit " << max_allowed_active_workers << " -> " << limit
+             << " (idle " << idle_fraction << ", latency " << latency
+             << ", best " << adaptive_best_latency << ", ready " << ready << ")";
+  }
+  max_allowed_active_workers = limit;
+  adaptive_active_workers = limit;
+  adaptive_active_workers_chosen += limit;
+}
+
+/// Continuation runner routine.
+/// Runs queued continuations back to back without switching, except
+/// to let the scheduler poll. If a continuation blocks, this Worker is
+/// promoted (see maybe_promote_continuation()); once that continuation
+/// finishes, it either takes over as runner again or waits as a spare.
+void continuationLoop ( Worker * me, void * args ) {
+  TaskingScheduler * sched = static_cast< TaskingScheduler * >( args );
+
+  while ( true ) {
+    if ( sched->continuation_runner != me ) {
+      if ( sched->continuation_runner == NULL ) {
+        sched->continuation_runner = me;
+      } else {
+        // start_continuation_runner() makes us the runner when it wakes us
+        sched->spareRunnerQ.enqueue( me );
+        sched->thread_suspend();
+        continue;
+      }
+    }
+
+    if ( sched->continuationQ.empty() ) {
+      sched->continuation_runner_idle = true;
+      sched->thread_suspend();
+      continue;
+    }
+
+    Task t = sched->continuationQ.front();
+    sched->continuationQ.pop_front();
+
+    sched->continuation_executing = true;
+    StateTimer::setThreadState( StateTimer::USER );
+    StateTimer::enterState_user();
+    {
+      GRAPPA_PROFILE( exectimer, "user_execution", "", GRAPPA_USER_GROUP );
+      t.execute();
+    }
+    StateTimer::setThreadState( StateTimer::FINDWORK );
+    continuations_run++;
+
+    // if we were promoted, the new runner owns this flag now
+    if ( sched->continuation_runner == me ) {
+      sched->continuation_executing = false;
+      sched->thread_maybe_yield();
+    }
+  }
+}
+
+/// Queue a continuation, waking or starting a runner if needed.
+void TaskingScheduler::spawn_continuation( Task t ) {
+  continuations_spawned++;
+  continuationQ.push_back( t );
+  if ( continuation_runner == NULL ) {
+    start_continuation_runner();
+  } else if ( continuation_runner_idle ) {
+    continuation_runner_idle = false;
+    thread_wake( continuation_runner );
+  }
+}
+
+/// Hand the continuation queue to a spare runner, or spawn a new one.
+void TaskingScheduler::start_continuation_runner( ) {
+  Worker * w = spareRunnerQ.dequeue();
+  continuation_runner = w;
+  continuation_runner_idle = false;
+  if ( w != NULL ) {
+    thread_wake( w );
+  } else {
+    continuation_runners_spawned++;
+    continuation_runner = impl::worker_spawn( current_thread, this, continuationLoop, this );
+    ready( continuation_runner );
+  }
+}
+
 /// create worker Threads for executing Tasks
 ///
 /// @param num how many workers to create
@@ -241,9 +419,23 @@ void TaskingScheduler::onWorkerStart( ) {
 
 /// Are there anymore threads to run?
 bool TaskingScheduler::queuesFinished( ) {
-  // there are no more threads to run if the periodicQueue is empty
-  // and the TaskManager has terminated
-  return periodicQ.empty() && task_manager->isWorkDone();
+  // there are no more threads to run if no Worker is sleeping on the
+  // timer wheel and the TaskManager has terminated
+  return timers.empty() && task_manager->isWorkDone();
+}
+
+void TaskingScheduler::idle_sleep( Grappa::Timestamp current_ts ) {
+  int64_t us = FLAGS_idle_sleep_max_us;
+  Grappa::Timestamp deadline = timers.next_deadline();
+  if( Grappa::tick_rate > 0.0 && deadline > current_ts ) {
+    double until_deadline = (double) (deadline - current_ts) / Grappa::tick_rate * 1.0e6;
+    if( until_deadline < us ) us = (int64_t) until_deadline;
+  } else if( deadline <= current_ts ) {
+    us = 0;
+  }
+  if( us > 0 ) {
+    usleep( us );
+  }
 }
 
 /// Print representation of TaskingScheduler
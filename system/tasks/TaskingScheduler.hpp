@@ -35,12 +35,15 @@
 #define TASKING_SCHEDULER_HPP
 
 #include "Worker.hpp"
+#include "Task.hpp"
 #include "ThreadQueue.hpp"
+#include "TimerWheel.hpp"
 #include "Scheduler.hpp"
 #include "Communicator.hpp"
 #include <Timestamp.hpp>
 #include <glog/logging.h>
 #include <sstream>
+#include <deque>
 #include "Metrics.hpp"
 #include "HistogramMetric.hpp"
 
@@ -58,11 +61,13 @@
 
 GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, scheduler_context_switches );
 GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, scheduler_count);
+GRAPPA_DECLARE_METRIC( SimpleMetric<uint64_t>, continuations_promoted );
 
 
 
 // forward declarations
 namespace Grappa {
+extern double tick_rate;
 namespace impl { void idle_flush_rdma_aggregator(); }
 namespace Metrics { void sample_all(); }
 }
@@ -71,6 +76,10 @@ namespace Metrics { void sample_all(); }
 bool idle_flush_aggregator();
 
 DECLARE_int64( periodic_poll_ticks );
+DECLARE_bool( adaptive_workers );
+DECLARE_int64( adaptive_workers_interval_ticks );
+DECLARE_uint64( adaptive_workers_min );
+DECLARE_uint64( adaptive_workers_max );
 DECLARE_bool(poll_on_idle);
 DECLARE_bool(flush_on_idle);
 DECLARE_bool(rdma_flush_on_idle);
@@ -93,12 +102,29 @@ class TaskingScheduler : public Scheduler {
     /// Queue for Threads that are ready to run
     PrefetchingThreadQueue readyQ;
 
-    /// Queue for Threads that are to run periodically
-    ThreadQueue periodicQ;
+    /// Sleeping Threads, periodic and delayed, ordered by wakeup time
+    TimerWheel timers;
 
     /// Pool of idle workers that are not assigned to Tasks
     ThreadQueue unassignedQ;
 
+    /// Continuations waiting to run. Unlike Tasks, these don't each
+    /// get a worker: one runner Worker runs them back to back.
+    std::deque<Task> continuationQ;
+
+    /// Worker currently running continuations, if any
+    Worker * continuation_runner;
+
+    /// runner is suspended waiting for continuations
+    bool continuation_runner_idle;
+
+    /// runner is in the middle of a continuation
+    bool continuation_executing;
+
+    /// runners whose continuation blocked, finished it, and are
+    /// waiting to be reused
+    ThreadQueue spareRunnerQ;
+
     /// Master Worker that represents the main program thread
     Worker * master;
 
@@ -115,6 +141,19 @@ class TaskingScheduler : public Scheduler {
     /// Max allowed active workers
     uint64_t max_allowed_active_workers;
 
+    /// adaptive worker control: previous sample of each input
+    Grappa::Timestamp adaptive_prev_ts;
+    uint64_t adaptive_prev_idle_ticks;
+    double adaptive_prev_latency_sum;
+    size_t adaptive_prev_latency_samples;
+
+    /// adaptive worker control: lowest delegate latency seen so far
+    double adaptive_best_latency;
+
+    /// someone set an explicit limit with allow_active_workers(), so
+    /// the adaptive controller leaves it alone
+    bool active_workers_pinned;
+
     /// Reference to Task manager that is used by the scheduler
     /// for finding Tasks to assign to workers
     TaskManager * task_manager;
@@ -127,28 +166,21 @@ class TaskingScheduler : public Scheduler {
 
     task_worker_args * work_args;
 
-    // STUB: replace with real periodic threads
-    Grappa::Timestamp previous_periodic_ts;
     Grappa::Timestamp periodic_poll_ticks;
-  inline bool should_run_periodic( Grappa::Timestamp current_ts ) {
-    return current_ts - previous_periodic_ts > periodic_poll_ticks;
-  }
 
+    /// Take a Worker whose wakeup time has passed, if any.
     Worker * periodicDequeue(Grappa::Timestamp current_ts) {
-      // // tick the timestap counter
-      // Grappa::tick();
-      // Grappa::Timestamp current_ts = Grappa::timestamp();
-
-      if( should_run_periodic( current_ts ) ) {
-        return periodicQ.dequeue();
-      } else {
-        return NULL;
+      if( current_ts >= timers.next_deadline() ) {
+        timers.advance( current_ts );
       }
+      return timers.dequeue_expired();
     }
-    //////
 
     bool queuesFinished();
 
+    /// Sleep the core while there is nothing to do, but not past the next timer.
+    void idle_sleep( Grappa::Timestamp current_ts );
+
     /// make sure we don't context switch when we don't want to
     bool in_no_switch_region_;
 
@@ -173,6 +205,12 @@ class TaskingScheduler : public Scheduler {
         Grappa::tick();
         current_ts = Grappa::timestamp();
 
+        // maybe adjust the active worker limit
+        if( FLAGS_adaptive_workers &&
+            current_ts - adaptive_prev_ts > FLAGS_adaptive_workers_interval_ticks ) {
+          adapt_active_workers( current_ts );
+        }
+
         // maybe sample
         if( Grappa::impl::take_tracing_sample ) {
           Grappa::impl::take_tracing_sample = false;
@@ -246,14 +284,14 @@ class TaskingScheduler : public Scheduler {
         } else {
           *(stats.state_timers[ stats.prev_state ]) += (current_ts - prev_ts) / tick_scale;
           stats.prev_state = TaskingSchedulerMetrics::StateIdle;
-          usleep(1);
+          idle_sleep( current_ts );
         }
 
         prev_ts = current_ts;
         // no coroutines can run, so handle
         /*DVLOG(5) << current_thread->id << " scheduler: no coroutines can run"
           << "[isBlocking=" << isBlocking
-          << " periodQ=" << (periodicQ.empty() ? "empty" : "full")
+          << " timers=" << (timers.empty() ? "empty" : "full")
           << " unassignedQ=" << (unassignedQ.empty() ? "empty" : "full") << "]";*/
         //                usleep(1);
       } while ( isBlocking || !queuesFinished() );
@@ -268,7 +306,7 @@ class TaskingScheduler : public Scheduler {
         //<< "  \"hostname\": \"" << global_communicator.hostname() << "\"" << std::endl
         << "  \"pid\": " << getpid() << std::endl
         << "  \"readyQ\": " << readyQ << std::endl
-        << "  \"periodicQ\": " << periodicQ << std::endl
+        << "  \"timers\": " << timers << std::endl
         << "  \"num_workers\": " << num_workers << std::endl
         << "  \"num_idle\": " << num_idle << std::endl
         << "  \"unassignedQ\": " << unassignedQ << std::endl
@@ -342,7 +380,10 @@ class TaskingScheduler : public Scheduler {
     /// Set allowed active workers to allow `n` more workers than are active now, or if '-1'
     /// is specified, allow all workers to be active.
     /// (this is mostly to make Core 0 with user_main not get forced to have fewer active)
+    /// With --adaptive_workers, '-1' hands the limit back to the
+    /// controller, and any other value pins it until then.
     void allow_active_workers(int64_t n) {
+      active_workers_pinned = (n != -1);
       if (n == -1) {
         max_allowed_active_workers = num_workers;
       } else {
@@ -353,6 +394,10 @@ class TaskingScheduler : public Scheduler {
 
     int64_t max_allowed_active() { return max_allowed_active_workers; }
 
+    /// Retune the active worker limit (called every
+    /// --adaptive_workers_interval_ticks with --adaptive_workers)
+    void adapt_active_workers( Grappa::Timestamp current_ts );
+
     /// Assign the Worker a unique id for this scheduler
     void assignTid( Worker * thr ) {
       thr->id = nextId++;
@@ -360,6 +405,26 @@ class TaskingScheduler : public Scheduler {
 
     void createWorkers( uint64_t num );
     Worker* maybeSpawnCoroutines( );
+
+    void spawn_continuation( Task t );
+    void start_continuation_runner( );
+
+    /// A continuation that blocks keeps the runner's stack: the runner
+    /// becomes an ordinary Worker for the rest of that continuation,
+    /// and a new runner takes over the queue.
+    inline void maybe_promote_continuation( ) {
+      if( continuation_executing && current_thread == continuation_runner ) {
+        continuations_promoted++;
+        continuation_executing = false;
+        continuation_runner = NULL;
+        if( !continuationQ.empty() ) start_continuation_runner();
+      }
+    }
+
+    /// Number of continuations waiting to run
+    uint64_t continuation_count() {
+      return continuationQ.size();
+    }
     void onWorkerStart( );
 
     uint64_t active_task_count() {
@@ -376,12 +441,14 @@ class TaskingScheduler : public Scheduler {
       readyQ.enqueue( thr );
     }
 
-    /// Put the Worker into the periodic queue
+    /// Put the Worker to sleep for one polling interval
     void periodic( Worker * thr ) {
-      periodicQ.enqueue( thr );
-      Grappa::tick();
-      Grappa::Timestamp current_ts = Grappa::force_tick();
-      previous_periodic_ts = current_ts;
+      periodic( thr, periodic_poll_ticks );
+    }
+
+    /// Put the Worker to sleep for interval ticks
+    void periodic( Worker * thr, Grappa::Timestamp interval ) {
+      timers.insert( thr, Grappa::force_tick() + interval );
     }
 
     /// Reset scheduler statistics
@@ -395,6 +462,7 @@ class TaskingScheduler : public Scheduler {
     bool thread_maybe_yield( );
     bool thread_yield( );
     bool thread_yield_periodic( );
+    void thread_delay_until( Grappa::Timestamp deadline );
     void thread_suspend( );
     void thread_wake( Worker * next );
     void thread_yield_wake( Worker * next );
@@ -409,6 +477,7 @@ class TaskingScheduler : public Scheduler {
 
     friend std::ostream& operator<<( std::ostream& o, const TaskingScheduler& ts );
     friend void workerLoop ( Worker *, void * );
+    friend void continuationLoop ( Worker *, void * );
 };  
 
 /// Arguments to workerLoop() worker Worker routine
@@ -428,7 +497,7 @@ inline bool TaskingScheduler::thread_maybe_yield( ) {
   // tick the timestap counter
   Grappa::Timestamp current_ts = Grappa::force_tick();
   
-  if( should_run_periodic( current_ts ) ) {
+  if( current_ts >= timers.next_deadline() ) {
     yielded = true;
     thread_yield();
   }
@@ -442,6 +511,7 @@ inline bool TaskingScheduler::thread_maybe_yield( ) {
 /// Cannot be called during the master Worker.
 inline bool TaskingScheduler::thread_yield( ) {
   CHECK( current_thread != master ) << "can't yield on a system Worker";
+  maybe_promote_continuation();
   StateTimer::enterState_scheduler();
 
   ready( current_thread ); 
@@ -462,6 +532,7 @@ inline bool TaskingScheduler::thread_yield( ) {
 /// Cannot be called during the master Worker.
 inline bool TaskingScheduler::thread_yield_periodic( ) {
   CHECK( current_thread != master ) << "can't yield on a system Worker";
+  maybe_promote_continuation();
   StateTimer::enterState_scheduler();
 
   periodic( current_thread ); 
@@ -478,10 +549,28 @@ inline bool TaskingScheduler::thread_yield_periodic( ) {
   return gotRescheduled; // 0=another ran; 1=me got rescheduled immediately
 }
 
+/// Sleep the current Worker until the timestamp counter reaches deadline.
+/// Cannot be called during the master Worker.
+inline void TaskingScheduler::thread_delay_until( Grappa::Timestamp deadline ) {
+  CHECK( current_thread != master ) << "can't delay a system Worker";
+  maybe_promote_continuation();
+  StateTimer::enterState_scheduler();
+
+  timers.insert( current_thread, deadline );
+
+  Worker * delayedThr = current_thread;
+
+  Worker * next = nextCoroutine( );
+
+  current_thread = next;
+  thread_context_switch( delayedThr, next, NULL);
+}
+
 /// Suspend the current Worker. Worker is not placed on any queue.
 /// Cannot be called during the master Worker.
 inline void TaskingScheduler::thread_suspend( ) {
   CHECK( current_thread != master ) << "can't yield on a system Worker";
+  maybe_promote_continuation();
   CHECK( current_thread->running ) << "may only suspend a running coroutine";
   StateTimer::enterState_scheduler();
 
@@ -515,6 +604,7 @@ inline void TaskingScheduler::thread_wake( Worker * next ) {
 /// For now, waking a queued Worker is also a fatal error. 
 inline void TaskingScheduler::thread_yield_wake( Worker * next ) {    
   CHECK( current_thread != master ) << "can't yield on a system Worker";
+  maybe_promote_continuation();
   CHECK( next->sched == static_cast<Scheduler*>(this) ) << "can only wake a Worker on your scheduler";
   CHECK( next->next == NULL ) << "woken Worker should not be on any queue";
   CHECK( !next->running ) << "woken Worker should not be running";
@@ -534,6 +624,7 @@ inline void TaskingScheduler::thread_yield_wake( Worker * next ) {
 /// For now, waking a queued Worker is also a fatal error. 
 inline void TaskingScheduler::thread_suspend_wake( Worker *next ) {
   CHECK( current_thread != master ) << "can't yield on a system Worker";
+  maybe_promote_continuation();
   CHECK( next->next == NULL ) << "woken Worker should not be on any queue";
   CHECK( !next->running ) << "woken Worker should not be running";
   StateTimer::enterState_scheduler();
@@ -612,6 +703,12 @@ static inline void yield() { impl::global_scheduler.thread_yield(); }
 /// Yield to scheduler, placing current Worker on periodic queue.
 static inline void yield_periodic() { impl::global_scheduler.thread_yield_periodic( ); }
 
+/// Sleep the current Worker until the timestamp counter reaches deadline.
+static inline void delay_until( Timestamp deadline ) { impl::global_scheduler.thread_delay_until( deadline ); }
+
+/// Sleep the current Worker for at least ticks timestamp ticks.
+static inline void delay_for( Timestamp ticks ) { delay_until( force_tick() + ticks ); }
+
 /// Yield to scheduler, suspending current Worker.
 static inline void suspend() {
   DVLOG(5) << "suspending Worker " << impl::global_scheduler.get_current_thread() << "(# " << impl::global_scheduler.get_current_thread()->id << ")";
@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2010-2015, University of Washington and Battelle
+// Memorial Institute.  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//     * Redistributions of source code must retain the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials
+//       provided with the distribution.
+//     * Neither the name of the University of Washington, Battelle
+//       Memorial Institute, or the names of their contributors may be
+//       used to endorse or promote products derived from this
+//       software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// UNIVERSITY OF WASHINGTON OR BATTELLE MEMORIAL INSTITUTE BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Worker.hpp"
+#include "Timestamp.hpp"
+#include <limits>
+#include <glog/logging.h>
+#include <iostream>
+
+namespace Grappa {
+namespace impl {
+
+/// Hierarchical timer wheel of sleeping Workers, each with a wakeup
+/// deadline in timestamp ticks. Level 0 has one slot per
+/// 2^resolution_bits ticks; each level above covers 64 slots of the
+/// one below, so inserting and expiring a timer is O(1) and the
+/// scheduler only has to look at the wheel when the earliest
+/// deadline comes due. Workers are linked through their next field,
+/// so a Worker must not be on any other queue while it's here.
+class TimerWheel {
+  private:
+    static const int slot_bits = 6;
+    static const int slots = 1 << slot_bits;
+    static const int levels = 4;
+
+    int resolution_bits;
+
+    /// each slot is an unordered list of Workers
+    Worker * wheel[ levels ][ slots ];
+    uint64_t level_count[ levels ];
+
+    /// the wheel has been advanced to this level-0 slot
+    int64_t current;
+
+    /// no timer is due before this timestamp
+    Grappa::Timestamp earliest;
+
+    /// timers that are due, waiting to be run, in order of expiry
+    Worker * expired_head;
+    Worker * expired_tail;
+
+    uint64_t len;
+
+    inline void push_expired( Worker * w ) {
+      w->next = NULL;
+      if( expired_head == NULL ) {
+        expired_head = w;
+      } else {
+        expired_tail->next = w;
+      }
+      expired_tail = w;
+    }
+
+    /// file a Worker in the slot for its deadline, relative to current;
+    /// round up, so a slot only expires once all its deadlines have passed
+    inline void place( Worker * w ) {
+      int64_t slot = ( w->wakeup + (1L << resolution_bits) - 1 ) >> resolution_bits;
+      int64_t delta = slot - current;
+      if( delta <= 0 ) {
+        push_expired( w );
+        return;
+      }
+      int level = 0;
+      while( level < levels - 1 && delta >= (1L << (slot_bits * (level + 1))) ) {
+        level++;
+      }
+      int64_t index;
+      if( delta >= (1L << (slot_bits * levels)) ) {
+        // past the end of the wheel: park in the farthest top-level
+        // slot, and re-file when it comes around
+        index = ( (current >> (slot_bits * (levels - 1))) - 1 ) & (slots - 1);
+      } else {
+        index = ( slot >> (slot_bits * level) ) & (slots - 1);
+      }
+      w->next = wheel[level][index];
+      wheel[level][index] = w;
+      level_count[level]++;
+    }
+
+    /// recompute a lower bound on the next deadline
+    inline void update_earliest() {
+      earliest = std::numeric_limits< Grappa::Timestamp >::max();
+      if( expired_head != NULL ) {
+        earliest = 0;
+        return;
+      }
+      if( level_count[0] > 0 ) {
+        for( int64_t i = 1; i <= slots; ++i ) {
+          if( wheel[0][ (current + i) & (slots - 1) ] != NULL ) {
+            earliest = (current + i) << resolution_bits;
+            break;
+          }
+        }
+      }
+      if( level_count[1] + level_count[2] + level_count[3] > 0 ) {
+        // nothing up there is due before the next level-1 boundary
+        int64_t boundary = ( ( (current >> slot_bits) + 1 ) << slot_bits ) << resolution_bits;
+        if( boundary < earliest ) earliest = boundary;
+      }
+    }
+
+  public:
+    TimerWheel()
+      : resolution_bits( 10 )
+      , current( 0 )
+      , earliest( std::numeric_limits< Grappa::Timestamp >::max() )
+      , expired_head( NULL )
+      , expired_tail( NULL )
+      , len( 0 )
+    {
+      for( int level = 0; level < levels; ++level ) {
+        level_count[level] = 0;
+        for( int i = 0; i < slots; ++i ) {
+          wheel[level][i] = NULL;
+        }
+      }
+    }
+
+    /// Start the wheel at the current time.
+    void init( Grappa::Timestamp now, int resolution_bits_arg ) {
+      CHECK_EQ( len, 0 ) << "can't restart a wheel with timers in it";
+      resolution_bits = resolution_bits_arg;
+      current = now >> resolution_bits;
+    }
+
+    /// Wake this Worker once the timestamp reaches deadline.
+    void insert( Worker * w, Grappa::Timestamp deadline ) {
+      w->wakeup = deadline;
+      len++;
+      place( w );
+      if( deadline < earliest ) earliest = deadline;
+    }
+
+    /// Lower bound on the next deadline; don't bother calling
+    /// advance() before then.
+    Grappa::Timestamp next_deadline() const { return earliest; }
+
+    /// Move every timer due by now to the expired list.
+    void advance( Grappa::Timestamp now ) {
+      int64_t target = now >> resolution_bits;
+      if( level_count[0] + level_count[1] + level_count[2] + level_count[3] == 0 ) {
+        if( target > current ) current = target;
+        update_earliest();
+        return;
+      }
+      while( current < target ) {
+        current++;
+
+        // cascade higher levels whose slot boundary we just crossed
+        for( int level = 1; level < levels; ++level ) {
+          if( ( current & ( (1L << (slot_bits * level)) - 1 ) ) != 0 ) break;
+          int64_t index = ( current >> (slot_bits * level) ) & (slots - 1);
+          Worker * w = wheel[level][index];
+          wheel[level][index] = NULL;
+          while( w != NULL ) {
+            Worker * next = w->next;
+            level_count[level]--;
+            place( w );
+            w = next;
+          }
+        }
+
+        // expire this level-0 slot; anything not yet due (a deadline
+        // of now+1 seen late, say) moves on to the next slot
+        int64_t index = current & (slots - 1);
+        Worker * w = wheel[0][index];
+        wheel[0][index] = NULL;
+        while( w != NULL ) {
+          Worker * next = w->next;
+          if( w->wakeup > now ) {
+            int64_t later = (current + 1) & (slots - 1);
+            w->next = wheel[0][later];
+            wheel[0][later] = w;
+          } else {
+            level_count[0]--;
+            push_expired( w );
+          }
+          w = next;
+        }
+      }
+      update_earliest();
+    }
+
+    /// Take the next Worker whose deadline has passed, if any.
+    Worker * dequeue_expired() {
+      Worker * w = expired_head;
+      if( w != NULL ) {
+        expired_head = w->next;
+        w->next = NULL;
+        len--;
+        if( expired_head == NULL ) update_earliest();
+      }
+      return w;
+    }
+
+    uint64_t length() const { return len; }
+    bool empty() const { return len == 0; }
+
+    std::ostream& dump( std::ostream& o ) const {
+      return o << "[length:" << len
+               << "; current:" << current
+               << "; earliest:" << earliest << "]";
+    }
+};
+
+} // namespace impl
+} // namespace Grappa
+
+inline std::ostream& operator<<( std::ostream& o, const Grappa::impl::TimerWheel& tw ) {
+  return tw.dump( o );
+}